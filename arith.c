@@ -0,0 +1,403 @@
+/**
+ * Integer expression evaluator for $(( )) and let.
+ *
+ * The tokenizer reads numbers in place and takes the longest operator. The
+ * parser is a Pratt parser: every operator has a binding power and an
+ * expression keeps taking operators while they bind tighter than the one
+ * it was called with.
+ */
+#define _GNU_SOURCE
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "vect.h"
+#include "vars.h"
+#include "arith.h"
+
+// Kinds of token in an expression
+enum arith_token {
+  ARITH_NUM,
+  ARITH_NAME,
+  ARITH_OP,
+  ARITH_END
+};
+
+/** State of the parser while it walks the expression. */
+typedef struct arith {
+  const char *input;
+  int pos;
+  enum arith_token type;   /* Kind of the current token. */
+  long long value;         /* Value of a number token. */
+  char *text;              /* Text of a name or operator token. */
+  int error;
+  int noeval;              /* Above 0 while parsing a side that isn't evaluated. */
+} arith_t;
+
+// Operators, longest first so the tokenizer always takes the longest match
+static const char *OPERATORS[] = {
+  "<<=", ">>=",
+  "++", "--", "<<", ">>", "<=", ">=", "==", "!=", "&&", "||",
+  "+=", "-=", "*=", "/=", "%=", "&=", "^=", "|=",
+  "+", "-", "*", "/", "%", "<", ">", "&", "^", "|", "!", "~",
+  "?", ":", "=", ",", "(", ")",
+  NULL
+};
+
+// Binding power of the operators that go between two values
+#define BP_COMMA 1
+#define BP_ASSIGN 2
+#define BP_TERNARY 3
+#define BP_MULTIPLY 13
+#define BP_UNARY 14
+
+long long parseExpr(arith_t *p, int minBp);
+
+// Checks if the character is a digit
+int is_digit(char ch) {
+  // this relies on the fact that digits are ordered in the ASCII table
+  return ch >= '0' && ch <= '9';
+}
+
+// Checks if the character can be part of a variable name
+int isNameChar(char ch) {
+  return (ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z')
+    || is_digit(ch) || ch == '_';
+}
+
+// Reports an error, only the first one is printed
+void arithError(arith_t *p, const char *msg) {
+  if (!p->error) {
+    fprintf(stderr, "arithmetic: %s in '%s'\n", msg, p->input);
+  }
+  p->error = 1;
+}
+
+// Moves on to the next token
+void nextToken(arith_t *p) {
+  const char *input = p->input;
+  free(p->text);
+  p->text = NULL;
+
+  while (input[p->pos] == ' ' || input[p->pos] == '\t' || input[p->pos] == '\n') {
+    p->pos++;
+  }
+
+  if (input[p->pos] == '\0') {
+    p->type = ARITH_END;
+    return;
+  }
+
+  // Numbers, in decimal, in hex with 0x or in octal with a leading 0
+  if (is_digit(input[p->pos])) {
+    p->type = ARITH_NUM;
+    if (input[p->pos] == '0' && (input[p->pos+1] == 'x' || input[p->pos+1] == 'X')) {
+      char *end;
+      p->value = (long long) strtoull(input + p->pos + 2, &end, 16);
+      p->pos = end - input;
+      return;
+    }
+    if (input[p->pos] == '0' && is_digit(input[p->pos+1])) {
+      char *end;
+      p->value = (long long) strtoull(input + p->pos, &end, 8);
+      p->pos = end - input;
+      if (is_digit(input[p->pos])) {
+	arithError(p, "invalid octal number");
+	p->type = ARITH_END;
+      }
+      return;
+    }
+
+    // The digits are read in place, strtoll stops at the first other character
+    char *end;
+    p->value = strtoll(input + p->pos, &end, 10);
+    p->pos = end - input;
+    return;
+  }
+
+  // Variable names, the $ in front is allowed but not needed
+  int start = p->pos;
+  if (input[start] == '$' && isNameChar(input[start+1])) {
+    start++;
+  }
+  if (isNameChar(input[start])) {
+    int end = start;
+    while (isNameChar(input[end])) {
+      end++;
+    }
+    p->type = ARITH_NAME;
+    p->text = strndup(input + start, end - start);
+    p->pos = end;
+    return;
+  }
+
+  for (int i = 0; OPERATORS[i] != NULL; i++) {
+    int len = strlen(OPERATORS[i]);
+    if (strncmp(input + p->pos, OPERATORS[i], len) == 0) {
+      p->type = ARITH_OP;
+      p->text = strdup(OPERATORS[i]);
+      p->pos += len;
+      return;
+    }
+  }
+
+  arithError(p, "unexpected character");
+  p->type = ARITH_END;
+}
+
+// Checks if the current token is the given operator
+int isOp(arith_t *p, const char *op) {
+  return p->type == ARITH_OP && strcmp(p->text, op) == 0;
+}
+
+// Binding power of an operator between two values, 0 if it isn't one
+int infixBp(const char *op) {
+  if (strcmp(op, ",") == 0) return BP_COMMA;
+  if (strcmp(op, "?") == 0) return BP_TERNARY;
+  if (strcmp(op, "||") == 0) return 4;
+  if (strcmp(op, "&&") == 0) return 5;
+  if (strcmp(op, "|") == 0) return 6;
+  if (strcmp(op, "^") == 0) return 7;
+  if (strcmp(op, "&") == 0) return 8;
+  if (strcmp(op, "==") == 0 || strcmp(op, "!=") == 0) return 9;
+  if (strcmp(op, "<") == 0 || strcmp(op, "<=") == 0
+      || strcmp(op, ">") == 0 || strcmp(op, ">=") == 0) return 10;
+  if (strcmp(op, "<<") == 0 || strcmp(op, ">>") == 0) return 11;
+  if (strcmp(op, "+") == 0 || strcmp(op, "-") == 0) return 12;
+  if (strcmp(op, "*") == 0 || strcmp(op, "/") == 0 || strcmp(op, "%") == 0) return BP_MULTIPLY;
+  return 0;
+}
+
+// Checks if the operator is = or one of the compound assignments
+int isAssignOp(const char *op) {
+  int len = strlen(op);
+  return op[len-1] == '=' && strcmp(op, "==") != 0 && strcmp(op, "!=") != 0
+    && strcmp(op, "<=") != 0 && strcmp(op, ">=") != 0;
+}
+
+// Applies a binary operator, the arithmetic wraps around like in other shells
+long long applyOp(arith_t *p, const char *op, long long a, long long b) {
+  unsigned long long ua = a;
+  unsigned long long ub = b;
+
+  if (op[0] == '+') return (long long) (ua + ub);
+  if (op[0] == '-') return (long long) (ua - ub);
+  if (op[0] == '*') return (long long) (ua * ub);
+  if (op[0] == '/' || op[0] == '%') {
+    if (b == 0) {
+      if (!p->noeval) {
+	arithError(p, "division by 0");
+      }
+      return 0;
+    }
+    // The one division that overflows
+    if (b == -1) {
+      return op[0] == '/' ? (long long) (0 - ua) : 0;
+    }
+    return op[0] == '/' ? a / b : a % b;
+  }
+  if (strncmp(op, "<<", 2) == 0) return (long long) (ua << (ub & 63));
+  if (strncmp(op, ">>", 2) == 0) return a >> (ub & 63);
+  if (strcmp(op, "<") == 0) return a < b;
+  if (strcmp(op, "<=") == 0) return a <= b;
+  if (strcmp(op, ">") == 0) return a > b;
+  if (strcmp(op, ">=") == 0) return a >= b;
+  if (strcmp(op, "==") == 0) return a == b;
+  if (strcmp(op, "!=") == 0) return a != b;
+  if (op[0] == '&') return a & b;
+  if (op[0] == '^') return a ^ b;
+  if (op[0] == '|') return a | b;
+
+  arithError(p, "unknown operator");
+  return 0;
+}
+
+// Gets the value of a variable as a number
+long long varValue(const char *name) {
+  const char *value = getVar(name);
+  if (value == NULL || value[0] == '\0') {
+    return 0;
+  }
+  return strtoll(value, NULL, 0);
+}
+
+// Stores a number in a variable, unless this side isn't being evaluated
+void storeVar(arith_t *p, const char *name, long long value) {
+  if (p->noeval || p->error) {
+    return;
+  }
+  char number[32];
+  snprintf(number, sizeof(number), "%lld", value);
+  setVar(name, number);
+}
+
+// Parses what can start an expression: numbers, variables, unary operators
+// and parentheses
+long long parsePrefix(arith_t *p, int minBp) {
+  if (p->type == ARITH_NUM) {
+    long long value = p->value;
+    nextToken(p);
+    return value;
+  }
+
+  if (p->type == ARITH_NAME) {
+    char *name = strdup(p->text);
+    nextToken(p);
+    long long value = varValue(name);
+
+    // Postfix ++ and -- give the old value
+    if (isOp(p, "++") || isOp(p, "--")) {
+      storeVar(p, name, p->text[0] == '+' ? value + 1 : value - 1);
+      nextToken(p);
+    }
+    // Assignments are right associative
+    else if (p->type == ARITH_OP && isAssignOp(p->text) && minBp < BP_ASSIGN) {
+      char *op = strdup(p->text);
+      nextToken(p);
+      long long rhs = parseExpr(p, BP_ASSIGN - 1);
+      if (strcmp(op, "=") == 0) {
+	value = rhs;
+      }
+      else {
+	op[strlen(op) - 1] = '\0';
+	value = applyOp(p, op, value, rhs);
+      }
+      storeVar(p, name, value);
+      free(op);
+    }
+
+    free(name);
+    return value;
+  }
+
+  if (p->type != ARITH_OP) {
+    arithError(p, "missing value");
+    return 0;
+  }
+
+  if (isOp(p, "(")) {
+    nextToken(p);
+    long long value = parseExpr(p, 0);
+    if (!isOp(p, ")")) {
+      arithError(p, "missing )");
+      return 0;
+    }
+    nextToken(p);
+    return value;
+  }
+
+  // Prefix ++ and -- give the new value
+  if (isOp(p, "++") || isOp(p, "--")) {
+    int up = p->text[0] == '+';
+    nextToken(p);
+    if (p->type != ARITH_NAME) {
+      arithError(p, "++ and -- need a variable");
+      return 0;
+    }
+    long long value = varValue(p->text) + (up ? 1 : -1);
+    storeVar(p, p->text, value);
+    nextToken(p);
+    return value;
+  }
+
+  char op = p->text[0];
+  if (p->text[1] == '\0' && (op == '-' || op == '+' || op == '!' || op == '~')) {
+    nextToken(p);
+    unsigned long long value = parseExpr(p, BP_UNARY - 1);
+    if (op == '-') return (long long) (0 - value);
+    if (op == '!') return value == 0;
+    if (op == '~') return (long long) ~value;
+    return value;
+  }
+
+  arithError(p, "unexpected operator");
+  return 0;
+}
+
+// Parses an expression made of operators that bind tighter than minBp
+long long parseExpr(arith_t *p, int minBp) {
+  long long left = parsePrefix(p, minBp);
+
+  while (!p->error && p->type == ARITH_OP) {
+    int bp = infixBp(p->text);
+    if (bp == 0 || bp <= minBp) {
+      break;
+    }
+    char *op = strdup(p->text);
+    nextToken(p);
+
+    if (strcmp(op, "?") == 0) {
+      // Only the chosen side is evaluated
+      if (!left) p->noeval++;
+      long long yes = parseExpr(p, 0);
+      if (!left) p->noeval--;
+
+      if (!isOp(p, ":")) {
+	arithError(p, "missing : for ?");
+	free(op);
+	return 0;
+      }
+      nextToken(p);
+
+      if (left) p->noeval++;
+      long long no = parseExpr(p, BP_TERNARY - 1);
+      if (left) p->noeval--;
+      left = left ? yes : no;
+    }
+    else if (strcmp(op, "&&") == 0 || strcmp(op, "||") == 0) {
+      // The right side only runs when it can change the answer
+      int skip = op[0] == '&' ? !left : left != 0;
+      if (skip) p->noeval++;
+      long long right = parseExpr(p, bp);
+      if (skip) p->noeval--;
+      left = op[0] == '&' ? (left && right) : (left || right);
+    }
+    else if (strcmp(op, ",") == 0) {
+      left = parseExpr(p, bp);
+    }
+    else {
+      long long right = parseExpr(p, bp);
+      left = applyOp(p, op, left, right);
+    }
+    free(op);
+  }
+
+  return left;
+}
+
+int evalArith(const char *expr, long long *result) {
+  arith_t p = { expr, 0, ARITH_END, 0, NULL, 0, 0 };
+  nextToken(&p);
+
+  // An empty expression is 0
+  long long value = 0;
+  if (p.type != ARITH_END) {
+    value = parseExpr(&p, 0);
+  }
+  if (!p.error && p.type != ARITH_END) {
+    arithError(&p, "unexpected token");
+  }
+
+  free(p.text);
+  if (p.error) {
+    return -1;
+  }
+  *result = value;
+  return 0;
+}
+
+int letCmd(vect_t *tokens) {
+  if (vect_size(tokens) < 2) {
+    fprintf(stderr, "let: expression expected\n");
+    return 1;
+  }
+
+  long long value = 0;
+  for (int i = 1; i < vect_size(tokens); i++) {
+    if (evalArith(vect_get(tokens, i), &value) == -1) {
+      return 1;
+    }
+  }
+  return value != 0 ? 0 : 1;
+}
@@ -0,0 +1,18 @@
+#ifndef _ARITH_H
+#define _ARITH_H
+
+#include "vect.h"
+
+/** Evaluates an integer expression with the usual C operators, including
+ *  assignments to shell variables. Numbers are decimal, hex with 0x, or
+ *  octal with a leading 0 like in C, so 010 is 8. Variables can be written
+ *  as name or $name, and unset or empty variables count as 0. $(( )) expands
+ *  the expression before it gets here. Returns 0 and stores the value in
+ *  result on success, or prints an error and returns -1. */
+int evalArith(const char *expr, long long *result);
+
+/** The let built in. Evaluates each argument and returns 0 if the last one
+ *  was not zero, otherwise 1. */
+int letCmd(vect_t *tokens);
+
+#endif /* ifndef _ARITH_H */
@@ -0,0 +1,249 @@
+#define _GNU_SOURCE
+#include <assert.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#include "vect.h"
+#include "shell.h"
+#include "cache.h"
+#include "stats.h"
+#include "bench.h"
+
+/** One command being measured. */
+typedef struct bench_target {
+  char *text;            /* The command as it was given. */
+  parsed_line_t *line;
+  uint64_t *times;       /* Nanoseconds of each timed run. */
+  double userMs;         /* CPU time of the runs, the shell's and its children's. */
+  double sysMs;
+  long switches;         /* Voluntary and involuntary context switches. */
+} bench_target_t;
+
+// Adds up the rusage of the shell and of the children it waited for
+void totalUsage(struct rusage *total);
+
+// Milliseconds in a timeval
+double timevalMs(struct timeval tv);
+
+// Runs the command once, timing it and adding its rusage to the target
+uint64_t benchRun(bench_target_t *target);
+
+// Orders two run times for qsort
+int compareTimes(const void *a, const void *b);
+
+// Adds a row of the report with one value for each target
+int reportRow(char *out, size_t cap, const char *label, double *values, int count);
+
+// Adds up the rusage of the shell and of the children it waited for
+void totalUsage(struct rusage *total) {
+  struct rusage self;
+  struct rusage children;
+  getrusage(RUSAGE_SELF, &self);
+  getrusage(RUSAGE_CHILDREN, &children);
+
+  timeradd(&self.ru_utime, &children.ru_utime, &total->ru_utime);
+  timeradd(&self.ru_stime, &children.ru_stime, &total->ru_stime);
+  total->ru_nvcsw = self.ru_nvcsw + children.ru_nvcsw;
+  total->ru_nivcsw = self.ru_nivcsw + children.ru_nivcsw;
+}
+
+// Milliseconds in a timeval
+double timevalMs(struct timeval tv) {
+  return tv.tv_sec * 1000.0 + tv.tv_usec / 1000.0;
+}
+
+// Runs the command once, timing it and adding its rusage to the target
+uint64_t benchRun(bench_target_t *target) {
+  struct rusage before;
+  struct rusage after;
+  totalUsage(&before);
+
+  uint64_t start = statClock();
+  runParsed(target->line, 0);
+  uint64_t elapsed = statClock() - start;
+
+  totalUsage(&after);
+  target->userMs += timevalMs(after.ru_utime) - timevalMs(before.ru_utime);
+  target->sysMs += timevalMs(after.ru_stime) - timevalMs(before.ru_stime);
+  target->switches += (after.ru_nvcsw - before.ru_nvcsw) + (after.ru_nivcsw - before.ru_nivcsw);
+  return elapsed;
+}
+
+// Orders two run times for qsort
+int compareTimes(const void *a, const void *b) {
+  uint64_t x = *(const uint64_t *) a;
+  uint64_t y = *(const uint64_t *) b;
+  return (x > y) - (x < y);
+}
+
+// Adds a row of the report with one value for each target
+int reportRow(char *out, size_t cap, const char *label, double *values, int count) {
+  int len = snprintf(out, cap, "%-14s", label);
+  for (int i = 0; i < count; i++) {
+    len += snprintf(out + len, cap - len, " %16.1f", values[i]);
+  }
+  len += snprintf(out + len, cap - len, "\n");
+  return len;
+}
+
+int benchCmd(vect_t *tokens) {
+  char usage[] = "usage: bench [-n N] [-w WARMUP] -- command [-- command]\n";
+  int runs = BENCH_DEFAULT_RUNS;
+  int warmup = BENCH_DEFAULT_WARMUP;
+
+  int i = 1;
+  while (i < vect_size(tokens) && strcmp(vect_get(tokens, i), "--") != 0) {
+    const char *opt = vect_get(tokens, i);
+    const char *arg = i + 1 < vect_size(tokens) ? vect_get(tokens, i + 1) : NULL;
+    if (strcmp(opt, "-n") == 0 && arg != NULL && atoi(arg) > 0) {
+      runs = atoi(arg);
+    }
+    else if (strcmp(opt, "-w") == 0 && arg != NULL && atoi(arg) >= 0) {
+      warmup = atoi(arg);
+    }
+    else {
+      assert(write(2, usage, strlen(usage)) == strlen(usage));
+      return 1;
+    }
+    i += 2;
+  }
+
+  // Each command is the words between one -- and the next
+  bench_target_t targets[BENCH_MAX_COMMANDS];
+  int count = 0;
+  int ok = i < vect_size(tokens);
+  while (ok && i < vect_size(tokens)) {
+    i++;
+    int end = i;
+    while (end < vect_size(tokens) && strcmp(vect_get(tokens, end), "--") != 0) {
+      end++;
+    }
+    if (end == i || count == BENCH_MAX_COMMANDS) {
+      ok = 0;
+      break;
+    }
+
+    bench_target_t *target = &targets[count];
+    memset(target, 0, sizeof(bench_target_t));
+    count++;
+
+    // Parsed once here, every run reuses the tree
+    target->line = parseWords(tokens, i, end, &target->text);
+    if (target->line == NULL) {
+      fprintf(stderr, "bench: syntax error in %s", target->text);
+      ok = 0;
+      break;
+    }
+    target->times = malloc(runs * sizeof(uint64_t));
+    i = end;
+  }
+
+  if (!ok || count == 0) {
+    if (count == 0 || targets[count - 1].line != NULL) {
+      assert(write(2, usage, strlen(usage)) == strlen(usage));
+    }
+    for (int t = 0; t < count; t++) {
+      releaseLine(targets[t].line);
+      free(targets[t].text);
+      free(targets[t].times);
+    }
+    return 1;
+  }
+
+  // The commands take turns so they see the same conditions
+  for (int r = 0; r < warmup && status == 0; r++) {
+    for (int t = 0; t < count; t++) {
+      runParsed(targets[t].line, 0);
+    }
+  }
+  for (int t = 0; t < count; t++) {
+    targets[t].userMs = 0;
+    targets[t].sysMs = 0;
+    targets[t].switches = 0;
+  }
+  int done = 0;
+  for (; done < runs && status == 0; done++) {
+    for (int t = 0; t < count; t++) {
+      targets[t].times[done] = benchRun(&targets[t]);
+    }
+  }
+
+  double mins[BENCH_MAX_COMMANDS];
+  double means[BENCH_MAX_COMMANDS];
+  double medians[BENCH_MAX_COMMANDS];
+  double p95s[BENCH_MAX_COMMANDS];
+  double stddevs[BENCH_MAX_COMMANDS];
+  double users[BENCH_MAX_COMMANDS];
+  double syss[BENCH_MAX_COMMANDS];
+  double switches[BENCH_MAX_COMMANDS];
+  for (int t = 0; t < count && done > 0; t++) {
+    uint64_t *times = targets[t].times;
+    qsort(times, done, sizeof(uint64_t), compareTimes);
+
+    double sum = 0;
+    for (int r = 0; r < done; r++) {
+      sum += times[r];
+    }
+    double mean = sum / done;
+    double squares = 0;
+    for (int r = 0; r < done; r++) {
+      squares += (times[r] - mean) * (times[r] - mean);
+    }
+
+    // The p95 is the nearest rank, the run that 95% of runs are no slower than
+    int rank = (95 * done + 99) / 100 - 1;
+    mins[t] = times[0] / 1000.0;
+    means[t] = mean / 1000.0;
+    medians[t] = (done % 2 == 1 ? times[done / 2]
+		  : (times[done / 2 - 1] + times[done / 2]) / 2.0) / 1000.0;
+    p95s[t] = times[rank] / 1000.0;
+    stddevs[t] = (done > 1 ? sqrt(squares / (done - 1)) : 0) / 1000.0;
+    users[t] = targets[t].userMs;
+    syss[t] = targets[t].sysMs;
+    switches[t] = targets[t].switches;
+  }
+
+  // The report is one write so it can't mix with the commands' output
+  size_t cap = 1024;
+  for (int t = 0; t < count; t++) {
+    cap += strlen(targets[t].text) + 32;
+  }
+  char *out = malloc(cap);
+  int len = 0;
+  for (int t = 0; t < count; t++) {
+    len += snprintf(out + len, cap - len, "%s: %s", t == 0 ? "command" : "against", targets[t].text);
+  }
+  len += snprintf(out + len, cap - len, "%-14s", "runs");
+  for (int t = 0; t < count; t++) {
+    len += snprintf(out + len, cap - len, " %16d", done);
+  }
+  len += snprintf(out + len, cap - len, "\n");
+  if (done > 0) {
+    len += reportRow(out + len, cap - len, "min (us)", mins, count);
+    len += reportRow(out + len, cap - len, "mean (us)", means, count);
+    len += reportRow(out + len, cap - len, "median (us)", medians, count);
+    len += reportRow(out + len, cap - len, "p95 (us)", p95s, count);
+    len += reportRow(out + len, cap - len, "stddev (us)", stddevs, count);
+    len += reportRow(out + len, cap - len, "user (ms)", users, count);
+    len += reportRow(out + len, cap - len, "sys (ms)", syss, count);
+    len += reportRow(out + len, cap - len, "switches", switches, count);
+  }
+  if (count == 2 && done > 0 && medians[0] > 0) {
+    len += snprintf(out + len, cap - len, "median ratio   %16.2fx\n", medians[1] / medians[0]);
+  }
+  assert(write(1, out, len) == len);
+  free(out);
+
+  for (int t = 0; t < count; t++) {
+    releaseLine(targets[t].line);
+    free(targets[t].text);
+    free(targets[t].times);
+  }
+  return 0;
+}
@@ -0,0 +1,32 @@
+#ifndef _BENCH_H
+#define _BENCH_H
+
+#include "vect.h"
+
+/** Runs of each command when -n isn't given. */
+#define BENCH_DEFAULT_RUNS 10
+
+/** Untimed runs of each command before the timed ones when -w isn't given. */
+#define BENCH_DEFAULT_WARMUP 1
+
+/** Most commands bench compares at once. */
+#define BENCH_MAX_COMMANDS 2
+
+/** Runs the bench built in:
+ *
+ *    bench [-n N] [-w WARMUP] -- command [-- command]
+ *
+ *  Each command is the words up to the next --, joined with spaces, so a
+ *  pipeline has to be quoted ("ls | wc -l"). It is tokenized and parsed
+ *  once and then run N times through the executor, after WARMUP runs that
+ *  aren't timed. Each run is timed with CLOCK_MONOTONIC. When there are two
+ *  commands their runs take turns so drift affects both the same way, and
+ *  the results are printed side by side.
+ *
+ *  Prints the min, mean, median, p95 and standard deviation of the runs in
+ *  microseconds, with the user and system time and the context switches of
+ *  the shell and its children from getrusage.
+ *  Returns 0, or 1 on a usage or syntax error. */
+int benchCmd(vect_t *tokens);
+
+#endif /* ifndef _BENCH_H */
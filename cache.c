@@ -0,0 +1,291 @@
+#define _GNU_SOURCE
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include "vect.h"
+#include "token.h"
+#include "parse.h"
+#include "script.h"
+#include "heredoc.h"
+#include "stats.h"
+#include "cache.h"
+
+// Multipliers of the hash, from the murmur3 finalizer
+#define HASH_MULT_1 0xff51afd7ed558ccdULL
+#define HASH_MULT_2 0xc4ceb9fe1a85ec53ULL
+#define HASH_SEED 0x9e3779b97f4a7c15ULL
+
+static parsed_line_t *buckets[PARSE_CACHE_BUCKETS];
+static parsed_line_t *newest = NULL;
+static parsed_line_t *oldest = NULL;
+static int cachedCount = 0;
+static unsigned long hits = 0;
+static unsigned long misses = 0;
+
+// Scrambles the bits of a word so every input bit affects every output bit
+uint64_t mixWord(uint64_t x);
+
+// Finds the text in the cache without counting a hit or a miss
+parsed_line_t *findLine(const char *text, size_t len, uint64_t hash, parse_mode_t mode);
+
+// Puts a line that isn't in the recently used list at its front
+void linkNewest(parsed_line_t *line);
+
+// Moves the line to the front of the recently used list
+void touchLine(parsed_line_t *line);
+
+// Takes the line out of the recently used list
+void unlinkRecent(parsed_line_t *line);
+
+// Takes the least recently used line out of the cache
+void evictOldest();
+
+// Frees the line and everything it parsed to
+void freeLine(parsed_line_t *line);
+
+// Scrambles the bits of a word so every input bit affects every output bit
+uint64_t mixWord(uint64_t x) {
+  x ^= x >> 33;
+  x *= HASH_MULT_1;
+  x ^= x >> 33;
+  x *= HASH_MULT_2;
+  x ^= x >> 33;
+  return x;
+}
+
+uint64_t hashText(const char *text, size_t len) {
+  uint64_t hash = HASH_SEED ^ len;
+  size_t i = 0;
+  for (; i + sizeof(uint64_t) <= len; i += sizeof(uint64_t)) {
+    uint64_t word;
+    memcpy(&word, text + i, sizeof(word));
+    hash = (hash ^ mixWord(word)) * HASH_MULT_1;
+  }
+
+  // The last few bytes are padded with zeros, the length tells them apart
+  if (i < len) {
+    uint64_t word = 0;
+    memcpy(&word, text + i, len - i);
+    hash = (hash ^ mixWord(word)) * HASH_MULT_1;
+  }
+  return mixWord(hash);
+}
+
+// Finds the text in the cache without counting a hit or a miss
+parsed_line_t *findLine(const char *text, size_t len, uint64_t hash, parse_mode_t mode) {
+  parsed_line_t *line = buckets[hash & (PARSE_CACHE_BUCKETS - 1)];
+  for (; line != NULL; line = line->chain) {
+    if (line->hash == hash && line->mode == mode && line->len == len
+	&& memcmp(line->text, text, len) == 0) {
+      return line;
+    }
+  }
+  return NULL;
+}
+
+// Takes the line out of the recently used list
+void unlinkRecent(parsed_line_t *line) {
+  if (line->newer != NULL) {
+    line->newer->older = line->older;
+  }
+  else {
+    newest = line->older;
+  }
+  if (line->older != NULL) {
+    line->older->newer = line->newer;
+  }
+  else {
+    oldest = line->newer;
+  }
+  line->newer = NULL;
+  line->older = NULL;
+}
+
+// Puts a line that isn't in the recently used list at its front
+void linkNewest(parsed_line_t *line) {
+  line->older = newest;
+  if (newest != NULL) {
+    newest->newer = line;
+  }
+  newest = line;
+  if (oldest == NULL) {
+    oldest = line;
+  }
+}
+
+// Moves the line to the front of the recently used list
+void touchLine(parsed_line_t *line) {
+  if (newest != line) {
+    unlinkRecent(line);
+    linkNewest(line);
+  }
+}
+
+// Takes the least recently used line out of the cache
+// A line that is still running stays alive until it is released
+void evictOldest() {
+  parsed_line_t *line = oldest;
+  unlinkRecent(line);
+
+  parsed_line_t **link = &buckets[line->hash & (PARSE_CACHE_BUCKETS - 1)];
+  while (*link != line) {
+    link = &(*link)->chain;
+  }
+  *link = line->chain;
+  line->chain = NULL;
+
+  free(line->text);
+  line->text = NULL;
+  cachedCount--;
+  releaseLine(line);
+}
+
+// Frees the line and everything it parsed to
+void freeLine(parsed_line_t *line) {
+  if (line->prog != NULL) {
+    program_delete(line->prog);
+  }
+  cmd_delete(line->cmd);
+  free(line->text);
+  free(line);
+}
+
+parsed_line_t *parseTokens(vect_t *tokens, parse_mode_t mode, int *incomplete) {
+  *incomplete = 0;
+  uint64_t start = statClock();
+  parsed_line_t *line = calloc(1, sizeof(parsed_line_t));
+  line->mode = mode;
+  line->uses = 1;
+
+  // A line with no tokens is left with neither a program nor a tree
+  if (mode == PARSE_SCRIPT || startsScript(tokens)) {
+    line->prog = compileScript(tokens, incomplete);
+    if (line->prog == NULL) {
+      free(line);
+      line = NULL;
+    }
+  }
+  else if (vect_size(tokens) > 0) {
+    line->cmd = parseCommand(tokens);
+  }
+
+  countSince(STAT_NS_PARSE, start);
+  return line;
+}
+
+parsed_line_t *parseWords(vect_t *words, int from, int to, char **text) {
+  size_t len = 1;
+  for (int w = from; w < to; w++) {
+    len += strlen(vect_get(words, w)) + 1;
+  }
+  char *joined = (char *) calloc(len, 1);
+  for (int w = from; w < to; w++) {
+    strcat(joined, vect_get(words, w));
+    strcat(joined, w + 1 < to ? " " : "\n");
+  }
+
+  vect_t *tokens = parseInput(joined);
+  int incomplete = 0;
+  parsed_line_t *line = parseTokens(tokens, PARSE_LINE, &incomplete);
+  vect_delete(tokens);
+
+  if (text != NULL) {
+    *text = joined;
+  }
+  else {
+    free(joined);
+  }
+  return line;
+}
+
+parsed_line_t *cacheLookup(const char *text, parse_mode_t mode) {
+  size_t len = strlen(text);
+  parsed_line_t *line = findLine(text, len, hashText(text, len), mode);
+  if (line == NULL) {
+    misses++;
+    return NULL;
+  }
+
+  hits++;
+  touchLine(line);
+  line->uses++;
+  return line;
+}
+
+void cacheStore(const char *text, parsed_line_t *line) {
+  size_t len = strlen(text);
+  uint64_t hash = hashText(text, len);
+
+  // A command substitution in between may have cached the same text already
+  if (line->text != NULL || findLine(text, len, hash, line->mode) != NULL) {
+    return;
+  }
+
+  if (cachedCount == PARSE_CACHE_SIZE) {
+    evictOldest();
+  }
+
+  line->text = strndup(text, len);
+  line->len = len;
+  line->hash = hash;
+  line->chain = buckets[hash & (PARSE_CACHE_BUCKETS - 1)];
+  buckets[hash & (PARSE_CACHE_BUCKETS - 1)] = line;
+  linkNewest(line);
+  cachedCount++;
+
+  // The cache holds the line too
+  line->uses++;
+}
+
+parsed_line_t *parseText(const char *text, parse_mode_t mode, int *incomplete) {
+  *incomplete = 0;
+  parsed_line_t *line = cacheLookup(text, mode);
+  if (line != NULL) {
+    return line;
+  }
+
+  line_source_t lines = { -1, text, NULL };
+  vect_t *tokens = readScript(&lines);
+  line = parseTokens(tokens, mode, incomplete);
+  vect_delete(tokens);
+
+  if (line != NULL) {
+    cacheStore(text, line);
+  }
+  return line;
+}
+
+void releaseLine(parsed_line_t *line) {
+  if (line != NULL && --line->uses == 0) {
+    freeLine(line);
+  }
+}
+
+void clearCache() {
+  while (oldest != NULL) {
+    evictOldest();
+  }
+}
+
+int parseCacheCmd(vect_t *tokens) {
+  if (vect_size(tokens) == 2 && strcmp(vect_get(tokens, 1), "-c") == 0) {
+    clearCache();
+    hits = 0;
+    misses = 0;
+    return 0;
+  }
+  if (vect_size(tokens) != 1) {
+    char usage[] = "usage: parsecache [-c]\n";
+    assert(write(2, usage, strlen(usage)) == strlen(usage));
+    return 1;
+  }
+
+  char stats[128];
+  int len = snprintf(stats, sizeof(stats), "hits: %lu\nmisses: %lu\nlines: %d/%d\n",
+		     hits, misses, cachedCount, PARSE_CACHE_SIZE);
+  assert(write(1, stats, len) == len);
+  return 0;
+}
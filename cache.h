@@ -0,0 +1,87 @@
+#ifndef _CACHE_H
+#define _CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "vect.h"
+#include "parse.h"
+#include "script.h"
+
+/** Most lines the cache keeps before it drops the least recently used. */
+#define PARSE_CACHE_SIZE 64
+
+/** Number of hash buckets, a power of two. */
+#define PARSE_CACHE_BUCKETS 128
+
+/** How the text of a line is turned into something to run. */
+typedef enum {
+  PARSE_LINE,    /* Like a typed line: a program only when it has if, while or for. */
+  PARSE_SCRIPT   /* Always a program, like a file run with source. */
+} parse_mode_t;
+
+/** A line that has been tokenized and parsed, ready to run any number of
+ *  times. Nothing in it changes once it is built. */
+typedef struct parsed_line {
+  parse_mode_t mode;
+  program_t *prog;        /* Set when the line compiled to a program. */
+  cmd_t *cmd;             /* The command tree otherwise. */
+
+  /* Used by the cache. */
+  char *text;             /* The raw text, NULL when the line isn't cached. */
+  size_t len;
+  uint64_t hash;
+  int uses;               /* Holders of the line, it is freed when the last one lets go. */
+  struct parsed_line *chain;   /* Next line in the same bucket. */
+  struct parsed_line *newer;   /* Neighbours in the recently used list. */
+  struct parsed_line *older;
+} parsed_line_t;
+
+/** Hashes the text, eight bytes at a time. */
+uint64_t hashText(const char *text, size_t len);
+
+/** Parses the tokens the way the mode says, without caching them. The
+ *  caller holds the line and lets go of it with releaseLine.
+ *  Returns NULL on a syntax error, and also sets incomplete when the
+ *  tokens just ended too early (like an if without fi). */
+parsed_line_t *parseTokens(vect_t *tokens, parse_mode_t mode, int *incomplete);
+
+/** Joins the words from index from up to index to with spaces and parses
+ *  them as a line, without caching it, for built ins that take a command
+ *  as their arguments. The joined text, ending in a newline, is stored in
+ *  text when it isn't NULL and the caller frees it. Returns NULL on a
+ *  syntax error. */
+parsed_line_t *parseWords(vect_t *words, int from, int to, char **text);
+
+/** Finds the text in the cache and marks it as the most recently used.
+ *  Returns the line held for the caller, or NULL when it isn't there.
+ *  Every call counts as a hit or a miss. */
+parsed_line_t *cacheLookup(const char *text, parse_mode_t mode);
+
+/** Adds a line that was parsed from the text to the cache, dropping the
+ *  least recently used line when the cache is full. The caller still
+ *  holds the line. */
+void cacheStore(const char *text, parsed_line_t *line);
+
+/** Returns the parsed text from the cache, or tokenizes, parses and caches
+ *  it. Lines of the text are separated like ; does, and here-documents
+ *  take their bodies from the lines that follow. The caller holds the line
+ *  and lets go of it with releaseLine. Returns NULL like parseTokens. */
+parsed_line_t *parseText(const char *text, parse_mode_t mode, int *incomplete);
+
+/** Lets go of a line. It is freed once nothing holds it and it has left
+ *  the cache. */
+void releaseLine(parsed_line_t *line);
+
+/** Drops every line from the cache, freeing the ones nothing holds. */
+void clearCache();
+
+/** Runs the parsecache built in:
+ *
+ *    parsecache [-c]
+ *
+ *  Prints the hits, misses and lines in the cache. -c empties the cache
+ *  and sets the counters back to 0. */
+int parseCacheCmd(vect_t *tokens);
+
+#endif /* ifndef _CACHE_H */
@@ -0,0 +1,281 @@
+/**
+ * Client for ./shell --server.
+ *
+ *   ./client SOCKET [-C dir] [-e NAME=value]... -- command...
+ *       Runs the command on the server, copies its output to stdout and
+ *       stderr, and exits with its exit status.
+ *
+ *   ./client SOCKET -n COUNT [-j CLIENTS] -- command...
+ *       Load test: sends COUNT requests over CLIENTS connections at once and
+ *       reports requests per second and the p50 and p99 latency.
+ */
+#define _GNU_SOURCE
+#include <assert.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "server.h"
+
+/** The request a client sends. */
+typedef struct request {
+  const char *cwd;
+  const char **env;
+  int envCount;
+  char *line;
+} request_t;
+
+// Writes all of the buffer, returns -1 on error
+int writeAll(int fd, const void *buffer, size_t len) {
+  const char *bytes = buffer;
+  while (len > 0) {
+    ssize_t n = write(fd, bytes, len);
+    if (n == -1) {
+      if (errno == EINTR) {
+	continue;
+      }
+      return -1;
+    }
+    bytes += n;
+    len -= n;
+  }
+  return 0;
+}
+
+// Reads exactly len bytes, returns -1 on error or if the server hung up
+int readAll(int fd, void *buffer, size_t len) {
+  char *bytes = buffer;
+  while (len > 0) {
+    ssize_t n = read(fd, bytes, len);
+    if (n == 0) {
+      return -1;
+    }
+    if (n == -1) {
+      if (errno == EINTR) {
+	continue;
+      }
+      return -1;
+    }
+    bytes += n;
+    len -= n;
+  }
+  return 0;
+}
+
+// Sends one frame to the server
+int sendFrame(int fd, char type, const char *payload, uint32_t len) {
+  char header[FRAME_HEADER_SIZE];
+  header[0] = type;
+  memcpy(header + 1, &len, sizeof(len));
+  if (writeAll(fd, header, sizeof(header)) == -1) {
+    return -1;
+  }
+  return writeAll(fd, payload, len);
+}
+
+// Connects to the server socket
+int connectServer(const char *path) {
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd == -1 || connect(fd, (struct sockaddr *) &addr, sizeof(addr)) == -1) {
+    perror("client: connect");
+    exit(1);
+  }
+  return fd;
+}
+
+// Sends the request and waits for its exit status
+// When echo is set the output is copied to stdout and stderr
+int runRequest(int fd, request_t *req, int echo) {
+  if (req->cwd != NULL) {
+    sendFrame(fd, FRAME_CWD, req->cwd, strlen(req->cwd));
+  }
+  for (int i = 0; i < req->envCount; i++) {
+    sendFrame(fd, FRAME_ENV, req->env[i], strlen(req->env[i]));
+  }
+  if (sendFrame(fd, FRAME_LINE, req->line, strlen(req->line)) == -1) {
+    perror("client: send");
+    exit(1);
+  }
+
+  char *payload = malloc(SERVER_READ_SIZE);
+  size_t payloadCap = SERVER_READ_SIZE;
+
+  while (1) {
+    char header[FRAME_HEADER_SIZE];
+    uint32_t len;
+    if (readAll(fd, header, sizeof(header)) == -1) {
+      fprintf(stderr, "client: server hung up\n");
+      exit(1);
+    }
+    memcpy(&len, header + 1, sizeof(len));
+
+    if (len > payloadCap) {
+      payloadCap = len;
+      payload = realloc(payload, payloadCap);
+    }
+    if (readAll(fd, payload, len) == -1) {
+      fprintf(stderr, "client: server hung up\n");
+      exit(1);
+    }
+
+    if (header[0] == FRAME_EXIT) {
+      int32_t result;
+      memcpy(&result, payload, sizeof(result));
+      free(payload);
+      return result;
+    }
+    if (echo) {
+      writeAll(header[0] == FRAME_STDERR ? 2 : 1, payload, len);
+    }
+  }
+}
+
+// Current time in nanoseconds
+uint64_t nowNs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// Sorts latencies for qsort
+int compareLatency(const void *a, const void *b) {
+  uint64_t x = *(const uint64_t *) a;
+  uint64_t y = *(const uint64_t *) b;
+  return x < y ? -1 : x > y;
+}
+
+// Runs the load test and prints the results
+int bench(const char *path, request_t *req, int count, int clients) {
+  if (clients > count) {
+    clients = count;
+  }
+
+  int results[2];
+  assert(pipe(results) == 0);
+
+  uint64_t start = nowNs();
+
+  // Each client is its own process with its own connection
+  for (int c = 0; c < clients; c++) {
+    int share = count / clients + (c < count % clients ? 1 : 0);
+    if (fork() == 0) {
+      close(results[0]);
+      int fd = connectServer(path);
+      uint64_t *latencies = malloc(share * sizeof(uint64_t));
+      for (int i = 0; i < share; i++) {
+	uint64_t before = nowNs();
+	runRequest(fd, req, 0);
+	latencies[i] = nowNs() - before;
+      }
+      writeAll(results[1], latencies, share * sizeof(uint64_t));
+      _exit(0);
+    }
+  }
+  close(results[1]);
+
+  uint64_t *latencies = malloc(count * sizeof(uint64_t));
+  size_t got = 0;
+  ssize_t n;
+  while ((n = read(results[0], (char *) latencies + got, count * sizeof(uint64_t) - got)) > 0) {
+    got += n;
+  }
+  while (wait(NULL) > 0) {
+  }
+  uint64_t elapsed = nowNs() - start;
+
+  int done = got / sizeof(uint64_t);
+  if (done == 0) {
+    fprintf(stderr, "client: no requests finished\n");
+    return 1;
+  }
+  qsort(latencies, done, sizeof(uint64_t), compareLatency);
+
+  double seconds = elapsed / 1e9;
+  printf("requests:    %d\n", done);
+  printf("clients:     %d\n", clients);
+  printf("time:        %.3f s\n", seconds);
+  printf("rate:        %.1f requests/s\n", done / seconds);
+  printf("p50 latency: %.3f ms\n", latencies[done / 2] / 1e6);
+  printf("p99 latency: %.3f ms\n", latencies[(done * 99) / 100] / 1e6);
+
+  free(latencies);
+  return 0;
+}
+
+void usage() {
+  fprintf(stderr, "usage: client SOCKET [-C dir] [-e NAME=value]... [-n COUNT [-j CLIENTS]] -- command...\n");
+  exit(2);
+}
+
+int main(int argc, char **argv) {
+  if (argc < 3) {
+    usage();
+  }
+
+  const char *path = argv[1];
+  request_t req = { NULL, calloc(argc, sizeof(char *)), 0, NULL };
+  int count = 0;
+  int clients = 1;
+
+  int i = 2;
+  for (; i < argc && strcmp(argv[i], "--") != 0; i++) {
+    if (strcmp(argv[i], "-C") == 0 && i + 1 < argc) {
+      req.cwd = argv[++i];
+    }
+    else if (strcmp(argv[i], "-e") == 0 && i + 1 < argc) {
+      req.env[req.envCount++] = argv[++i];
+    }
+    else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+      count = atoi(argv[++i]);
+    }
+    else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+      clients = atoi(argv[++i]);
+    }
+    else {
+      usage();
+    }
+  }
+  if (i + 1 >= argc || clients < 1) {
+    usage();
+  }
+
+  // The rest of the arguments make up the command line
+  size_t len = 0;
+  for (int j = i + 1; j < argc; j++) {
+    len += strlen(argv[j]) + 1;
+  }
+  req.line = calloc(len + 1, 1);
+  for (int j = i + 1; j < argc; j++) {
+    strcat(req.line, argv[j]);
+    if (j + 1 < argc) {
+      strcat(req.line, " ");
+    }
+  }
+
+  int result;
+  if (count > 0) {
+    result = bench(path, &req, count, clients);
+  }
+  else {
+    int fd = connectServer(path);
+    result = runRequest(fd, &req, 1);
+    close(fd);
+  }
+
+  free(req.line);
+  free(req.env);
+  return result;
+}
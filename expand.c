@@ -0,0 +1,454 @@
+#define _GNU_SOURCE
+#include <assert.h>
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/mman.h>
+
+#include "vect.h"
+#include "token.h"
+#include "shell.h"
+#include "expand.h"
+#include "vars.h"
+#include "arith.h"
+#include "heredoc.h"
+#include "cache.h"
+#include "stats.h"
+#include "readbuf.h"
+
+// Reads everything from fd into a buffer that doubles in size when it fills up
+char *readAll(int fd, size_t *length);
+
+// Finds the index of the character that closes the substitution starting at start
+int findSubstitutionEnd(const char *token, int start);
+
+// Splits the string on whitespace and adds each word to the vector
+void addWords(vect_t *output, const char *str);
+
+// Finds the value of the variable reference starting at start and
+// stores the index just past the reference in end
+char *expandVariable(const char *token, int start, int *end);
+
+// Expands everything in the token, setting whole when the token was only
+// one substitution or variable. With quotes set a " starts or ends a quoted
+// part and is left out, and text in single quotes outside of one is copied
+// as it is without its quotes. status gets the exit status of each command
+// substitution when it isn't NULL
+// Returns NULL when an arithmetic expression in it failed
+char *expandWord(const char *token, int quotes, int *whole, int *status);
+
+// Reads everything from fd into a buffer that doubles in size when it fills up
+char *readAll(int fd, size_t *length) {
+  size_t capacity = CAPTURE_INITIAL_CAPACITY;
+  size_t len = 0;
+  char *buffer = (char *) malloc(capacity);
+
+  while (1) {
+    // Always leave room for the terminating byte
+    if (len + 1 >= capacity) {
+      capacity = capacity * CAPTURE_GROWTH_FACTOR;
+      buffer = realloc(buffer, capacity);
+    }
+
+    // Read as much as the free space in the buffer allows
+    ssize_t n = read(fd, buffer + len, capacity - len - 1);
+    if (n == 0) {
+      break;
+    }
+    if (n == -1) {
+      perror("Error reading command output");
+      break;
+    }
+    len += n;
+  }
+
+  // Remove the trailing newlines in place
+  while (len > 0 && buffer[len - 1] == '\n') {
+    len--;
+  }
+  buffer[len] = '\0';
+
+  *length = len;
+  return buffer;
+}
+
+char *captureOutput(const char *cmd, size_t *length, int *status) {
+  // The same substitution in a loop is only parsed the first time
+  int incomplete = 0;
+  parsed_line_t *line = parseText(cmd, PARSE_LINE, &incomplete);
+  if (line == NULL) {
+    if (incomplete) {
+      char early[] = "syntax error: unexpected end of input\n";
+      assert(write(2, early, strlen(early)) == strlen(early));
+    }
+    *status = 2;
+    *length = 0;
+    return strdup("");
+  }
+
+  // Built ins that only print are run right here. Nothing reads their
+  // output until they return, so it goes to memory instead of a pipe that
+  // more than a pipe full would block on
+  cmd_t *tree = line->cmd;
+  int memory = -1;
+  if (tree != NULL && tree->type == CMD_SIMPLE && tree->redirs == NULL
+      && vect_size(tree->words) > 0 && isPureBuiltIn(tree->words)) {
+    memory = memfd_create("substitution", MFD_CLOEXEC);
+  }
+  if (memory != -1) {
+    int saved_stdout = dup(1);
+    dup2(memory, STDOUT_FILENO);
+    *status = processBuiltIn(tree->words);
+    dup2(saved_stdout, STDOUT_FILENO);
+    close(saved_stdout);
+
+    lseek(memory, 0, SEEK_SET);
+    char *output = readAll(memory, length);
+    close(memory);
+    releaseLine(line);
+    return output;
+  }
+
+  int pipe_fd[2];
+  assert(pipe(pipe_fd) == 0);
+
+  // Make the pipe bigger so the command rarely has to wait for us to read
+  fcntl(pipe_fd[1], F_SETPIPE_SZ, CAPTURE_PIPE_SIZE);
+
+  // The command reads stdin from where the read built in stopped
+  returnReadAhead();
+  int pid = countedFork();
+  if (pid == 0) {
+    close(pipe_fd[0]);
+    dup2(pipe_fd[1], STDOUT_FILENO);
+    close(pipe_fd[1]);
+
+    _exit(runParsed(line, 1));
+  }
+  else if (pid < 0) {
+    perror("Error - fork failed");
+    exit(1);
+  }
+
+  close(pipe_fd[1]);
+  char *output = readAll(pipe_fd[0], length);
+  close(pipe_fd[0]);
+  int wstatus = 0;
+  countedWaitpid(pid, &wstatus, 0);
+  *status = exitStatus(wstatus);
+
+  releaseLine(line);
+  return output;
+}
+
+char *appendString(char *dest, size_t *len, size_t *cap, const char *src, size_t n) {
+  while (*len + n + 1 > *cap) {
+    *cap = *cap * CAPTURE_GROWTH_FACTOR;
+    dest = realloc(dest, *cap);
+  }
+  memcpy(dest + *len, src, n);
+  *len += n;
+  dest[*len] = '\0';
+  return dest;
+}
+
+// Finds the index of the character that closes the substitution starting at start
+int findSubstitutionEnd(const char *token, int start) {
+  int len = strlen(token);
+
+  if (token[start] == '`') {
+    int i = start + 1;
+    while (i < len && token[i] != '`') {
+      i++;
+    }
+    return i;
+  }
+
+  int depth = 1;
+  int i = start + 2;
+  while (i < len) {
+    if (token[i] == '(') {
+      depth++;
+    }
+    else if (token[i] == ')') {
+      depth--;
+      if (depth == 0) {
+	break;
+      }
+    }
+    i++;
+  }
+  return i;
+}
+
+// Splits the string on whitespace and adds each word to the vector
+void addWords(vect_t *output, const char *str) {
+  char *copy = strdup(str);
+  char *save = NULL;
+  char *word = strtok_r(copy, " \t\n", &save);
+  while (word != NULL) {
+    vect_add(output, word);
+    word = strtok_r(NULL, " \t\n", &save);
+  }
+  free(copy);
+}
+
+// Finds the value of the variable reference starting at start and
+// stores the index just past the reference in end
+char *expandVariable(const char *token, int start, int *end) {
+  int i = start + 1;
+
+  // $? is the exit status of the last command
+  if (token[i] == '?') {
+    *end = i + 1;
+    char number[16];
+    snprintf(number, sizeof(number), "%d", last_status);
+    return strdup(number);
+  }
+
+  // ${name} or $name, and ${#name} is the length instead of the value
+  int braces = token[i] == '{';
+  if (braces) {
+    i++;
+  }
+  int length = braces && token[i] == '#';
+  if (length) {
+    i++;
+  }
+  int nameStart = i;
+  while (isVarName(token + nameStart, i - nameStart + 1)) {
+    i++;
+  }
+  int nameLen = i - nameStart;
+
+  // ${name[n]} is an element of an array and ${name[@]} all of them
+  int all = 0;
+  if (braces && nameLen > 0 && token[i] == '[') {
+    int close = i + 1;
+    while (isdigit((unsigned char) token[close])) {
+      close++;
+    }
+    if (close == i + 1 && token[close] == '@') {
+      all = 1;
+      close++;
+    }
+    if (close > i + 1 && token[close] == ']') {
+      i = close + 1;
+      nameLen = all ? nameLen : i - nameStart;
+    }
+    else {
+      all = 0;
+    }
+  }
+
+  if (braces) {
+    if (token[i] != '}') {
+      *end = i;
+      return strdup("");
+    }
+    i++;
+  }
+  *end = i;
+
+  char *name = strndup(token + nameStart, nameLen);
+  vect_t *array = all ? getArray(name) : NULL;
+  const char *value = getVar(name);
+  free(name);
+
+  char number[24];
+  if (length) {
+    // A variable that isn't an array counts as one element when it is set
+    size_t count = 0;
+    if (array != NULL) {
+      count = vect_size(array);
+    }
+    else if (all) {
+      count = value != NULL;
+    }
+    else if (value != NULL) {
+      count = strlen(value);
+    }
+    snprintf(number, sizeof(number), "%zu", count);
+    return strdup(number);
+  }
+  if (array == NULL) {
+    return strdup(value == NULL ? "" : value);
+  }
+
+  // The elements are joined with spaces, so an unquoted use splits them again
+  size_t total = 1;
+  for (int e = 0; e < vect_size(array); e++) {
+    total += strlen(vect_get(array, e)) + 1;
+  }
+  char *joined = malloc(total);
+  size_t len = 0;
+  for (int e = 0; e < vect_size(array); e++) {
+    size_t elementLen = strlen(vect_get(array, e));
+    memcpy(joined + len, vect_get(array, e), elementLen);
+    len += elementLen;
+    joined[len++] = ' ';
+  }
+  joined[len > 0 ? len - 1 : 0] = '\0';
+  return joined;
+}
+
+// Expands everything in the token, setting whole when the token was only
+// one substitution or variable. With quotes set a " starts or ends a quoted
+// part and is left out, and text in single quotes outside of one is copied
+// as it is without its quotes. status gets the exit status of each command
+// substitution when it isn't NULL
+// Returns NULL when an arithmetic expression in it failed
+char *expandWord(const char *token, int quotes, int *whole, int *status) {
+  int tokenLen = strlen(token);
+  size_t cap = tokenLen + 1;
+  size_t len = 0;
+  char *result = (char *) malloc(cap);
+  result[0] = '\0';
+  *whole = 0;
+
+  // Only a token that starts with the substitution or variable is whole,
+  // so one in quotes never is
+  int i = 0;
+  int inDouble = 0;
+  while (i < tokenLen) {
+    if (quotes && token[i] == '"') {
+      inDouble = !inDouble;
+      i++;
+      continue;
+    }
+
+    // Nothing is expanded in single quotes, like '$HOME'
+    if (quotes && !inDouble && token[i] == '\'') {
+      const char *close = strchr(token + i + 1, '\'');
+      int end = close != NULL ? close - token : tokenLen;
+      result = appendString(result, &len, &cap, token + i + 1, end - i - 1);
+      i = end + 1;
+      continue;
+    }
+
+    // Arithmetic like $(( i + 1 )) is worked out in the shell
+    if (token[i] == '$' && token[i+1] == '(' && token[i+2] == '(') {
+      int end = findSubstitutionEnd(token, i);
+      if (end < tokenLen && token[end-1] == ')') {
+	*whole = (i == 0 && end >= tokenLen - 1);
+
+	// Variables and substitutions in the expression are expanded before it
+	// is parsed, like ${x} in $(( ${x} + 1 ))
+	char *raw = strndup(token + i + 3, end - i - 4);
+	int inner;
+	char *expr = expandWord(raw, 0, &inner, status);
+	free(raw);
+
+	// A failed expression stops the expansion, so the command never runs
+	long long value = 0;
+	int failed = expr == NULL || evalArith(expr, &value) == -1;
+	free(expr);
+	if (failed) {
+	  free(result);
+	  return NULL;
+	}
+
+	char number[32];
+	int numberLen = snprintf(number, sizeof(number), "%lld", value);
+	result = appendString(result, &len, &cap, number, numberLen);
+
+	i = end + 1;
+	continue;
+      }
+    }
+
+    if ((token[i] == '$' && token[i+1] == '(') || token[i] == '`') {
+      int open = token[i] == '`' ? 1 : 2;
+      int end = findSubstitutionEnd(token, i);
+
+      // The token is only this substitution so its output gets split into words
+      *whole = (i == 0 && end >= tokenLen - 1);
+
+      char *cmd = strndup(token + i + open, end - i - open);
+      size_t outLen;
+      int outStatus;
+      char *out = captureOutput(cmd, &outLen, &outStatus);
+      if (status != NULL) {
+	*status = outStatus;
+      }
+      result = appendString(result, &len, &cap, out, outLen);
+      free(out);
+      free(cmd);
+
+      i = end + 1;
+      continue;
+    }
+
+    // Variable references like $name, ${name} and $?
+    if (token[i] == '$' && (token[i+1] == '?' || token[i+1] == '{'
+	  || isVarName(token + i + 1, 1))) {
+      int end;
+      char *value = expandVariable(token, i, &end);
+      *whole = (i == 0 && end >= tokenLen);
+      result = appendString(result, &len, &cap, value, strlen(value));
+      free(value);
+
+      i = end;
+      continue;
+    }
+
+    result = appendString(result, &len, &cap, token + i, 1);
+    i++;
+  }
+
+  return result;
+}
+
+char *expandString(const char *text) {
+  uint64_t start = statClock();
+  int whole;
+  char *result = expandWord(text, 0, &whole, NULL);
+  countSince(STAT_NS_EXPAND, start);
+  return result;
+}
+
+char *expandUnsplit(const char *word) {
+  uint64_t start = statClock();
+  int whole;
+  char *result = expandWord(word, 1, &whole, NULL);
+  countSince(STAT_NS_EXPAND, start);
+  return result;
+}
+
+vect_t *expandTokens(vect_t *tokens, int *status) {
+  uint64_t start = statClock();
+  vect_t *output = vect_new();
+
+  for (int t = 0; t < vect_size(tokens); t++) {
+    const char *token = vect_get(tokens, t);
+
+    // Nothing to do for tokens without a substitution, variable or quotes
+    if (strpbrk(token, "$`\"'") == NULL) {
+      vect_add(output, token);
+      continue;
+    }
+
+    int whole;
+    char *result = expandWord(token, 1, &whole, status);
+    if (result == NULL) {
+      vect_delete(output);
+      output = NULL;
+      break;
+    }
+    if (whole) {
+      addWords(output, result);
+    }
+    else {
+      vect_add(output, result);
+    }
+    free(result);
+  }
+
+  countSince(STAT_NS_EXPAND, start);
+  return output;
+}
@@ -0,0 +1,54 @@
+#ifndef _EXPAND_H
+#define _EXPAND_H
+
+#include <stddef.h>
+
+#include "vect.h"
+
+/** Pipe size requested for command substitution, so most outputs fit
+ *  without the child blocking on a full pipe. */
+#define CAPTURE_PIPE_SIZE (1024 * 1024)
+
+/** Initial size of the command substitution buffer. */
+#define CAPTURE_INITIAL_CAPACITY 4096
+
+/** Growth factor of the command substitution buffer. */
+#define CAPTURE_GROWTH_FACTOR 2
+
+/** Runs the command line and returns everything it wrote to stdout with the
+ *  trailing newlines removed. The length of the output is stored in length
+ *  and the exit status of the command in status.
+ *  The caller is responsible for freeing the returned string. */
+char *captureOutput(const char *cmd, size_t *length, int *status);
+
+/** Returns a new vector where every $(...) and `...` in the tokens has been
+ *  replaced by the output of the command, every $(( )) by the value of the
+ *  expression and every $name, ${name} and $? by its value. A token that is
+ *  only a substitution or variable is split on whitespace into separate
+ *  tokens. The tokenizer leaves the double quotes around a quoted string
+ *  with a substitution or variable in it, so its token is never split and
+ *  the quotes are taken out here. When status isn't NULL it gets the exit
+ *  status of the last command substitution, and is left alone when there
+ *  was none. Returns NULL when an arithmetic expression failed, after its
+ *  error was printed, so the command isn't run.
+ *  The caller is responsible for deleting the returned vector. */
+vect_t *expandTokens(vect_t *tokens, int *status);
+
+/** Expands the text like expandTokens does but keeps it as one string, for
+ *  text that isn't split into words like the body of a here-document.
+ *  Double quotes in it are plain text.
+ *  Returns NULL when an arithmetic expression failed.
+ *  The caller is responsible for freeing the returned string. */
+char *expandString(const char *text);
+
+/** Expands one token like expandTokens does, quotes and all, but never
+ *  splits it, for the word of a here-string.
+ *  Returns NULL when an arithmetic expression failed.
+ *  The caller is responsible for freeing the returned string. */
+char *expandUnsplit(const char *word);
+
+/** Appends n bytes of src to the growable string dest, whose length and
+ *  capacity are updated. Returns dest, which may have moved. */
+char *appendString(char *dest, size_t *len, size_t *cap, const char *src, size_t n);
+
+#endif /* ifndef _EXPAND_H */
@@ -0,0 +1,395 @@
+#define _GNU_SOURCE
+#include <assert.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/sendfile.h>
+
+#include "vect.h"
+#include "readbuf.h"
+#include "fastcopy.h"
+
+// The ways copyFd can move the data
+enum copy_method {
+  COPY_FILE_RANGE,
+  COPY_SPLICE,
+  COPY_SENDFILE,
+  COPY_READ_WRITE
+};
+
+// Copies the rest of in to out through a buffer
+int copyReadWrite(int in, int out);
+
+// Checks if the error means the kernel can't do this copy so we should fall back
+int shouldFallBack(int err);
+
+// Writes all n bytes of the buffer, returns -1 on error
+int writeBuffer(int out, const char *buffer, size_t n);
+
+// Writes what the shell read ahead from in to out, returns -1 on error
+int copyReadAhead(int in, int out);
+
+// Writes what the shell read ahead from in to out, returns -1 on error
+int copyReadAhead(int in, int out) {
+  char ahead[4096];
+  size_t n;
+  while ((n = takeReadAhead(in, ahead, sizeof(ahead))) > 0) {
+    if (writeBuffer(out, ahead, n) == -1) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+// Reads exactly n bytes from the pipe, returns -1 on error
+int readChunk(int pipeFd, char *buffer, size_t n);
+
+// Moves exactly n bytes from the pipe to out
+int moveChunk(int pipeFd, int out, size_t n, int *buffered, char *buffer);
+
+// Checks if the error means the kernel can't do this copy so we should fall back
+int shouldFallBack(int err) {
+  return err == EINVAL || err == ENOSYS || err == EXDEV
+    || err == EOPNOTSUPP || err == EBADF;
+}
+
+// Copies the rest of in to out through a buffer
+int copyReadWrite(int in, int out) {
+  char *buffer = (char *) malloc(FASTCOPY_BUFFER_SIZE);
+
+  while (1) {
+    ssize_t n = read(in, buffer, FASTCOPY_BUFFER_SIZE);
+    if (n == 0) {
+      break;
+    }
+    if (n == -1) {
+      if (errno == EINTR) {
+	continue;
+      }
+      free(buffer);
+      return -1;
+    }
+
+    // Writes can be partial so keep going until the whole chunk is out
+    ssize_t written = 0;
+    while (written < n) {
+      ssize_t w = write(out, buffer + written, n - written);
+      if (w == -1) {
+	if (errno == EINTR) {
+	  continue;
+	}
+	free(buffer);
+	return -1;
+      }
+      written += w;
+    }
+  }
+
+  free(buffer);
+  return 0;
+}
+
+int copyFd(int in, int out) {
+  struct stat inStat;
+  struct stat outStat;
+  if (fstat(in, &inStat) == -1 || fstat(out, &outStat) == -1) {
+    return -1;
+  }
+
+  // Pick the cheapest way the kernel has for these two kinds of file
+  enum copy_method method;
+  if (S_ISREG(inStat.st_mode) && S_ISREG(outStat.st_mode)) {
+    method = COPY_FILE_RANGE;
+  }
+  else if (S_ISFIFO(inStat.st_mode) || S_ISFIFO(outStat.st_mode)) {
+    method = COPY_SPLICE;
+  }
+  else if (S_ISREG(inStat.st_mode)) {
+    method = COPY_SENDFILE;
+  }
+  else {
+    method = COPY_READ_WRITE;
+  }
+
+  while (method != COPY_READ_WRITE) {
+    ssize_t n;
+    if (method == COPY_FILE_RANGE) {
+      n = copy_file_range(in, NULL, out, NULL, FASTCOPY_CHUNK, 0);
+    }
+    else if (method == COPY_SPLICE) {
+      n = splice(in, NULL, out, NULL, FASTCOPY_CHUNK, SPLICE_F_MOVE | SPLICE_F_MORE);
+    }
+    else {
+      n = sendfile(out, in, NULL, FASTCOPY_CHUNK);
+    }
+
+    if (n == 0) {
+      return 0;
+    }
+    if (n == -1) {
+      if (errno == EINTR) {
+	continue;
+      }
+      if (!shouldFallBack(errno)) {
+	return -1;
+      }
+
+      // The file offsets have moved with what was copied so far
+      // so the fallback carries on from the same place
+      method = COPY_READ_WRITE;
+    }
+  }
+
+  return copyReadWrite(in, out);
+}
+
+// Writes all n bytes of the buffer, returns -1 on error
+int writeBuffer(int out, const char *buffer, size_t n) {
+  while (n > 0) {
+    ssize_t w = write(out, buffer, n);
+    if (w == -1) {
+      if (errno == EINTR) {
+	continue;
+      }
+      return -1;
+    }
+    buffer += w;
+    n -= w;
+  }
+  return 0;
+}
+
+// Reads exactly n bytes from the pipe, returns -1 on error
+int readChunk(int pipeFd, char *buffer, size_t n) {
+  while (n > 0) {
+    ssize_t r = read(pipeFd, buffer, n);
+    if (r == -1 && errno == EINTR) {
+      continue;
+    }
+    if (r <= 0) {
+      return -1;
+    }
+    buffer += r;
+    n -= r;
+  }
+  return 0;
+}
+
+// Moves exactly n bytes from the pipe to out
+// Uses splice until the kernel refuses it for out, which sets buffered and
+// sends the rest through the buffer. When out fails the rest of the bytes
+// are still read so the pipe is empty for the next chunk
+int moveChunk(int pipeFd, int out, size_t n, int *buffered, char *buffer) {
+  int result = 0;
+  while (n > 0) {
+    ssize_t m;
+    if (result == 0 && !*buffered) {
+      m = splice(pipeFd, NULL, out, NULL, n, SPLICE_F_MOVE);
+      if (m == -1) {
+	if (errno == EINTR) {
+	  continue;
+	}
+	if (shouldFallBack(errno)) {
+	  *buffered = 1;
+	}
+	else {
+	  result = -1;
+	}
+	continue;
+      }
+    }
+    else {
+      m = read(pipeFd, buffer, n < FASTCOPY_BUFFER_SIZE ? n : FASTCOPY_BUFFER_SIZE);
+      if (m == -1 && errno == EINTR) {
+	continue;
+      }
+      if (m <= 0) {
+	return -1;
+      }
+      if (result == 0 && writeBuffer(out, buffer, m) == -1) {
+	result = -1;
+      }
+    }
+    n -= m;
+  }
+  return result;
+}
+
+int fanOut(int in, int *outs, int count) {
+  int held[2];
+  int spare[2];
+  if (pipe2(held, O_CLOEXEC) == -1) {
+    return -1;
+  }
+  if (pipe2(spare, O_CLOEXEC) == -1) {
+    close(held[0]);
+    close(held[1]);
+    return -1;
+  }
+
+  // Both pipes get the same size so a tee into the empty spare pipe
+  // always copies the whole chunk that is held
+  fcntl(held[1], F_SETPIPE_SZ, FASTCOPY_CHUNK);
+  fcntl(spare[1], F_SETPIPE_SZ, FASTCOPY_CHUNK);
+  int heldSize = fcntl(held[1], F_GETPIPE_SZ);
+  int spareSize = fcntl(spare[1], F_GETPIPE_SZ);
+  size_t chunk = heldSize < spareSize ? heldSize : spareSize;
+
+  char *buffer = (char *) malloc(FASTCOPY_BUFFER_SIZE);
+  char *chunkBuffer = NULL;
+  int *buffered = calloc(count, sizeof(int));
+  int *failed = calloc(count, sizeof(int));
+  int live = count;
+  int useTee = 1;
+  int result = 0;
+
+  while (live > 0) {
+    // Take the next chunk out of the input
+    ssize_t n = splice(in, NULL, held[1], NULL, chunk, SPLICE_F_MOVE);
+    if (n == 0) {
+      break;
+    }
+    if (n == -1) {
+      if (errno == EINTR) {
+	continue;
+      }
+      result = -1;
+      break;
+    }
+
+    int last = count - 1;
+    while (failed[last]) {
+      last--;
+    }
+
+    // Every target but the last gets its own copy of the chunk from tee
+    int t = 0;
+    for (; useTee && t < last; t++) {
+      if (failed[t]) {
+	continue;
+      }
+      ssize_t copied = tee(held[0], spare[1], n, 0);
+      if (copied != n) {
+	// Throw away a partial copy and send the rest through memory
+	if (copied > 0) {
+	  moveChunk(spare[0], -1, copied, &buffered[t], buffer);
+	}
+	useTee = 0;
+	break;
+      }
+      if (moveChunk(spare[0], outs[t], n, &buffered[t], buffer) == -1) {
+	failed[t] = 1;
+	live--;
+	result = -1;
+      }
+    }
+
+    // The last target takes the held chunk itself
+    if (useTee) {
+      if (moveChunk(held[0], outs[last], n, &buffered[last], buffer) == -1) {
+	failed[last] = 1;
+	live--;
+	result = -1;
+      }
+      continue;
+    }
+
+    // Without tee the chunk is read once and written to the targets left
+    if (chunkBuffer == NULL) {
+      chunkBuffer = (char *) malloc(chunk);
+    }
+    if (readChunk(held[0], chunkBuffer, n) == -1) {
+      result = -1;
+      break;
+    }
+    for (; t < count; t++) {
+      if (!failed[t] && writeBuffer(outs[t], chunkBuffer, n) == -1) {
+	failed[t] = 1;
+	live--;
+	result = -1;
+      }
+    }
+  }
+
+  close(held[0]);
+  close(held[1]);
+  close(spare[0]);
+  close(spare[1]);
+  free(buffer);
+  free(chunkBuffer);
+  free(buffered);
+  free(failed);
+  return result;
+}
+
+int isPureCat(vect_t *tokens) {
+  if (vect_size(tokens) == 0 || strcmp(vect_get(tokens, 0), "cat") != 0) {
+    return 0;
+  }
+
+  // Any option changes the output so only plain file names and - are copies
+  for (int i = 1; i < vect_size(tokens); i++) {
+    const char *arg = vect_get(tokens, i);
+    if (arg[0] == '-' && arg[1] != '\0') {
+      return 0;
+    }
+  }
+
+  return 1;
+}
+
+int runPureCat(vect_t *tokens) {
+  int result = 0;
+
+  // Ignore SIGPIPE while copying so a reader that quits early
+  // only stops the copy instead of killing the shell
+  struct sigaction ignore;
+  struct sigaction saved;
+  memset(&ignore, 0, sizeof(ignore));
+  ignore.sa_handler = SIG_IGN;
+  sigaction(SIGPIPE, &ignore, &saved);
+
+  // No file names means copy stdin
+  int count = vect_size(tokens) == 1 ? 1 : vect_size(tokens) - 1;
+  for (int i = 0; i < count; i++) {
+    const char *name = vect_size(tokens) == 1 ? "-" : vect_get(tokens, i + 1);
+
+    int fd = STDIN_FILENO;
+    if (strcmp(name, "-") != 0) {
+      fd = open(name, O_RDONLY | O_CLOEXEC);
+      if (fd == -1) {
+	fprintf(stderr, "cat: %s: %s\n", name, strerror(errno));
+	result = 1;
+	continue;
+      }
+    }
+
+    // Lines the read built in or the shell read ahead from stdin come first
+    if ((fd == STDIN_FILENO && copyReadAhead(fd, STDOUT_FILENO) == -1)
+	|| copyFd(fd, STDOUT_FILENO) == -1) {
+      int err = errno;
+      if (err == EPIPE) {
+	if (fd != STDIN_FILENO) {
+	  close(fd);
+	}
+	result = 1;
+	break;
+      }
+      fprintf(stderr, "cat: %s: %s\n", name, strerror(err));
+      result = 1;
+    }
+
+    if (fd != STDIN_FILENO) {
+      close(fd);
+    }
+  }
+
+  sigaction(SIGPIPE, &saved, NULL);
+  return result;
+}
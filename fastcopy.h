@@ -0,0 +1,34 @@
+#ifndef _FASTCOPY_H
+#define _FASTCOPY_H
+
+#include "vect.h"
+
+/** Largest chunk moved by a single copy_file_range, splice or sendfile call. */
+#define FASTCOPY_CHUNK (1024 * 1024)
+
+/** Size of the buffer used when the kernel refuses to copy for us. */
+#define FASTCOPY_BUFFER_SIZE (64 * 1024)
+
+/** Copies everything from in to out, using copy_file_range between files,
+ *  splice when one side is a pipe and sendfile otherwise. Falls back to
+ *  read and write when the kernel refuses. Returns 0 on success and -1 on
+ *  error with errno set. */
+int copyFd(int in, int out);
+
+/** Copies everything from the pipe in to each of the count fds in outs,
+ *  like tee(1) but inside the kernel: every target but the last gets its
+ *  data from tee(2) and all of them are written with splice(2). A target
+ *  that splice refuses, like a file opened with O_APPEND, is written from a
+ *  buffer instead. A target that fails is dropped and the copy stops once
+ *  none are left. Returns 0, or -1 if any target failed. */
+int fanOut(int in, int *outs, int count);
+
+/** Checks if the command is cat with only file names, which is a pure copy
+ *  that the shell can do itself. */
+int isPureCat(vect_t *tokens);
+
+/** Runs a pure cat in the shell by copying each file to stdout.
+ *  Returns 0 if every file was copied and 1 otherwise. */
+int runPureCat(vect_t *tokens);
+
+#endif /* ifndef _FASTCOPY_H */
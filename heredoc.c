@@ -0,0 +1,218 @@
+#define _GNU_SOURCE
+#include <assert.h>
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+
+#include "vect.h"
+#include "token.h"
+#include "expand.h"
+#include "stats.h"
+#include "readbuf.h"
+#include "heredoc.h"
+
+// Checks if the token is << or <<-, with or without an fd in front
+int isHeredocOp(const char *token);
+
+// Takes the quotes out of the delimiter, setting quoted if there were any
+char *heredocDelimiter(const char *word, int *quoted);
+
+// Reads the lines of one here-document up to the delimiter
+// Sets ended when the input ran out first
+char *readBody(line_source_t *src, const char *delim, int stripTabs, int *ended);
+
+// Checks if the token is << or <<-, with or without an fd in front
+int isHeredocOp(const char *token) {
+  while (isdigit((unsigned char) *token)) {
+    token++;
+  }
+  return strcmp(token, "<<") == 0 || strcmp(token, "<<-") == 0;
+}
+
+// Takes the quotes out of the delimiter, setting quoted if there were any
+char *heredocDelimiter(const char *word, int *quoted) {
+  char *delim = (char *) malloc(strlen(word) + 1);
+  int len = 0;
+  *quoted = 0;
+  for (int i = 0; word[i] != '\0'; i++) {
+    if (word[i] == '\'' || word[i] == '"' || word[i] == '\\') {
+      *quoted = 1;
+      continue;
+    }
+    delim[len++] = word[i];
+  }
+  delim[len] = '\0';
+  return delim;
+}
+
+// Reads the lines of one here-document up to the delimiter
+// Sets ended when the input ran out first
+char *readBody(line_source_t *src, const char *delim, int stripTabs, int *ended) {
+  size_t cap = 256;
+  size_t len = 0;
+  char *body = (char *) malloc(cap);
+  body[0] = '\0';
+  *ended = 0;
+
+  while (1) {
+    if (src->prompt != NULL) {
+      assert(write(1, src->prompt, strlen(src->prompt)) == strlen(src->prompt));
+    }
+    char *line = readLine(src);
+    if (line == NULL) {
+      *ended = 1;
+      return body;
+    }
+
+    const char *text = line;
+    while (stripTabs && *text == '\t') {
+      text++;
+    }
+
+    // The delimiter is a line on its own
+    size_t textLen = strlen(text);
+    if (textLen - 1 == strlen(delim) && strncmp(text, delim, textLen - 1) == 0) {
+      free(line);
+      return body;
+    }
+
+    body = appendString(body, &len, &cap, text, textLen);
+    free(line);
+  }
+}
+
+char *readLine(line_source_t *src) {
+  char *line = NULL;
+  size_t len;
+
+  if (src->fd != -1) {
+    int terminated;
+    line = readRecord(src->fd, '\n', &len, &terminated);
+    if (line == NULL) {
+      return NULL;
+    }
+  }
+  else {
+    if (src->text == NULL || *src->text == '\0') {
+      return NULL;
+    }
+    const char *end = strchr(src->text, '\n');
+    len = end == NULL ? strlen(src->text) : (size_t) (end - src->text) + 1;
+    line = strndup(src->text, len);
+    src->text += len;
+  }
+
+  // A line read from an fd and the last line of a string have no newline
+  if (len == 0 || line[len - 1] != '\n') {
+    line = realloc(line, len + 2);
+    line[len] = '\n';
+    line[len + 1] = '\0';
+  }
+  countStat(STAT_LINES, 1);
+  return line;
+}
+
+int readHeredocs(vect_t *tokens, line_source_t *src) {
+  int result = 0;
+  for (int i = 0; i + 1 < vect_size(tokens); i++) {
+    const char *op = vect_get(tokens, i);
+    if (!isHeredocOp(op)) {
+      continue;
+    }
+
+    int quoted;
+    int ended;
+    char *delim = heredocDelimiter(vect_get(tokens, i + 1), &quoted);
+    char *body = readBody(src, delim, op[strlen(op) - 1] == '-', &ended);
+    if (ended) {
+      fprintf(stderr, "warning: here-document wanted `%s' but the input ended\n", delim);
+      result = -1;
+    }
+    free(delim);
+
+    // A quoted delimiter keeps the body from being expanded
+    if (quoted) {
+      int fdLen = strspn(op, "0123456789");
+      char *literal = (char *) malloc(fdLen + strlen(HEREDOC_LITERAL_OP) + 1);
+      memcpy(literal, op, fdLen);
+      strcpy(literal + fdLen, HEREDOC_LITERAL_OP);
+      vect_set(tokens, i, literal);
+      free(literal);
+    }
+    vect_set(tokens, i + 1, body);
+    free(body);
+    i++;
+  }
+  return result;
+}
+
+vect_t *readScript(line_source_t *src) {
+  vect_t *script = vect_new();
+  char *line;
+  while ((line = readLine(src)) != NULL) {
+    vect_t *tokens = parseInput(line);
+    free(line);
+    readHeredocs(tokens, src);
+
+    // Each line ends a statement just like ; does
+    if (vect_size(tokens) > 0 && vect_size(script) > 0) {
+      vect_add(script, ";");
+    }
+    for (int i = 0; i < vect_size(tokens); i++) {
+      vect_add(script, vect_get(tokens, i));
+    }
+    vect_delete(tokens);
+  }
+  return script;
+}
+
+int openHeredoc(const char *text, size_t len) {
+  int pipe_fd[2];
+  if (pipe2(pipe_fd, O_CLOEXEC) == -1) {
+    perror("here-document: pipe");
+    return -1;
+  }
+
+  // A body that fits in the pipe can be written before anything reads it
+  int pipeSize = fcntl(pipe_fd[1], F_GETPIPE_SZ);
+  if (pipeSize > 0 && len <= (size_t) pipeSize) {
+    size_t done = 0;
+    while (done < len) {
+      ssize_t n = write(pipe_fd[1], text + done, len - done);
+      if (n <= 0) {
+	break;
+      }
+      done += n;
+    }
+    close(pipe_fd[1]);
+    return pipe_fd[0];
+  }
+  close(pipe_fd[0]);
+  close(pipe_fd[1]);
+
+  // Bigger bodies go in memory that the command reads like a file
+  int fd = memfd_create("heredoc", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+  if (fd == -1) {
+    perror("here-document: memfd_create");
+    return -1;
+  }
+  size_t done = 0;
+  while (done < len) {
+    ssize_t n = write(fd, text + done, len - done);
+    if (n <= 0) {
+      perror("here-document: write");
+      close(fd);
+      return -1;
+    }
+    done += n;
+  }
+
+  // Seal it so the body can't change under the command
+  fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL);
+  lseek(fd, 0, SEEK_SET);
+  return fd;
+}
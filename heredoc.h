@@ -0,0 +1,39 @@
+#ifndef _HEREDOC_H
+#define _HEREDOC_H
+
+#include "vect.h"
+
+/** Operator that takes the place of << once the body of a here-document
+ *  with a quoted delimiter has been read, so the body isn't expanded. The
+ *  tokenizer never makes it since a ' after << starts the next word. */
+#define HEREDOC_LITERAL_OP "<<'"
+
+/** Where lines of input come from: an fd, or a string when fd is -1. */
+typedef struct line_source {
+  int fd;                /* Read through its read-ahead buffer. */
+  const char *text;      /* The rest of the string. */
+  const char *prompt;    /* Printed before each line of a here-document, or NULL. */
+} line_source_t;
+
+/** Reads the next line from the source, including its newline.
+ *  Returns NULL at the end. The caller is responsible for freeing the line. */
+char *readLine(line_source_t *src);
+
+/** Reads the body of every here-document in the tokens from the lines that
+ *  follow, in order. The delimiter after each << is replaced by the body.
+ *  <<- also takes the tabs off the start of every line, and a delimiter with
+ *  quotes in it turns << into HEREDOC_LITERAL_OP. Returns 0, or -1 when the
+ *  input ended before a delimiter, keeping what was read. */
+int readHeredocs(vect_t *tokens, line_source_t *src);
+
+/** Tokenizes every line left in the source with a ; token between lines,
+ *  reading the bodies of any here-documents along the way.
+ *  The caller is responsible for deleting the returned vector. */
+vect_t *readScript(line_source_t *src);
+
+/** Returns a file descriptor open for reading that holds the text. It is a
+ *  pipe when the text fits in the pipe buffer, and a sealed memfd otherwise,
+ *  so nothing touches the disk. Returns -1 and prints an error on failure. */
+int openHeredoc(const char *text, size_t len);
+
+#endif /* ifndef _HEREDOC_H */
@@ -0,0 +1,301 @@
+#define _GNU_SOURCE
+#include <assert.h>
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "vect.h"
+#include "shell.h"
+#include "cache.h"
+#include "vars.h"
+#include "stats.h"
+#include "readbuf.h"
+#include "jobs.h"
+
+// The jobs in the order they were started
+static job_t *jobs = NULL;
+static int jobCount = 0;
+static int jobCapacity = 0;
+static int nextJobId = 1;
+
+// Moves fd to the lowest free fd at or above COPROC_MIN_FD, close-on-exec
+int moveHigh(int fd);
+
+// Closes the shell's end of the coprocess's stdin so it sees the end
+void closeInput(job_t *job);
+
+// Closes the shell's ends of the job's pipes and unsets its variables
+void closeJob(job_t *job);
+
+// Waits for the job if it hasn't been waited for, blocking when told to
+void reapJob(job_t *job, int block);
+
+// Removes the job at idx from the table
+void removeJob(int idx);
+
+// Finds the job a wait argument names, %ID, a pid or a coprocess name
+int findJob(const char *arg);
+
+// Moves fd to the lowest free fd at or above COPROC_MIN_FD, close-on-exec
+int moveHigh(int fd) {
+  int high = fcntl(fd, F_DUPFD_CLOEXEC, COPROC_MIN_FD);
+  close(fd);
+  return high;
+}
+
+// Closes the shell's end of the coprocess's stdin so it sees the end
+void closeInput(job_t *job) {
+  if (job->writeFd == -1) {
+    return;
+  }
+  close(job->writeFd);
+  job->writeFd = -1;
+
+  // ${NAME[0]} is still there to read the rest of the output from
+  vect_t *array = getArray(job->name);
+  if (array != NULL && vect_size(array) > 1) {
+    vect_remove_last(array);
+  }
+}
+
+// Closes the shell's ends of the job's pipes and unsets its variables
+void closeJob(job_t *job) {
+  closeInput(job);
+  if (job->readFd != -1) {
+    readAheadMoved(job->readFd);
+    close(job->readFd);
+    job->readFd = -1;
+  }
+  if (job->name == NULL) {
+    return;
+  }
+
+  char *element = malloc(strlen(job->name) + 8);
+  unsetArray(job->name);
+  sprintf(element, "%s_PID", job->name);
+  unsetVar(element);
+  free(element);
+
+  free(job->name);
+  job->name = NULL;
+}
+
+// Waits for the job if it hasn't been waited for, blocking when told to
+void reapJob(job_t *job, int block) {
+  if (job->done) {
+    return;
+  }
+  int wstatus = 0;
+  if (countedWaitpid(job->pid, &wstatus, block ? 0 : WNOHANG) == job->pid) {
+    job->done = 1;
+    job->status = exitStatus(wstatus);
+  }
+}
+
+// Removes the job at idx from the table
+void removeJob(int idx) {
+  closeJob(&jobs[idx]);
+  free(jobs[idx].command);
+  jobCount--;
+  memmove(&jobs[idx], &jobs[idx + 1], (jobCount - idx) * sizeof(job_t));
+}
+
+// Finds the job a wait argument names, %ID, a pid or a coprocess name
+int findJob(const char *arg) {
+  for (int i = 0; i < jobCount; i++) {
+    if ((arg[0] == '%' && atoi(arg + 1) == jobs[i].id)
+	|| (isdigit((unsigned char) arg[0]) && atoi(arg) == jobs[i].pid)
+	|| (jobs[i].name != NULL && strcmp(arg, jobs[i].name) == 0)) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+int addJob(pid_t pid, const char *name, const char *command, int readFd, int writeFd) {
+  if (jobCount == jobCapacity) {
+    jobCapacity = jobCapacity == 0 ? JOBS_INITIAL_CAPACITY : jobCapacity * JOBS_GROWTH_FACTOR;
+    jobs = realloc(jobs, jobCapacity * sizeof(job_t));
+  }
+
+  job_t *job = &jobs[jobCount++];
+  job->id = nextJobId++;
+  job->pid = pid;
+  job->name = name == NULL ? NULL : strdup(name);
+  job->command = strdup(command);
+  job->readFd = readFd;
+  job->writeFd = writeFd;
+  job->done = 0;
+  job->status = 0;
+  return job->id;
+}
+
+void closeJobFds() {
+  for (int i = 0; i < jobCount; i++) {
+    if (jobs[i].readFd != -1) {
+      close(jobs[i].readFd);
+      jobs[i].readFd = -1;
+    }
+    if (jobs[i].writeFd != -1) {
+      close(jobs[i].writeFd);
+      jobs[i].writeFd = -1;
+    }
+  }
+}
+
+int coprocCmd(vect_t *tokens) {
+  if (vect_size(tokens) < 3 || !isVarName(vect_get(tokens, 1), strlen(vect_get(tokens, 1)))) {
+    char usage[] = "usage: coproc NAME command [args...]\n";
+    assert(write(2, usage, strlen(usage)) == strlen(usage));
+    return 1;
+  }
+  const char *name = vect_get(tokens, 1);
+
+  char *text;
+  parsed_line_t *line = parseWords(tokens, 2, vect_size(tokens), &text);
+  if (line == NULL) {
+    fprintf(stderr, "coproc: syntax error in %s", text);
+    free(text);
+    return 1;
+  }
+  text[strlen(text) - 1] = '\0';
+
+  // A coprocess with the same name loses its pipes so it can finish
+  int old = findJob(name);
+  if (old != -1) {
+    reapJob(&jobs[old], 0);
+    if (!jobs[old].done) {
+      fprintf(stderr, "coproc: %s is still running as %d\n", name, jobs[old].pid);
+    }
+    closeJob(&jobs[old]);
+    if (jobs[old].done) {
+      removeJob(old);
+    }
+  }
+
+  int toChild[2];
+  int fromChild[2];
+  if (pipe2(toChild, O_CLOEXEC) == -1) {
+    perror("coproc: pipe");
+    releaseLine(line);
+    free(text);
+    return 1;
+  }
+  if (pipe2(fromChild, O_CLOEXEC) == -1) {
+    perror("coproc: pipe");
+    close(toChild[0]);
+    close(toChild[1]);
+    releaseLine(line);
+    free(text);
+    return 1;
+  }
+
+  int pid = countedFork();
+  if (pid == 0) {
+    // The command may run in this process without an exec, so nothing but
+    // its stdin and stdout can be left holding the pipes
+    readAheadMoved(STDIN_FILENO);
+    dup2(toChild[0], STDIN_FILENO);
+    dup2(fromChild[1], STDOUT_FILENO);
+    close(toChild[0]);
+    close(toChild[1]);
+    close(fromChild[0]);
+    close(fromChild[1]);
+    closeJobFds();
+    _exit(runParsed(line, 1));
+  }
+  close(toChild[0]);
+  close(fromChild[1]);
+  releaseLine(line);
+
+  if (pid < 0) {
+    perror("Error - fork failed");
+    close(toChild[1]);
+    close(fromChild[0]);
+    free(text);
+    return 1;
+  }
+
+  int readFd = moveHigh(fromChild[0]);
+  int writeFd = moveHigh(toChild[1]);
+  addJob(pid, name, text, readFd, writeFd);
+  free(text);
+
+  vect_t *fds = vect_new();
+  char number[16];
+  snprintf(number, sizeof(number), "%d", readFd);
+  vect_add(fds, number);
+  snprintf(number, sizeof(number), "%d", writeFd);
+  vect_add(fds, number);
+  setArray(name, fds);
+
+  char *element = malloc(strlen(name) + 8);
+  snprintf(number, sizeof(number), "%d", pid);
+  sprintf(element, "%s_PID", name);
+  setVar(element, number);
+  free(element);
+  return 0;
+}
+
+int jobsCmd(vect_t *tokens) {
+  int i = 0;
+  while (i < jobCount) {
+    job_t *job = &jobs[i];
+    reapJob(job, 0);
+
+    char line[64];
+    int len = snprintf(line, sizeof(line), "[%d] %d %s ", job->id, job->pid,
+		       job->done ? "Done" : "Running");
+    assert(write(1, line, len) == len);
+    assert(write(1, job->command, strlen(job->command)) == strlen(job->command));
+    assert(write(1, "\n", 1) == 1);
+
+    // A finished job is only reported once
+    if (job->done) {
+      removeJob(i);
+    }
+    else {
+      i++;
+    }
+  }
+  return 0;
+}
+
+int waitCmd(vect_t *tokens) {
+  int result = 0;
+
+  // Without arguments every job is waited for
+  int all = vect_size(tokens) == 1;
+  int count = all ? jobCount : vect_size(tokens) - 1;
+  for (int i = 0; i < count; i++) {
+    int idx = all ? i : findJob(vect_get(tokens, i + 1));
+    if (idx == -1) {
+      fprintf(stderr, "wait: %s: no such job\n", vect_get(tokens, i + 1));
+      result = 127;
+      continue;
+    }
+
+    // A coprocess keeps the end its output comes from so the rest of the
+    // output can still be read, until jobs reports it as done
+    job_t *job = &jobs[idx];
+    closeInput(job);
+    reapJob(job, 1);
+    result = job->status;
+    if (job->readFd == -1 && !all) {
+      removeJob(idx);
+    }
+  }
+
+  // Removing jobs while going through all of them would skip some
+  for (int i = jobCount - 1; all && i >= 0; i--) {
+    if (jobs[i].readFd == -1) {
+      removeJob(i);
+    }
+  }
+  return result;
+}
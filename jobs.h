@@ -0,0 +1,62 @@
+#ifndef _JOBS_H
+#define _JOBS_H
+
+#include <sys/types.h>
+
+#include "vect.h"
+
+/** Lowest fd the shell keeps the pipes of a coprocess on, out of the way
+ *  of the fds that scripts redirect and of the redirection backups. */
+#define COPROC_MIN_FD 60
+
+/* Job table configuration. */
+#define JOBS_INITIAL_CAPACITY 4
+#define JOBS_GROWTH_FACTOR 2
+
+/** A child the shell left running. */
+typedef struct job {
+  int id;            /* The n in %n. */
+  pid_t pid;
+  char *name;        /* Name of a coprocess, NULL for other jobs. */
+  char *command;     /* The command as it was given. */
+  int readFd;        /* The shell's end of the coprocess's stdout, or -1. */
+  int writeFd;       /* The shell's end of the coprocess's stdin, or -1. */
+  int done;          /* Set once the child has been waited for. */
+  int status;        /* Its exit status once done. */
+} job_t;
+
+/** Adds a child to the job table and returns its job id. The fds are the
+ *  shell's ends of its pipes, -1 when it has none. */
+int addJob(pid_t pid, const char *name, const char *command, int readFd, int writeFd);
+
+/** Runs the coproc built in:
+ *
+ *    coproc NAME command [args...]
+ *
+ *  Starts the command with its stdin and stdout connected to pipes that
+ *  stay open in the shell, so one process can answer many requests. The
+ *  words are joined like bench does, so a pipeline has to be quoted.
+ *  ${NAME[0]} (also $NAME) is the fd to read its output from and
+ *  ${NAME[1]} the fd to write its input to, as in >&${NAME[1]}, and
+ *  NAME_PID is its pid. The fds are close-on-exec, so only a command
+ *  they are redirected to gets them. Returns 0, or 1 on an error. */
+int coprocCmd(vect_t *tokens);
+
+/** Runs the jobs built in, which lists the jobs as "[id] pid state command".
+ *  Jobs that have finished are listed once as Done and then forgotten. */
+int jobsCmd(vect_t *tokens);
+
+/** Runs the wait built in:
+ *
+ *    wait [%ID | PID | NAME]...
+ *
+ *  Waits for the jobs given, or all of them, and returns the exit status of
+ *  the last one. The shell's end of a coprocess's stdin is closed first so
+ *  it sees the end of its input. Its output stays open, so what it wrote
+ *  can still be read, until jobs has reported it as done. */
+int waitCmd(vect_t *tokens);
+
+/** Closes the pipes of every coprocess, for a child that won't use them. */
+void closeJobFds();
+
+#endif /* ifndef _JOBS_H */
@@ -0,0 +1,176 @@
+#include <assert.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "vect.h"
+#include "parse.h"
+#include "heredoc.h"
+
+// Creates a node of the given type
+cmd_t *cmd_new(cmd_type_t type);
+
+// Splits the tokens at idx into a node with the two sides parsed
+cmd_t *parseOperator(cmd_type_t type, vect_t *tokens, int idx);
+
+// Finds the index of the last && or ||, or -1 if there is neither
+int lastConditional(vect_t *tokens);
+
+// Creates a node of the given type
+cmd_t *cmd_new(cmd_type_t type) {
+  cmd_t *cmd = malloc(sizeof(cmd_t));
+  cmd->type = type;
+  cmd->words = NULL;
+  cmd->redirs = NULL;
+  cmd->pipedOut = 0;
+  cmd->left = NULL;
+  cmd->right = NULL;
+  return cmd;
+}
+
+// Splits the tokens at idx into a node with the two sides parsed
+cmd_t *parseOperator(cmd_type_t type, vect_t *tokens, int idx) {
+  vect_t *before = copy_vect_until(NULL, tokens, idx);
+  cmd_t *left = parseCommand(before);
+  vect_delete(before);
+
+  // Nothing after the operator means there is only the left side to run
+  if (vect_size(tokens) - 1 <= idx) {
+    return left;
+  }
+
+  cmd_t *cmd = cmd_new(type);
+  cmd->left = left;
+
+  // Output redirections of the left side of a pipe still feed the pipe too
+  if (type == CMD_PIPE) {
+    left->pipedOut = 1;
+  }
+
+  vect_t *after = copy_vect_after(NULL, tokens, idx + 1);
+  cmd->right = parseCommand(after);
+  vect_delete(after);
+
+  return cmd;
+}
+
+// Finds the index of the last && or ||, or -1 if there is neither
+int lastConditional(vect_t *tokens) {
+  for (int i = vect_size(tokens) - 1; i >= 0; i--) {
+    const char *token = vect_get(tokens, i);
+    if (strcmp(token, "&&") == 0 || strcmp(token, "||") == 0) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+// Operators are split from the loosest to the tightest binding:
+// ; then && and || then | then the redirections
+cmd_t *parseCommand(vect_t *tokens) {
+  assert(tokens != NULL);
+
+  // Case where there is sequencing
+  int sequenceIdx = indexOf(tokens, ";");
+  if (sequenceIdx != -1) {
+    return parseOperator(CMD_SEQ, tokens, sequenceIdx);
+  }
+
+  // Case where there is && or ||
+  // Splitting at the last one makes a && b || c group as (a && b) || c
+  int condIdx = lastConditional(tokens);
+  if (condIdx != -1) {
+    cmd_type_t type = strcmp(vect_get(tokens, condIdx), "&&") == 0 ? CMD_AND : CMD_OR;
+    return parseOperator(type, tokens, condIdx);
+  }
+
+  // Case where there is a pipe
+  int pipeIdx = indexOf(tokens, "|");
+  if (pipeIdx != -1) {
+    return parseOperator(CMD_PIPE, tokens, pipeIdx);
+  }
+
+  // No operators left so this is a plain command
+  // Redirections are taken out of the words in the order they appear
+  cmd_t *cmd = cmd_new(CMD_SIMPLE);
+  cmd->words = vect_new();
+  redir_t **last = &cmd->redirs;
+  for (int i = 0; i < vect_size(tokens); i++) {
+    redir_t op;
+    if (!parseRedirectOp(vect_get(tokens, i), &op)) {
+      vect_add(cmd->words, vect_get(tokens, i));
+      continue;
+    }
+
+    redir_t *redir = malloc(sizeof(redir_t));
+    *redir = op;
+    redir->word = i + 1 < vect_size(tokens) ? vect_get_copy(tokens, ++i) : NULL;
+    redir->next = NULL;
+    *last = redir;
+    last = &redir->next;
+  }
+  return cmd;
+}
+
+int parseRedirectOp(const char *token, redir_t *redir) {
+  // An fd number in front replaces the default one
+  int i = 0;
+  while (isdigit((unsigned char) token[i])) {
+    i++;
+  }
+  const char *op = token + i;
+
+  if (strcmp(op, "<") == 0 || strcmp(op, "<>") == 0 || strcmp(op, "<&") == 0) {
+    redir->fd = 0;
+    redir->type = op[1] == '&' ? REDIR_DUP : REDIR_FILE;
+    redir->flags = op[1] == '>' ? O_RDWR | O_CREAT : O_RDONLY;
+  }
+  else if (strcmp(op, ">") == 0 || strcmp(op, ">>") == 0 || strcmp(op, ">&") == 0) {
+    redir->fd = 1;
+    redir->type = op[1] == '&' ? REDIR_DUP : REDIR_FILE;
+    redir->flags = O_WRONLY | O_CREAT | (op[1] == '>' ? O_APPEND : O_TRUNC);
+  }
+  else if (strcmp(op, "<<") == 0 || strcmp(op, "<<-") == 0
+      || strcmp(op, HEREDOC_LITERAL_OP) == 0 || strcmp(op, "<<<") == 0) {
+    redir->fd = 0;
+    redir->flags = O_RDONLY;
+    if (strcmp(op, "<<<") == 0) {
+      redir->type = REDIR_HERESTRING;
+    }
+    else {
+      redir->type = op[2] == '\'' ? REDIR_HEREDOC_LITERAL : REDIR_HEREDOC;
+    }
+  }
+  else if (i == 0 && (strcmp(op, "&>") == 0 || strcmp(op, "&>>") == 0)) {
+    redir->fd = 1;
+    redir->type = REDIR_BOTH;
+    redir->flags = O_WRONLY | O_CREAT | (op[2] == '>' ? O_APPEND : O_TRUNC);
+  }
+  else {
+    return 0;
+  }
+
+  if (i > 0) {
+    redir->fd = atoi(token);
+  }
+  return 1;
+}
+
+void cmd_delete(cmd_t *cmd) {
+  if (cmd == NULL) {
+    return;
+  }
+  if (cmd->words != NULL) {
+    vect_delete(cmd->words);
+  }
+  while (cmd->redirs != NULL) {
+    redir_t *next = cmd->redirs->next;
+    free(cmd->redirs->word);
+    free(cmd->redirs);
+    cmd->redirs = next;
+  }
+  cmd_delete(cmd->left);
+  cmd_delete(cmd->right);
+  free(cmd);
+}
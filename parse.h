@@ -0,0 +1,55 @@
+#ifndef _PARSE_H
+#define _PARSE_H
+
+#include "vect.h"
+
+/** The kinds of node in a parsed command. */
+typedef enum {
+  CMD_SIMPLE,   /* A command and its arguments. */
+  CMD_PIPE,     /* left | right */
+  CMD_SEQ,      /* left ; right */
+  CMD_AND,      /* left && right */
+  CMD_OR        /* left || right */
+} cmd_type_t;
+
+/** The kinds of redirection. */
+typedef enum {
+  REDIR_FILE,   /* n< n> n>> n<> file, opened with the flags. */
+  REDIR_DUP,    /* n>&m or n<&m, or n>&- to close n. */
+  REDIR_BOTH,   /* &> and &>> file, for both stdout and stderr. */
+  REDIR_HEREDOC,         /* n<< and n<<-, the word is the body and gets expanded. */
+  REDIR_HEREDOC_LITERAL, /* A here-document with a quoted delimiter, not expanded. */
+  REDIR_HERESTRING       /* n<<< word, the word and a newline. */
+} redir_type_t;
+
+/** One redirection of a simple command. They are applied in order. */
+typedef struct redir {
+  redir_type_t type;
+  int fd;              /* The fd being redirected. */
+  int flags;           /* Flags to open the file with. */
+  char *word;          /* File or fd, expanded when the command runs. NULL if missing. */
+  struct redir *next;
+} redir_t;
+
+/** A parsed command line. The tree is never changed once it is built so it
+ *  can be run as many times as needed. */
+typedef struct cmd {
+  cmd_type_t type;
+  vect_t *words;       /* Arguments of a simple command. */
+  redir_t *redirs;     /* Redirections of a simple command, NULL when there are none. */
+  int pipedOut;        /* Set when the stdout of a simple command feeds a pipe. */
+  struct cmd *left;    /* Left side of an operator. */
+  struct cmd *right;   /* Right side of an operator. */
+} cmd_t;
+
+/** Parses the tokens of a command line into a command tree. */
+cmd_t *parseCommand(vect_t *tokens);
+
+/** Checks if the token is a redirection operator like 2>> and fills in the
+ *  type, fd and flags of the redirection when it is. */
+int parseRedirectOp(const char *token, redir_t *redir);
+
+/** Delete the command tree, freeing all memory it occupies. */
+void cmd_delete(cmd_t *cmd);
+
+#endif /* ifndef _PARSE_H */
@@ -0,0 +1,335 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "readbuf.h"
+
+/** What was read ahead from one open file or pipe. */
+typedef struct read_buffer {
+  char *data;
+  size_t start;      /* First byte that hasn't been handed out. */
+  size_t end;        /* End of what was read. */
+  size_t cap;
+  int seekable;      /* Set when what was read ahead can be given back. */
+  dev_t dev;         /* The pipe the buffer belongs to. */
+  ino_t ino;
+  int users;         /* fds reading the pipe through the buffer. */
+  struct read_buffer *next;
+} read_buffer_t;
+
+// The buffer each fd reads through, NULL until it is read again
+static read_buffer_t *byFd[READ_BUFFER_MAX_FD];
+
+// Buffers of pipes, kept while they hold data even when no fd uses them,
+// since the next fd opened on the same pipe has to start with that data
+static read_buffer_t *pipes = NULL;
+
+// Finds the buffer for what fd is open on without making one, NULL when
+// nothing was read ahead from it
+read_buffer_t *findBuffer(int fd);
+
+// Finds or makes the buffer for what fd is open on, NULL on an error
+read_buffer_t *bufferFor(int fd);
+
+// Lets go of the buffer of fd, giving back what was read ahead from a file
+void detachBuffer(int fd);
+
+// Reads a block onto the end of the buffer, returning what read returned
+ssize_t fillBuffer(read_buffer_t *buffer, int fd);
+
+// Reads everything left on fd without a buffer, starting with len bytes of data
+char *readToEnd(int fd, char *data, size_t *len);
+
+// Finds the buffer for what fd is open on without making one, NULL when
+// nothing was read ahead from it
+read_buffer_t *findBuffer(int fd) {
+  if (fd < 0 || fd >= READ_BUFFER_MAX_FD) {
+    return NULL;
+  }
+  if (byFd[fd] != NULL || pipes == NULL) {
+    return byFd[fd];
+  }
+
+  // A pipe another fd read ahead from carries on where that fd stopped
+  struct stat st;
+  if (fstat(fd, &st) == -1 || S_ISREG(st.st_mode) || S_ISBLK(st.st_mode)) {
+    return NULL;
+  }
+  for (read_buffer_t *buffer = pipes; buffer != NULL; buffer = buffer->next) {
+    if (buffer->dev == st.st_dev && buffer->ino == st.st_ino) {
+      buffer->users++;
+      byFd[fd] = buffer;
+      return buffer;
+    }
+  }
+  return NULL;
+}
+
+// Finds or makes the buffer for what fd is open on, NULL on an error
+read_buffer_t *bufferFor(int fd) {
+  read_buffer_t *found = findBuffer(fd);
+  if (found != NULL) {
+    return found;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) == -1) {
+    perror("read");
+    return NULL;
+  }
+  int seekable = S_ISREG(st.st_mode) || S_ISBLK(st.st_mode);
+
+  read_buffer_t *buffer = calloc(1, sizeof(read_buffer_t));
+  buffer->cap = 2 * READ_BLOCK_SIZE;
+  buffer->data = malloc(buffer->cap);
+  buffer->seekable = seekable;
+  buffer->dev = st.st_dev;
+  buffer->ino = st.st_ino;
+  buffer->users = 1;
+  if (!seekable) {
+    buffer->next = pipes;
+    pipes = buffer;
+  }
+  byFd[fd] = buffer;
+  return buffer;
+}
+
+// Lets go of the buffer of fd, giving back what was read ahead from a file
+void detachBuffer(int fd) {
+  read_buffer_t *buffer = byFd[fd];
+  if (buffer == NULL) {
+    return;
+  }
+  byFd[fd] = NULL;
+
+  if (buffer->seekable) {
+    if (buffer->end > buffer->start) {
+      lseek(fd, -(off_t) (buffer->end - buffer->start), SEEK_CUR);
+    }
+    free(buffer->data);
+    free(buffer);
+    return;
+  }
+
+  // A pipe's buffer stays around while it has data nobody has read
+  buffer->users--;
+  if (buffer->users > 0 || buffer->end > buffer->start) {
+    return;
+  }
+  read_buffer_t **link = &pipes;
+  while (*link != buffer) {
+    link = &(*link)->next;
+  }
+  *link = buffer->next;
+  free(buffer->data);
+  free(buffer);
+}
+
+// Reads a block onto the end of the buffer, returning what read returned
+ssize_t fillBuffer(read_buffer_t *buffer, int fd) {
+  // The record that is being read moves to the front to make room
+  if (buffer->cap - buffer->end < READ_BLOCK_SIZE) {
+    memmove(buffer->data, buffer->data + buffer->start, buffer->end - buffer->start);
+    buffer->end -= buffer->start;
+    buffer->start = 0;
+  }
+  if (buffer->cap - buffer->end < READ_BLOCK_SIZE) {
+    buffer->cap *= 2;
+    buffer->data = realloc(buffer->data, buffer->cap);
+  }
+
+  ssize_t n;
+  while ((n = read(fd, buffer->data + buffer->end, buffer->cap - buffer->end)) == -1
+	 && errno == EINTR) {
+  }
+  if (n == -1) {
+    perror("read");
+  }
+  else {
+    buffer->end += n;
+  }
+  return n;
+}
+
+char *readRecord(int fd, char delim, size_t *len, int *terminated) {
+  *terminated = 0;
+
+  // Without a buffer reading past the delimiter would lose data
+  if (fd < 0 || fd >= READ_BUFFER_MAX_FD) {
+    size_t cap = 64;
+    size_t n = 0;
+    char *record = malloc(cap);
+    char c;
+    ssize_t got;
+    while ((got = read(fd, &c, 1)) == 1 && c != delim) {
+      if (n + 1 == cap) {
+	cap *= 2;
+	record = realloc(record, cap);
+      }
+      record[n++] = c;
+    }
+    if (got == -1) {
+      perror("read");
+    }
+    if (got != 1 && n == 0) {
+      free(record);
+      return NULL;
+    }
+    *terminated = got == 1;
+    record[n] = '\0';
+    *len = n;
+    return record;
+  }
+
+  read_buffer_t *buffer = bufferFor(fd);
+  if (buffer == NULL) {
+    return NULL;
+  }
+
+  // Bytes already searched are counted from start, which moves on a refill
+  size_t searched = 0;
+  char *found;
+  while ((found = memchr(buffer->data + buffer->start + searched, delim,
+			 buffer->end - buffer->start - searched)) == NULL) {
+    searched = buffer->end - buffer->start;
+    if (fillBuffer(buffer, fd) <= 0) {
+      break;
+    }
+  }
+
+  size_t n = found != NULL ? found - (buffer->data + buffer->start) : buffer->end - buffer->start;
+  if (found == NULL && n == 0) {
+    return NULL;
+  }
+  char *record = malloc(n + 1);
+  memcpy(record, buffer->data + buffer->start, n);
+  record[n] = '\0';
+
+  *terminated = found != NULL;
+  buffer->start += n + *terminated;
+  if (buffer->start == buffer->end) {
+    buffer->start = 0;
+    buffer->end = 0;
+  }
+  *len = n;
+  return record;
+}
+
+// Reads everything left on fd without a buffer, starting with len bytes of data
+char *readToEnd(int fd, char *data, size_t *len) {
+  size_t cap = *len + READ_BLOCK_SIZE;
+  data = realloc(data, cap);
+  while (1) {
+    if (cap - *len < READ_BLOCK_SIZE) {
+      cap *= 2;
+      data = realloc(data, cap);
+    }
+
+    ssize_t n;
+    while ((n = read(fd, data + *len, cap - *len)) == -1 && errno == EINTR) {
+    }
+    if (n == -1) {
+      perror("read");
+      free(data);
+      return NULL;
+    }
+    if (n == 0) {
+      break;
+    }
+    *len += n;
+  }
+  return data;
+}
+
+char *readRest(int fd, size_t *len, void **mapping, size_t *mappingLen) {
+  *mapping = NULL;
+  *len = 0;
+  if (fd < 0 || fd >= READ_BUFFER_MAX_FD) {
+    return readToEnd(fd, NULL, len);
+  }
+
+  read_buffer_t *buffer = bufferFor(fd);
+  if (buffer == NULL) {
+    return NULL;
+  }
+  size_t ahead = buffer->end - buffer->start;
+
+  // The rest of a file is mapped from where the read built in stopped, and
+  // the fd is left at the end as if it had been read
+  struct stat st;
+  if (buffer->seekable && fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+    off_t offset = lseek(fd, 0, SEEK_CUR);
+    off_t from = offset - (off_t) ahead;
+    if (offset != -1 && from < st.st_size) {
+      char *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (data != MAP_FAILED) {
+	madvise(data, st.st_size, MADV_SEQUENTIAL);
+	lseek(fd, 0, SEEK_END);
+	buffer->start = 0;
+	buffer->end = 0;
+	*mapping = data;
+	*mappingLen = st.st_size;
+	*len = st.st_size - from;
+	return data + from;
+      }
+    }
+  }
+
+  char *data = malloc(ahead + 1);
+  memcpy(data, buffer->data + buffer->start, ahead);
+  buffer->start = 0;
+  buffer->end = 0;
+  *len = ahead;
+  return readToEnd(fd, data, len);
+}
+
+void readAheadMoved(int fd) {
+  // The fd may be pointed at a copy of a file another fd read ahead from
+  returnReadAhead();
+  if (fd >= 0 && fd < READ_BUFFER_MAX_FD) {
+    detachBuffer(fd);
+  }
+}
+
+void readAheadRestored(int fd) {
+  returnReadAhead();
+  if (fd >= 0 && fd < READ_BUFFER_MAX_FD) {
+    detachBuffer(fd);
+  }
+}
+
+void returnReadAhead() {
+  for (int fd = 0; fd < READ_BUFFER_MAX_FD; fd++) {
+    read_buffer_t *buffer = byFd[fd];
+    if (buffer != NULL && buffer->seekable && buffer->end > buffer->start) {
+      lseek(fd, -(off_t) (buffer->end - buffer->start), SEEK_CUR);
+      buffer->start = 0;
+      buffer->end = 0;
+    }
+  }
+}
+
+size_t takeReadAhead(int fd, char *buf, size_t len) {
+  read_buffer_t *buffer = findBuffer(fd);
+  if (buffer == NULL) {
+    return 0;
+  }
+
+  size_t n = buffer->end - buffer->start;
+  if (n > len) {
+    n = len;
+  }
+  memcpy(buf, buffer->data + buffer->start, n);
+  buffer->start += n;
+  if (buffer->start == buffer->end) {
+    buffer->start = 0;
+    buffer->end = 0;
+  }
+  return n;
+}
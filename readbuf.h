@@ -0,0 +1,51 @@
+#ifndef _READBUF_H
+#define _READBUF_H
+
+#include <stddef.h>
+
+/** Size of each read that fills a read-ahead buffer. */
+#define READ_BLOCK_SIZE (64 * 1024)
+
+/** fds below this get a read-ahead buffer, higher ones are read a byte
+ *  at a time. */
+#define READ_BUFFER_MAX_FD 1024
+
+/** Reads the next record ending in delim from fd. Whole blocks are read
+ *  into a buffer kept for what the fd is open on, and what is left over is
+ *  used by the next call, so most records cost no system call at all.
+ *  The shell reads its commands from fd 0 the same way, so the read built
+ *  in carries on right after the line that ran it.
+ *
+ *  Returns the record without the delimiter, with its length in len, and
+ *  sets terminated when the delimiter was found. Returns NULL at the end
+ *  of the input when there was nothing left to read, or on an error. The
+ *  caller is responsible for freeing the record. */
+char *readRecord(int fd, char delim, size_t *len, int *terminated);
+
+/** Reads everything left on fd, starting with what was read ahead. A
+ *  regular file is mapped instead of read, and then mapping is set to what
+ *  has to be given to munmap with mappingLen. Otherwise mapping is NULL
+ *  and the caller frees the data. Returns NULL on an error. */
+char *readRest(int fd, size_t *len, void **mapping, size_t *mappingLen);
+
+/** Tells the buffers that the shell is about to point fd at something
+ *  else. What was read ahead from a file is given back to it, and what was
+ *  read ahead from a pipe is kept for the next fd that reads that pipe. */
+void readAheadMoved(int fd);
+
+/** Tells the buffers that the shell is about to put back the fd it had
+ *  moved. */
+void readAheadRestored(int fd);
+
+/** Moves up to len bytes that were read ahead from fd into buf, for a
+ *  built in that reads fd itself. Returns the number of bytes moved, 0
+ *  when nothing is left over. */
+size_t takeReadAhead(int fd, char *buf, size_t len);
+
+/** Gives back what was read ahead from files, so a child that reads the
+ *  same fd starts where the read built in stopped. Pipes can't take data
+ *  back, so what was read ahead from them is only seen by the built ins.
+ *  Called before the shell forks or execs. */
+void returnReadAhead();
+
+#endif /* ifndef _READBUF_H */
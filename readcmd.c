@@ -0,0 +1,146 @@
+#define _GNU_SOURCE
+#include <assert.h>
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "vect.h"
+#include "vars.h"
+#include "readbuf.h"
+#include "readcmd.h"
+
+// Parses the options both built ins share, returning the index of the first
+// word that isn't an option, or -1 on a bad option
+int readOptions(vect_t *tokens, const char *allowed, char *delim, int *fd, int *flag);
+
+// Parses the options both built ins share, returning the index of the first
+// word that isn't an option, or -1 on a bad option
+int readOptions(vect_t *tokens, const char *allowed, char *delim, int *fd, int *flag) {
+  int i = 1;
+  while (i < vect_size(tokens)) {
+    const char *opt = vect_get(tokens, i);
+    if (opt[0] != '-' || opt[1] == '\0' || opt[2] != '\0' || strchr(allowed, opt[1]) == NULL) {
+      break;
+    }
+
+    if (opt[1] == 'd' || opt[1] == 'u') {
+      if (i + 1 == vect_size(tokens)) {
+	return -1;
+      }
+      const char *arg = vect_get(tokens, i + 1);
+      if (opt[1] == 'd') {
+	*delim = arg[0];
+      }
+      else if (isdigit((unsigned char) arg[0])) {
+	*fd = atoi(arg);
+      }
+      else {
+	return -1;
+      }
+      i += 2;
+    }
+    else {
+      *flag = 1;
+      i++;
+    }
+  }
+  return i;
+}
+
+int readCmd(vect_t *tokens) {
+  char delim = '\n';
+  int fd = STDIN_FILENO;
+  int raw = 0;
+  int first = readOptions(tokens, "rdu", &delim, &fd, &raw);
+  for (int i = first; first != -1 && i < vect_size(tokens); i++) {
+    if (!isVarName(vect_get(tokens, i), strlen(vect_get(tokens, i)))) {
+      first = -1;
+    }
+  }
+  if (first == -1) {
+    char usage[] = "usage: read [-r] [-d DELIM] [-u FD] [NAME...]\n";
+    assert(write(2, usage, strlen(usage)) == strlen(usage));
+    return 1;
+  }
+
+  size_t len = 0;
+  int terminated = 0;
+  char *record = readRecord(fd, delim, &len, &terminated);
+  if (record == NULL) {
+    record = strdup("");
+  }
+
+  if (first == vect_size(tokens)) {
+    setVar("REPLY", record);
+    free(record);
+    return terminated ? 0 : 1;
+  }
+
+  // Each name but the last takes one word, the last one takes the rest
+  char *rest = record;
+  for (int i = first; i < vect_size(tokens); i++) {
+    rest += strspn(rest, READ_FIELD_SEPARATORS);
+    size_t wordLen = i + 1 < vect_size(tokens) ? strcspn(rest, READ_FIELD_SEPARATORS) : strlen(rest);
+    if (i + 1 == vect_size(tokens)) {
+      while (wordLen > 0 && strchr(READ_FIELD_SEPARATORS, rest[wordLen - 1]) != NULL) {
+	wordLen--;
+      }
+    }
+
+    char saved = rest[wordLen];
+    rest[wordLen] = '\0';
+    setVar(vect_get(tokens, i), rest);
+    rest[wordLen] = saved;
+    rest += wordLen;
+  }
+  free(record);
+  return terminated ? 0 : 1;
+}
+
+int mapfileCmd(vect_t *tokens) {
+  char delim = '\n';
+  int fd = STDIN_FILENO;
+  int trim = 0;
+  int first = readOptions(tokens, "tdu", &delim, &fd, &trim);
+  const char *name = MAPFILE_DEFAULT_ARRAY;
+  if (first != -1 && first + 1 == vect_size(tokens)) {
+    name = vect_get(tokens, first);
+  }
+  if (first == -1 || first + 1 < vect_size(tokens) || !isVarName(name, strlen(name))) {
+    char usage[] = "usage: mapfile [-t] [-d DELIM] [-u FD] [ARRAY]\n";
+    assert(write(2, usage, strlen(usage)) == strlen(usage));
+    return 1;
+  }
+
+  size_t len = 0;
+  void *mapping = NULL;
+  size_t mappingLen = 0;
+  char *data = readRest(fd, &len, &mapping, &mappingLen);
+  if (data == NULL) {
+    return 1;
+  }
+
+  // Only the delimiters are looked at, the bytes between them are copied
+  // straight into the elements
+  vect_t *array = vect_new();
+  char *pos = data;
+  char *end = data + len;
+  while (pos < end) {
+    char *found = memchr(pos, delim, end - pos);
+    char *next = found == NULL ? end : found + 1;
+    vect_add_len(array, pos, (trim && found != NULL ? found : next) - pos);
+    pos = next;
+  }
+  setArray(name, array);
+
+  if (mapping != NULL) {
+    munmap(mapping, mappingLen);
+  }
+  else {
+    free(data);
+  }
+  return 0;
+}
@@ -0,0 +1,35 @@
+#ifndef _READCMD_H
+#define _READCMD_H
+
+#include "vect.h"
+
+/** Characters read splits a record on. */
+#define READ_FIELD_SEPARATORS " \t\n"
+
+/** Array mapfile fills when it isn't given a name. */
+#define MAPFILE_DEFAULT_ARRAY "MAPFILE"
+
+/** Runs the read built in:
+ *
+ *    read [-r] [-d DELIM] [-u FD] [NAME...]
+ *
+ *  Reads a record ending in DELIM (a newline by default, the first
+ *  character of DELIM otherwise) from FD, stdin by default, through the
+ *  fd's read-ahead buffer. The record is split on blanks, one word to each
+ *  NAME, and the last NAME gets the rest of the record. Without a NAME the
+ *  whole record goes into REPLY. Backslashes are always kept as they are,
+ *  the way -r keeps them in other shells.
+ *  Returns 0, or 1 at the end of the input or on an error. */
+int readCmd(vect_t *tokens);
+
+/** Runs the mapfile built in, also called readarray:
+ *
+ *    mapfile [-t] [-d DELIM] [-u FD] [ARRAY]
+ *
+ *  Reads everything left on FD, stdin by default, into ARRAY, one record
+ *  in each element. A regular file is mapped and split with memchr rather
+ *  than read. -t removes the delimiter from the end of each element.
+ *  Returns 0, or 1 on an error. */
+int mapfileCmd(vect_t *tokens);
+
+#endif /* ifndef _READCMD_H */
@@ -0,0 +1,574 @@
+#define _GNU_SOURCE
+#include <assert.h>
+#include <ctype.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "vect.h"
+#include "parse.h"
+#include "shell.h"
+#include "expand.h"
+#include "fastcopy.h"
+#include "heredoc.h"
+#include "readbuf.h"
+#include "stats.h"
+#include "redirect.h"
+#include "spawner.h"
+
+/** The files an fd with more than one output redirection writes to. */
+typedef struct fanout {
+  int fd;
+  int remaining;     /* Output redirections of the fd not opened yet. */
+  int withPipe;      /* The pipe the fd already feeds is a target too. */
+  int count;
+  int *targets;
+} fanout_t;
+
+// Expands the word of a redirection, which has to end up as one word
+// Returns NULL and prints an error otherwise
+char *redirectTarget(redir_t *redir);
+
+// Copies the fd into the backup before it gets replaced, and lets the
+// read-ahead buffers know
+void backupFd(fd_backup_t *backup, int fd);
+
+// Points fd at target, which is an fd that is already open
+int moveFd(int target, int fd);
+
+// Opens the file with O_CLOEXEC added to the flags, printing any error
+int openFile(const char *target, int flags);
+
+// Opens the file of a redirection with its flags and O_CLOEXEC
+int openTarget(redir_t *redir, int flags);
+
+// Opens the text of a here-document or here-string
+int openHereText(redir_t *redir);
+
+// Checks if the target of n>&m is an fd number
+int isFdNumber(const char *target);
+
+// Applies one redirection
+int applyRedirect(redir_t *redir, fd_backup_t *backup);
+
+// Points the fd of the redirection at the file that was opened for it
+int replaceFd(int fd, redir_t *redir, fd_backup_t *backup);
+
+// Checks if the redirection only writes to a file
+int isOutputRedirect(redir_t *redir);
+
+// Finds the fan out of the fd, or NULL when the fd only has one output
+fanout_t *findFanout(fanout_t *fanouts, int count, int fd);
+
+// Points the fd at a pipe and starts a copier from it to the targets
+int startFanout(fanout_t *fanout, fd_backup_t *backup);
+
+// Gives fd n of the command fd, closing what it had if it was opened for it
+void setStdFd(std_fds_t *std, int n, int fd, int opened);
+
+// Works out one redirection for openStdFds
+int openStdFd(redir_t *redir, std_fds_t *std);
+
+// Expands the word of a redirection, which has to end up as one word
+// Returns NULL and prints an error otherwise
+char *redirectTarget(redir_t *redir) {
+  if (redir->word == NULL) {
+    char noFile[] = "Error: missing file name for redirection\n";
+    assert(write(2, noFile, strlen(noFile)) == strlen(noFile));
+    return NULL;
+  }
+
+  vect_t *word = vect_new();
+  vect_add(word, redir->word);
+  vect_t *expanded = expandTokens(word, NULL);
+  vect_delete(word);
+  if (expanded == NULL) {
+    return NULL;
+  }
+
+  if (vect_size(expanded) != 1) {
+    fprintf(stderr, "%s: ambiguous redirect\n", redir->word);
+    vect_delete(expanded);
+    return NULL;
+  }
+
+  char *target = vect_get_copy(expanded, 0);
+  vect_delete(expanded);
+  return target;
+}
+
+// Copies the fd into the backup before it gets replaced, and lets the
+// read-ahead buffers know
+void backupFd(fd_backup_t *backup, int fd) {
+  readAheadMoved(fd);
+  if (backup == NULL) {
+    return;
+  }
+  backup->fds[backup->count] = fd;
+  backup->copies[backup->count] = fcntl(fd, F_DUPFD_CLOEXEC, REDIRECT_BACKUP_MIN_FD);
+  backup->count++;
+}
+
+// Points fd at target, which is an fd that is already open
+// dup2 leaves the new fd without close-on-exec, but when the two are the
+// same fd the flag has to be cleared by hand
+int moveFd(int target, int fd) {
+  if (target == fd) {
+    return fcntl(fd, F_SETFD, 0);
+  }
+  return dup2(target, fd) == -1 ? -1 : 0;
+}
+
+// Opens the file with O_CLOEXEC added to the flags, printing any error
+int openFile(const char *target, int flags) {
+  int fd = open(target, flags | O_CLOEXEC, 0644);
+  if (fd == -1) {
+    perror(target);
+  }
+  return fd;
+}
+
+// Opens the file of a redirection with its flags and O_CLOEXEC
+int openTarget(redir_t *redir, int flags) {
+  char *target = redirectTarget(redir);
+  if (target == NULL) {
+    return -1;
+  }
+
+  int fd = openFile(target, flags);
+  free(target);
+  return fd;
+}
+
+// Opens the text of a here-document or here-string
+// The text is expanded like a word in quotes, so it is never split
+int openHereText(redir_t *redir) {
+  if (redir->word == NULL) {
+    char noText[] = "Error: missing word for here-document\n";
+    assert(write(2, noText, strlen(noText)) == strlen(noText));
+    return -1;
+  }
+
+  char *text;
+  if (redir->type == REDIR_HEREDOC_LITERAL) {
+    text = strdup(redir->word);
+  }
+  else {
+    // A here-document body is plain text, a here-string is a token
+    text = redir->type == REDIR_HERESTRING ? expandUnsplit(redir->word) : expandString(redir->word);
+    if (text == NULL) {
+      return -1;
+    }
+  }
+
+  // A here-string ends with a newline like a line would
+  size_t len = strlen(text);
+  if (redir->type == REDIR_HERESTRING) {
+    size_t cap = len + 1;
+    text = appendString(text, &len, &cap, "\n", 1);
+  }
+
+  int fd = openHeredoc(text, len);
+  free(text);
+  return fd;
+}
+
+// Checks if the target of n>&m is an fd number
+int isFdNumber(const char *target) {
+  int numeric = target[0] != '\0';
+  for (int i = 0; target[i] != '\0'; i++) {
+    numeric = numeric && isdigit((unsigned char) target[i]);
+  }
+  return numeric;
+}
+
+// Applies one redirection
+int applyRedirect(redir_t *redir, fd_backup_t *backup) {
+  if (redir->type == REDIR_HEREDOC || redir->type == REDIR_HEREDOC_LITERAL
+      || redir->type == REDIR_HERESTRING) {
+    int fd = openHereText(redir);
+    if (fd == -1) {
+      return -1;
+    }
+    return replaceFd(fd, redir, backup);
+  }
+
+  if (redir->type != REDIR_DUP) {
+    int fd = openTarget(redir, redir->flags);
+    if (fd == -1) {
+      return -1;
+    }
+    return replaceFd(fd, redir, backup);
+  }
+
+  char *target = redirectTarget(redir);
+  if (target == NULL) {
+    return -1;
+  }
+
+  // n>&- closes n
+  if (strcmp(target, "-") == 0) {
+    free(target);
+    backupFd(backup, redir->fd);
+    close(redir->fd);
+    return 0;
+  }
+
+  if (isFdNumber(target)) {
+    int from = atoi(target);
+    if (fcntl(from, F_GETFD) == -1) {
+      fprintf(stderr, "%s: bad file descriptor\n", target);
+      free(target);
+      return -1;
+    }
+    free(target);
+    backupFd(backup, redir->fd);
+    return moveFd(from, redir->fd);
+  }
+
+  // >&file is the same as &>file
+  if (redir->fd != 1) {
+    fprintf(stderr, "%s: ambiguous redirect\n", target);
+    free(target);
+    return -1;
+  }
+  int fd = openFile(target, O_WRONLY | O_CREAT | O_TRUNC);
+  free(target);
+  if (fd == -1) {
+    return -1;
+  }
+  return replaceFd(fd, redir, backup);
+}
+
+// Points the fd of the redirection at the file that was opened for it
+int replaceFd(int fd, redir_t *redir, fd_backup_t *backup) {
+  backupFd(backup, redir->fd);
+  int result = moveFd(fd, redir->fd);
+  if (fd != redir->fd) {
+    close(fd);
+  }
+
+  // Both stdout and stderr go to the file, for &> and >&file
+  if (result == 0 && (redir->type == REDIR_BOTH || redir->type == REDIR_DUP)) {
+    backupFd(backup, STDERR_FILENO);
+    result = moveFd(redir->fd, STDERR_FILENO);
+  }
+  return result;
+}
+
+// Checks if the redirection only writes to a file
+int isOutputRedirect(redir_t *redir) {
+  return redir->type == REDIR_FILE && (redir->flags & O_ACCMODE) == O_WRONLY;
+}
+
+// Finds the fan out of the fd, or NULL when the fd only has one output
+fanout_t *findFanout(fanout_t *fanouts, int count, int fd) {
+  for (int i = 0; i < count; i++) {
+    if (fanouts[i].fd == fd) {
+      return &fanouts[i];
+    }
+  }
+  return NULL;
+}
+
+// Points the fd at a pipe and starts a copier from it to the targets
+int startFanout(fanout_t *fanout, fd_backup_t *backup) {
+  int pipe_fd[2];
+  if (pipe2(pipe_fd, O_CLOEXEC) == -1) {
+    perror("Error creating pipe");
+    return -1;
+  }
+
+  int pid = countedFork();
+  if (pid < 0) {
+    perror("Error - fork failed");
+    close(pipe_fd[0]);
+    close(pipe_fd[1]);
+    return -1;
+  }
+
+  // The copier is the child in the shell, and the process itself when it
+  // is about to exec so the status it exits with is the command's
+  int copier = backup == NULL ? pid != 0 : pid == 0;
+  if (copier) {
+    close(pipe_fd[1]);
+    signal(SIGPIPE, SIG_IGN);
+    fanOut(pipe_fd[0], fanout->targets, fanout->count);
+    close(pipe_fd[0]);
+
+    // Close the targets before waiting so readers see the end right away
+    for (int i = 0; i < fanout->count; i++) {
+      close(fanout->targets[i]);
+    }
+    if (backup != NULL) {
+      _exit(0);
+    }
+    int wstatus = 0;
+    countedWaitpid(pid, &wstatus, 0);
+    _exit(exitStatus(wstatus));
+  }
+
+  close(pipe_fd[0]);
+  for (int i = 0; i < fanout->count; i++) {
+    close(fanout->targets[i]);
+  }
+  fanout->count = 0;
+
+  backupFd(backup, fanout->fd);
+  int result = moveFd(pipe_fd[1], fanout->fd);
+  if (pipe_fd[1] != fanout->fd) {
+    close(pipe_fd[1]);
+  }
+  if (backup != NULL) {
+    backup->copiers[backup->copierCount++] = pid;
+  }
+  return result;
+}
+
+int applyRedirects(cmd_t *cmd, fd_backup_t *backup) {
+  int most = 0;
+  for (redir_t *redir = cmd->redirs; redir != NULL; redir = redir->next) {
+    most++;
+  }
+
+  if (backup != NULL) {
+    // Each redirection replaces at most two fds
+    backup->count = 0;
+    backup->fds = most > 0 ? malloc(2 * most * sizeof(int)) : NULL;
+    backup->copies = most > 0 ? malloc(2 * most * sizeof(int)) : NULL;
+    backup->copierCount = 0;
+    backup->copiers = most > 0 ? malloc(most * sizeof(int)) : NULL;
+  }
+  if (most == 0) {
+    return 0;
+  }
+
+  // Count the output files of each fd to find the ones that fan out
+  fanout_t *fanouts = calloc(most, sizeof(fanout_t));
+  int fanoutCount = 0;
+  for (redir_t *redir = cmd->redirs; redir != NULL; redir = redir->next) {
+    if (!isOutputRedirect(redir)) {
+      continue;
+    }
+    fanout_t *fanout = findFanout(fanouts, fanoutCount, redir->fd);
+    if (fanout == NULL) {
+      fanout = &fanouts[fanoutCount++];
+      fanout->fd = redir->fd;
+      fanout->withPipe = cmd->pipedOut && redir->fd == STDOUT_FILENO;
+    }
+    fanout->remaining++;
+  }
+
+  int kept = 0;
+  for (int i = 0; i < fanoutCount; i++) {
+    if (fanouts[i].remaining + fanouts[i].withPipe >= 2) {
+      fanouts[kept] = fanouts[i];
+      fanouts[kept].targets = malloc((fanouts[i].remaining + 1) * sizeof(int));
+      kept++;
+    }
+  }
+  fanoutCount = kept;
+
+  int result = 0;
+  for (redir_t *redir = cmd->redirs; redir != NULL && result == 0; redir = redir->next) {
+    countStat(STAT_REDIRECTIONS, 1);
+    fanout_t *fanout = isOutputRedirect(redir) ? findFanout(fanouts, fanoutCount, redir->fd) : NULL;
+    if (fanout == NULL) {
+      result = applyRedirect(redir, backup);
+      continue;
+    }
+
+    // Files of an fd that fans out are collected until the last one is open
+    if (fanout->count == 0 && fanout->withPipe) {
+      fanout->targets[fanout->count++] = fcntl(fanout->fd, F_DUPFD_CLOEXEC, REDIRECT_BACKUP_MIN_FD);
+    }
+    int fd = openTarget(redir, redir->flags);
+    if (fd == -1) {
+      result = -1;
+      continue;
+    }
+    fanout->targets[fanout->count++] = fd;
+
+    if (--fanout->remaining == 0) {
+      result = startFanout(fanout, backup);
+    }
+  }
+
+  // An error part way leaves files open that never got a copier
+  for (int i = 0; i < fanoutCount; i++) {
+    for (int j = 0; j < fanouts[i].count; j++) {
+      close(fanouts[i].targets[j]);
+    }
+    free(fanouts[i].targets);
+  }
+  free(fanouts);
+  return result;
+}
+
+int fansOut(cmd_t *cmd) {
+  for (redir_t *redir = cmd->redirs; redir != NULL; redir = redir->next) {
+    if (!isOutputRedirect(redir)) {
+      continue;
+    }
+    int outputs = cmd->pipedOut && redir->fd == STDOUT_FILENO;
+    for (redir_t *other = cmd->redirs; other != NULL; other = other->next) {
+      outputs += isOutputRedirect(other) && other->fd == redir->fd;
+    }
+    if (outputs >= 2) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+// Gives fd n of the command fd, closing what it had if it was opened for it
+void setStdFd(std_fds_t *std, int n, int fd, int opened) {
+  if (std->opened[n]) {
+    close(std->fds[n]);
+  }
+  std->fds[n] = fd;
+  std->opened[n] = opened;
+}
+
+// Works out one redirection for openStdFds
+int openStdFd(redir_t *redir, std_fds_t *std) {
+  int fd;
+  if (redir->type == REDIR_HEREDOC || redir->type == REDIR_HEREDOC_LITERAL
+      || redir->type == REDIR_HERESTRING) {
+    fd = openHereText(redir);
+  }
+  else if (redir->type != REDIR_DUP) {
+    fd = openTarget(redir, redir->flags);
+  }
+  else {
+    char *target = redirectTarget(redir);
+    if (target == NULL) {
+      return -1;
+    }
+
+    // n>&- closes n
+    if (strcmp(target, "-") == 0) {
+      free(target);
+      setStdFd(std, redir->fd, -1, 0);
+      return 0;
+    }
+
+    if (isFdNumber(target)) {
+      // Fds 0 to 2 are whatever the earlier redirections made them
+      int from = atoi(target);
+      int source = from <= 2 ? std->fds[from] : from;
+      if (source == -1 || fcntl(source, F_GETFD) == -1) {
+        fprintf(stderr, "%s: bad file descriptor\n", target);
+        free(target);
+        return -1;
+      }
+      free(target);
+      if (from > 2 || !std->opened[from]) {
+        setStdFd(std, redir->fd, source, 0);
+        return 0;
+      }
+      fd = fcntl(source, F_DUPFD_CLOEXEC, 0);
+      if (fd == -1) {
+        perror("Error copying fd");
+        return -1;
+      }
+      setStdFd(std, redir->fd, fd, 1);
+      return 0;
+    }
+
+    // >&file is the same as &>file
+    if (redir->fd != 1) {
+      fprintf(stderr, "%s: ambiguous redirect\n", target);
+      free(target);
+      return -1;
+    }
+    fd = openFile(target, O_WRONLY | O_CREAT | O_TRUNC);
+    free(target);
+  }
+  if (fd == -1) {
+    return -1;
+  }
+  setStdFd(std, redir->fd, fd, 1);
+
+  // Both stdout and stderr go to the file, for &> and >&file
+  if (redir->type == REDIR_BOTH || redir->type == REDIR_DUP) {
+    int copy = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+    if (copy == -1) {
+      perror("Error copying fd");
+      return -1;
+    }
+    setStdFd(std, STDERR_FILENO, copy, 1);
+  }
+  return 0;
+}
+
+int openStdFds(cmd_t *cmd, std_fds_t *std) {
+  // A closed fd stays closed for the command
+  for (int n = 0; n < 3; n++) {
+    std->fds[n] = fcntl(n, F_GETFD) == -1 ? -1 : n;
+    std->opened[n] = 0;
+  }
+
+  for (redir_t *redir = cmd->redirs; redir != NULL; redir = redir->next) {
+    countStat(STAT_REDIRECTIONS, 1);
+    if (openStdFd(redir, std) == -1) {
+      closeStdFds(std);
+      return -1;
+    }
+  }
+  return 0;
+}
+
+void closeStdFds(std_fds_t *std) {
+  for (int n = 0; n < 3; n++) {
+    setStdFd(std, n, -1, 0);
+  }
+}
+
+void restoreRedirects(fd_backup_t *backup) {
+  for (int i = backup->count - 1; i >= 0; i--) {
+    readAheadRestored(backup->fds[i]);
+    if (backup->copies[i] == -1) {
+      close(backup->fds[i]);
+    }
+    else {
+      dup2(backup->copies[i], backup->fds[i]);
+      close(backup->copies[i]);
+    }
+  }
+
+  // Putting the fds back closed the pipes so the copiers can finish
+  for (int i = 0; i < backup->copierCount; i++) {
+    countedWaitpid(backup->copiers[i], NULL, 0);
+  }
+
+  free(backup->fds);
+  free(backup->copies);
+  free(backup->copiers);
+  backup->count = 0;
+  backup->copierCount = 0;
+}
+
+void forgetRedirects(fd_backup_t *backup) {
+  for (int i = 0; i < backup->count; i++) {
+    // The spawn helper only gives commands fds 0 to 2, so the shell forks
+    // the commands that would inherit another one itself
+    if (backup->fds[i] > 2) {
+      spawnFdKept(backup->fds[i]);
+    }
+    if (backup->copies[i] != -1) {
+      close(backup->copies[i]);
+    }
+  }
+  free(backup->fds);
+  free(backup->copies);
+  free(backup->copiers);
+  backup->count = 0;
+  backup->copierCount = 0;
+}
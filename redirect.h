@@ -0,0 +1,63 @@
+#ifndef _REDIRECT_H
+#define _REDIRECT_H
+
+#include "parse.h"
+
+/** Lowest fd used for the copies in a backup, so they stay out of the way
+ *  of the small fds that scripts redirect. */
+#define REDIRECT_BACKUP_MIN_FD 10
+
+/** The fds that redirections replaced in the shell, so they can be put back. */
+typedef struct fd_backup {
+  int count;
+  int *fds;          /* The fds that were replaced, in order. */
+  int *copies;       /* Close-on-exec copies of them, -1 when the fd wasn't open. */
+  int copierCount;
+  int *copiers;      /* Processes copying the output of an fd to its files. */
+} fd_backup_t;
+
+/** What a command gets as fds 0 to 2. */
+typedef struct std_fds {
+  int fds[3];        /* The fd it gets as fd n, -1 when it gets fd n closed. */
+  int opened[3];     /* Set when fds[n] was opened for the command. */
+} std_fds_t;
+
+/** Opens the targets of the redirections of the simple command in order and
+ *  points the fds at them. Everything is opened with O_CLOEXEC so only the
+ *  redirected fds survive an exec.
+ *
+ *  An fd with more than one output file (counting the pipe when the command
+ *  feeds one) writes to all of them, like multios in zsh. The fd becomes a
+ *  pipe and a copier process moves the data to every file with fanOut.
+ *
+ *  When backup is NULL the process is about to exec, so the old fds are
+ *  simply replaced. A copier is then the process itself: the command
+ *  carries on in a new child, and the copier exits with its status once
+ *  the copy is done. Otherwise each fd is copied into the backup first and
+ *  the copiers are children that restoreRedirects waits for.
+ *  Returns 0, or prints an error and returns -1. */
+int applyRedirects(cmd_t *cmd, fd_backup_t *backup);
+
+/** Checks if an fd of the simple command has more than one output file,
+ *  counting the pipe it feeds, so applyRedirects would start a copier. */
+int fansOut(cmd_t *cmd);
+
+/** Works out what the simple command gets as fds 0 to 2 from the shell's
+ *  and its redirections, like applyRedirects would leave them, but without
+ *  changing the shell's own fds. This is for the spawn helper, so the
+ *  command may only redirect fds 0 to 2 and must not fan out.
+ *  Returns 0, or prints an error, closes what it opened and returns -1. */
+int openStdFds(cmd_t *cmd, std_fds_t *std);
+
+/** Closes the fds openStdFds opened for the command. */
+void closeStdFds(std_fds_t *std);
+
+/** Puts back the fds in the backup in reverse order, waits for any copiers
+ *  to finish, and frees the backup. */
+void restoreRedirects(fd_backup_t *backup);
+
+/** Keeps the redirections in the backup for good, like exec > file does,
+ *  and frees the backup. */
+void forgetRedirects(fd_backup_t *backup);
+
+#endif /* ifndef _REDIRECT_H */
@@ -0,0 +1,341 @@
+#define _GNU_SOURCE
+#include <assert.h>
+#include <ctype.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#include "vect.h"
+#include "shell.h"
+#include "cache.h"
+#include "vars.h"
+#include "stats.h"
+#include "readbuf.h"
+#include "rlimit.h"
+#include "spawner.h"
+
+/** A resource ulimit can show and change. */
+typedef struct limit_kind {
+  char opt;
+  int resource;
+  rlim_t unit;           /* Bytes or seconds in one unit of a value. */
+  const char *name;
+} limit_kind_t;
+
+static const limit_kind_t kinds[] = {
+  { 'c', RLIMIT_CORE, 1024, "core file size (kbytes)" },
+  { 'f', RLIMIT_FSIZE, 1024, "file size (kbytes)" },
+  { 'n', RLIMIT_NOFILE, 1, "open files" },
+  { 's', RLIMIT_STACK, 1024, "stack size (kbytes)" },
+  { 't', RLIMIT_CPU, 1, "cpu time (seconds)" },
+  { 'u', RLIMIT_NPROC, 1, "max user processes" },
+  { 'v', RLIMIT_AS, 1024, "virtual memory (kbytes)" },
+};
+
+#define LIMIT_KINDS (sizeof(kinds) / sizeof(kinds[0]))
+
+// Finds the resource of a ulimit option, NULL when there is none
+const limit_kind_t *findKind(char opt);
+
+// Prints one limit, soft or hard, in the units of its option
+void printLimit(const limit_kind_t *kind, int hard, int withName);
+
+// Parses a count of units, or of the scale of a suffix, into value
+// Returns -1 when it isn't a number, has another suffix or overflows
+int parseScaled(const char *arg, rlim_t unit, const char *suffixes, const rlim_t *scales, rlim_t *value);
+
+// Lowers the soft and hard limit of the resource in this process
+int lowerLimit(int resource, rlim_t soft, rlim_t hard);
+
+// Writes a size in bytes with a K, M or G
+void formatSize(char *out, size_t cap, double bytes);
+
+// Finds the resource of a ulimit option, NULL when there is none
+const limit_kind_t *findKind(char opt) {
+  for (int i = 0; i < LIMIT_KINDS; i++) {
+    if (kinds[i].opt == opt) {
+      return &kinds[i];
+    }
+  }
+  return NULL;
+}
+
+// Prints one limit, soft or hard, in the units of its option
+void printLimit(const limit_kind_t *kind, int hard, int withName) {
+  struct rlimit rl;
+  if (getrlimit(kind->resource, &rl) == -1) {
+    perror("ulimit");
+    return;
+  }
+
+  rlim_t value = hard ? rl.rlim_max : rl.rlim_cur;
+  char line[128];
+  int len = withName ? snprintf(line, sizeof(line), "%-28s(-%c) ", kind->name, kind->opt) : 0;
+  if (value == RLIM_INFINITY) {
+    len += snprintf(line + len, sizeof(line) - len, "unlimited\n");
+  }
+  else {
+    len += snprintf(line + len, sizeof(line) - len, "%llu\n",
+		    (unsigned long long) (value / kind->unit));
+  }
+  assert(write(1, line, len) == len);
+}
+
+// Parses a count of units, or of the scale of a suffix, into value
+// Returns -1 when it isn't a number, has another suffix or overflows
+int parseScaled(const char *arg, rlim_t unit, const char *suffixes, const rlim_t *scales, rlim_t *value) {
+  if (!isdigit((unsigned char) arg[0])) {
+    return -1;
+  }
+  errno = 0;
+  char *end;
+  unsigned long long count = strtoull(arg, &end, 10);
+  if (errno != 0) {
+    return -1;
+  }
+
+  rlim_t scale = unit;
+  if (*end != '\0') {
+    const char *suffix = strchr(suffixes, tolower((unsigned char) *end));
+    if (suffix == NULL || end[1] != '\0') {
+      return -1;
+    }
+    scale = scales[suffix - suffixes];
+  }
+  if (count > (RLIM_INFINITY - 1) / scale) {
+    return -1;
+  }
+  *value = count * scale;
+  return 0;
+}
+
+// Lowers the soft and hard limit of the resource in this process
+int lowerLimit(int resource, rlim_t soft, rlim_t hard) {
+  struct rlimit rl;
+  if (getrlimit(resource, &rl) == -1) {
+    return -1;
+  }
+
+  // Only a privileged process can raise the hard limit
+  if (rl.rlim_max != RLIM_INFINITY && hard > rl.rlim_max) {
+    hard = rl.rlim_max;
+  }
+  rl.rlim_cur = soft < hard ? soft : hard;
+  rl.rlim_max = hard;
+  return setrlimit(resource, &rl);
+}
+
+// Writes a size in bytes with a K, M or G
+void formatSize(char *out, size_t cap, double bytes) {
+  const char *units = "KMG";
+  int unit = 0;
+  bytes /= 1024;
+  while (bytes >= 1024 && unit < 2) {
+    bytes /= 1024;
+    unit++;
+  }
+  snprintf(out, cap, "%.1f%c", bytes, units[unit]);
+}
+
+int ulimitCmd(vect_t *tokens) {
+  char usage[] = "usage: ulimit [-S | -H] [-a | -c | -f | -n | -s | -t | -u | -v] [VALUE]\n";
+  int soft = 0;
+  int hard = 0;
+  int all = 0;
+  const limit_kind_t *kind = NULL;
+
+  // Options come first and the value, if any, is the last word
+  int i = 1;
+  int ok = 1;
+  for (; ok && i < vect_size(tokens); i++) {
+    const char *arg = vect_get(tokens, i);
+    if (arg[0] != '-' || arg[1] == '\0' || arg[2] != '\0') {
+      break;
+    }
+    if (arg[1] == 'S') {
+      soft = 1;
+    }
+    else if (arg[1] == 'H') {
+      hard = 1;
+    }
+    else if (arg[1] == 'a') {
+      all = 1;
+    }
+    else {
+      ok = kind == NULL && findKind(arg[1]) != NULL;
+      kind = findKind(arg[1]);
+    }
+  }
+  const char *value = i < vect_size(tokens) ? vect_get(tokens, i) : NULL;
+  if (!ok || i + 1 < vect_size(tokens) || (all && value != NULL)) {
+    assert(write(2, usage, strlen(usage)) == strlen(usage));
+    return 1;
+  }
+
+  if (all) {
+    for (int i = 0; i < LIMIT_KINDS; i++) {
+      printLimit(&kinds[i], hard && !soft, 1);
+    }
+    return 0;
+  }
+  if (kind == NULL) {
+    kind = findKind('f');
+  }
+  if (value == NULL) {
+    printLimit(kind, hard && !soft, 0);
+    return 0;
+  }
+
+  // The value is in the units of the option
+  rlim_t limit = RLIM_INFINITY;
+  if (strcmp(value, "unlimited") != 0) {
+    if (parseScaled(value, kind->unit, "", NULL, &limit) == -1) {
+      assert(write(2, usage, strlen(usage)) == strlen(usage));
+      return 1;
+    }
+  }
+
+  // Without -S or -H both limits change
+  struct rlimit rl;
+  if (getrlimit(kind->resource, &rl) == -1) {
+    perror("ulimit");
+    return 1;
+  }
+  if (soft || !hard) {
+    rl.rlim_cur = limit;
+  }
+  if (hard || !soft) {
+    rl.rlim_max = limit;
+  }
+  if (setrlimit(kind->resource, &rl) == -1) {
+    perror("ulimit");
+    return 1;
+  }
+  spawnLimitsChanged();
+  return 0;
+}
+
+int limitCmd(vect_t *tokens) {
+  char usageMsg[] = "usage: limit [-m SIZE] [-t TIME] [-n FILES] -- command [args...]\n";
+  rlim_t memory = RLIM_INFINITY;
+  rlim_t cpu = RLIM_INFINITY;
+  rlim_t files = RLIM_INFINITY;
+  rlim_t sizeScales[] = { 1024, 1024 * 1024, 1024 * 1024 * 1024, (rlim_t) 1024 * 1024 * 1024 * 1024 };
+  rlim_t timeScales[] = { 1, 60, 3600 };
+
+  int i = 1;
+  int ok = 1;
+  while (ok && i < vect_size(tokens) && strcmp(vect_get(tokens, i), "--") != 0) {
+    const char *opt = vect_get(tokens, i);
+    const char *arg = i + 1 < vect_size(tokens) ? vect_get(tokens, i + 1) : NULL;
+    if (arg == NULL) {
+      ok = 0;
+    }
+    else if (strcmp(opt, "-m") == 0) {
+      ok = parseScaled(arg, 1, "kmgt", sizeScales, &memory) == 0;
+    }
+    else if (strcmp(opt, "-t") == 0) {
+      ok = parseScaled(arg, 1, "smh", timeScales, &cpu) == 0;
+    }
+    else if (strcmp(opt, "-n") == 0) {
+      ok = parseScaled(arg, 1, "", NULL, &files) == 0;
+    }
+    else {
+      ok = 0;
+    }
+    i += 2;
+  }
+  if (!ok || i + 1 >= vect_size(tokens)) {
+    assert(write(2, usageMsg, strlen(usageMsg)) == strlen(usageMsg));
+    return 1;
+  }
+
+  char *text;
+  parsed_line_t *line = parseWords(tokens, i + 1, vect_size(tokens), &text);
+  if (line == NULL) {
+    fprintf(stderr, "limit: syntax error in %s", text);
+    free(text);
+    return 1;
+  }
+  text[strlen(text) - 1] = '\0';
+
+  // The limits are set between fork and exec, so only the child has them,
+  // and it reads stdin from where the read built in stopped
+  returnReadAhead();
+  int pid = countedFork();
+  if (pid == 0) {
+    if ((memory != RLIM_INFINITY && lowerLimit(RLIMIT_AS, memory, memory) == -1)
+	|| (cpu != RLIM_INFINITY && lowerLimit(RLIMIT_CPU, cpu, cpu + LIMIT_CPU_GRACE) == -1)
+	|| (files != RLIM_INFINITY && lowerLimit(RLIMIT_NOFILE, files, files) == -1)) {
+      perror("limit");
+      _exit(126);
+    }
+    _exit(runParsed(line, 1));
+  }
+  releaseLine(line);
+  if (pid < 0) {
+    perror("Error - fork failed");
+    free(text);
+    return 1;
+  }
+
+  int wstatus = 0;
+  struct rusage usage;
+  memset(&usage, 0, sizeof(usage));
+  countedWait4(pid, &wstatus, 0, &usage);
+  int result = exitStatus(wstatus);
+
+  // CPU time is the only limit the kernel kills for, the others make calls
+  // fail and the command decides what to do about it. A command that dies
+  // from a crash or SIGKILL under a memory cap most likely ran out, but an
+  // exit status alone says nothing about a limit
+  double cpuUsed = usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6
+    + usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+  int sig = WIFSIGNALED(wstatus) ? WTERMSIG(wstatus) : 0;
+  char tripped[32] = "";
+  if (cpu != RLIM_INFINITY && (sig == SIGXCPU || (sig == SIGKILL && cpuUsed >= cpu))) {
+    strcpy(tripped, "cpu");
+  }
+  else if (memory != RLIM_INFINITY && (sig == SIGSEGV || sig == SIGABRT
+					  || sig == SIGBUS || sig == SIGKILL)) {
+    strcpy(tripped, "memory");
+  }
+  setVar("LIMIT_TRIPPED", tripped);
+
+  if (tripped[0] != '\0') {
+    // Only a signal names a limit, so the command was always killed
+    char how[96];
+    snprintf(how, sizeof(how), "killed by signal %d (%s)", sig, strsignal(sig));
+
+    const char *cause = strcmp(tripped, "cpu") == 0 ? "cpu time limit hit"
+      : "memory limit probably hit";
+
+    char rss[32];
+    formatSize(rss, sizeof(rss), usage.ru_maxrss * 1024.0);
+    char used[160];
+    int len = snprintf(used, sizeof(used), "cpu %.2fs", cpuUsed);
+    if (cpu != RLIM_INFINITY) {
+      len += snprintf(used + len, sizeof(used) - len, " of %llus", (unsigned long long) cpu);
+    }
+    len += snprintf(used + len, sizeof(used) - len, ", max rss %s", rss);
+    if (memory != RLIM_INFINITY) {
+      char cap[32];
+      formatSize(cap, sizeof(cap), memory);
+      len += snprintf(used + len, sizeof(used) - len, " of %s address space", cap);
+    }
+    if (files != RLIM_INFINITY) {
+      snprintf(used + len, sizeof(used) - len, ", %llu files", (unsigned long long) files);
+    }
+    fprintf(stderr, "limit: %s: %s, %s (%s)\n", text, how, cause, used);
+  }
+  free(text);
+  return result;
+}
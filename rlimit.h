@@ -0,0 +1,43 @@
+#ifndef _RLIMIT_H
+#define _RLIMIT_H
+
+#include "vect.h"
+
+/** Seconds of CPU time between SIGXCPU and SIGKILL for limit -t, so a
+ *  child that hits the limit is told why before it is killed. */
+#define LIMIT_CPU_GRACE 1
+
+/** Runs the ulimit built in:
+ *
+ *    ulimit [-S | -H] [-a | -c | -f | -n | -s | -t | -u | -v] [VALUE]
+ *
+ *  Shows or sets a resource limit of the shell, which every command it
+ *  starts afterwards inherits. Sizes are in kbytes and -t is in seconds,
+ *  VALUE may also be unlimited. -f is used when no resource is given. -S
+ *  and -H pick the soft or the hard limit, setting changes both by default
+ *  and showing shows the soft one. -a shows every limit.
+ *  Returns 0, or 1 on an error. */
+int ulimitCmd(vect_t *tokens);
+
+/** Runs the limit prefix:
+ *
+ *    limit [-m SIZE] [-t TIME] [-n FILES] -- command [args...]
+ *
+ *  Runs the command in a child that gets the limits right after it is
+ *  forked, so the shell keeps its own. -m caps the address space
+ *  (RLIMIT_AS) at SIZE bytes, with an optional K, M, G or T. -t caps the
+ *  CPU time (RLIMIT_CPU) at TIME seconds, with an optional s, m or h. -n
+ *  caps the open files (RLIMIT_NOFILE). The words are joined like bench
+ *  does, so a pipeline has to be quoted, and all of it shares the limits.
+ *
+ *  When a limit tripped, a line on stderr says which one, with the CPU
+ *  time and the peak RSS of the child against the limits. Running out of
+ *  CPU time is certain from the signal. Running out of memory only makes
+ *  calls fail, so memory is named only when the child then died from
+ *  SIGSEGV, SIGABRT, SIGBUS or SIGKILL with -m set. Running out of files
+ *  leaves no trace at all, so it is never named. A command that just
+ *  exits with an error isn't blamed on a limit. LIMIT_TRIPPED is set to
+ *  the limit named, or to nothing. Returns the exit status of the command. */
+int limitCmd(vect_t *tokens);
+
+#endif /* ifndef _RLIMIT_H */
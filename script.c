@@ -0,0 +1,562 @@
+#define _GNU_SOURCE
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include "vect.h"
+#include "parse.h"
+#include "shell.h"
+#include "expand.h"
+#include "vars.h"
+#include "script.h"
+#include "redirect.h"
+#include "stats.h"
+
+/** State of the compiler while it walks the tokens. */
+typedef struct compiler {
+  vect_t *tokens;
+  unsigned int pos;
+  program_t *prog;
+  int error;
+  int incomplete;
+  int report;        /* Print errors, unset for a compile that only checks. */
+  vect_t *prev;      /* Last plain statement, for prev. */
+} compiler_t;
+
+// Words that can end a list of statements
+static const char *THEN[] = { "then", NULL };
+static const char *IF_BRANCH[] = { "elif", "else", "fi", NULL };
+static const char *FI[] = { "fi", NULL };
+static const char *DO[] = { "do", NULL };
+static const char *DONE[] = { "done", NULL };
+
+// Words that can't start a plain statement
+static const char *RESERVED[] = { "then", "elif", "else", "fi", "do", "done", NULL };
+
+void compileList(compiler_t *c, const char **terms);
+void compileStatement(compiler_t *c);
+
+// Compiles the tokens, printing errors only when report is set
+program_t *compile(vect_t *tokens, int *incomplete, int report);
+
+// Checks if the word is one of the words in the list
+int isOneOf(const char *word, const char **list) {
+  for (int i = 0; list[i] != NULL; i++) {
+    if (strcmp(word, list[i]) == 0) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+int isScriptKeyword(const char *word) {
+  return strcmp(word, "if") == 0 || strcmp(word, "while") == 0
+    || strcmp(word, "for") == 0;
+}
+
+int startsScript(vect_t *tokens) {
+  // A keyword only counts at the start of a statement
+  for (int i = 0; i < vect_size(tokens); i++) {
+    if ((i == 0 || strcmp(vect_get(tokens, i - 1), ";") == 0)
+	&& isScriptKeyword(vect_get(tokens, i))) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+int isIncompleteScript(vect_t *tokens) {
+  // The script is compiled again once it is complete, which reports errors
+  int incomplete = 0;
+  program_t *prog = compile(tokens, &incomplete, 0);
+  if (prog != NULL) {
+    program_delete(prog);
+  }
+  return incomplete;
+}
+
+// The token the compiler is looking at, or NULL at the end
+const char *peek(compiler_t *c) {
+  if (c->pos >= vect_size(c->tokens)) {
+    return NULL;
+  }
+  return vect_get(c->tokens, c->pos);
+}
+
+// Records a syntax error at the word, where NULL means the tokens ran out
+void syntaxError(compiler_t *c, const char *near) {
+  if (c->error) {
+    return;
+  }
+  c->error = 1;
+
+  if (near == NULL) {
+    c->incomplete = 1;
+    return;
+  }
+  if (!c->report) {
+    return;
+  }
+  fprintf(stderr, "syntax error near unexpected token '%s'\n", near);
+}
+
+// Consumes the word if it is next, otherwise it is a syntax error
+int expect(compiler_t *c, const char *word) {
+  const char *next = peek(c);
+  if (next == NULL || strcmp(next, word) != 0) {
+    syntaxError(c, next);
+    return 0;
+  }
+  c->pos++;
+  return 1;
+}
+
+// Adds an instruction to the end of the program and returns its index
+int emit(compiler_t *c, opcode_t op) {
+  program_t *prog = c->prog;
+  if (prog->size == prog->capacity) {
+    prog->capacity = prog->capacity * PROGRAM_GROWTH_FACTOR;
+    prog->code = realloc(prog->code, prog->capacity * sizeof(instr_t));
+  }
+
+  instr_t *instr = &prog->code[prog->size];
+  memset(instr, 0, sizeof(instr_t));
+  instr->op = op;
+  return prog->size++;
+}
+
+// Points the jump at idx to the next instruction that will be emitted
+void patch(compiler_t *c, int idx) {
+  c->prog->code[idx].target = c->prog->size;
+}
+
+// Puts a new instruction at idx, moving the code from there on one place
+// up along with the jumps in it. Code before idx must not jump past it yet
+int insertAt(compiler_t *c, int idx, opcode_t op) {
+  program_t *prog = c->prog;
+  emit(c, op);
+  instr_t added = prog->code[prog->size - 1];
+  memmove(&prog->code[idx + 1], &prog->code[idx], (prog->size - 1 - idx) * sizeof(instr_t));
+  prog->code[idx] = added;
+
+  for (unsigned int i = idx + 1; i < prog->size; i++) {
+    opcode_t moved = prog->code[i].op;
+    if (moved == OP_JUMP || moved == OP_JUMP_FALSE || moved == OP_FOR_NEXT) {
+      prog->code[i].target++;
+    }
+  }
+  return idx;
+}
+
+// Compiles a statement without any keywords
+// Returns -1 when it is prev and there is no statement before it
+int compileSimple(compiler_t *c, vect_t *stmt) {
+  if (vect_size(stmt) == 0) {
+    return 0;
+  }
+
+  // prev runs the statement before it again
+  if (vect_size(stmt) == 1 && strcmp(vect_get(stmt, 0), "prev") == 0) {
+    if (c->prev == NULL) {
+      return -1;
+    }
+    stmt = c->prev;
+  }
+  else {
+    c->prev = copy_vect(c->prev, stmt);
+  }
+
+  cmd_t *cmd = parseCommand(stmt);
+  if (cmd->type != CMD_SIMPLE || cmd->redirs != NULL || vect_size(cmd->words) == 0) {
+    int idx = emit(c, OP_SPAWN);
+    c->prog->code[idx].cmd = cmd;
+    return 0;
+  }
+
+  // Plain commands that the shell runs itself get their own instructions
+  // so the machine doesn't have to look at the tree
+  vect_t *words = cmd->words;
+  const char *first = vect_get(words, 0);
+  opcode_t op = OP_SPAWN;
+  if (strcmp(first, "test") == 0 || strcmp(first, "[") == 0) {
+    op = OP_TEST;
+  }
+  else if (vect_size(words) == 1 && isAssignment(first)) {
+    op = OP_ASSIGN;
+  }
+  else if (isBuiltIn(words)) {
+    op = OP_BUILTIN;
+  }
+
+  int idx = emit(c, op);
+  if (op == OP_SPAWN) {
+    c->prog->code[idx].cmd = cmd;
+  }
+  else {
+    c->prog->code[idx].words = words;
+    cmd->words = NULL;
+    cmd_delete(cmd);
+  }
+  return 0;
+}
+
+// Compiles the redirections after the fi or done of the compound command
+// that starts at instruction start, so they apply around all of it
+void compileRedirects(compiler_t *c, int start) {
+  if (c->error) {
+    return;
+  }
+
+  // They go up to the end of the statement, or a keyword of an outer one
+  vect_t *words = vect_new();
+  const char *next;
+  while ((next = peek(c)) != NULL && strcmp(next, ";") != 0 && !isOneOf(next, RESERVED)) {
+    vect_add(words, next);
+    c->pos++;
+  }
+  if (vect_size(words) == 0) {
+    vect_delete(words);
+    return;
+  }
+
+  // Anything but redirections, like a pipe or more words, isn't supported
+  const char *first = vect_get(c->tokens, c->pos - vect_size(words));
+  cmd_t *cmd = parseCommand(words);
+  vect_delete(words);
+  if (cmd->type != CMD_SIMPLE || vect_size(cmd->words) != 0) {
+    syntaxError(c, first);
+    cmd_delete(cmd);
+    return;
+  }
+
+  int slot = c->prog->redirectSlots++;
+  int apply = insertAt(c, start, OP_REDIRECT);
+  c->prog->code[apply].cmd = cmd;
+  c->prog->code[apply].slot = slot;
+  int restore = emit(c, OP_RESTORE);
+  c->prog->code[restore].slot = slot;
+  patch(c, apply);
+}
+
+// Compiles the rest of an if or elif, after the keyword
+void compileIf(compiler_t *c) {
+  compileList(c, THEN);
+  if (!expect(c, "then")) {
+    return;
+  }
+
+  // Skip this branch when the condition fails
+  int skip = emit(c, OP_JUMP_FALSE);
+  compileList(c, IF_BRANCH);
+  if (c->error) {
+    return;
+  }
+
+  const char *next = peek(c);
+  if (strcmp(next, "elif") == 0) {
+    c->pos++;
+    int end = emit(c, OP_JUMP);
+    patch(c, skip);
+    compileIf(c);
+    patch(c, end);
+  }
+  else if (strcmp(next, "else") == 0) {
+    c->pos++;
+    int end = emit(c, OP_JUMP);
+    patch(c, skip);
+    compileList(c, FI);
+    expect(c, "fi");
+    patch(c, end);
+  }
+  else {
+    patch(c, skip);
+    expect(c, "fi");
+  }
+}
+
+// Compiles a while loop, after the keyword
+void compileWhile(compiler_t *c) {
+  int top = c->prog->size;
+  compileList(c, DO);
+  if (!expect(c, "do")) {
+    return;
+  }
+
+  int done = emit(c, OP_JUMP_FALSE);
+  compileList(c, DONE);
+  if (!expect(c, "done")) {
+    return;
+  }
+
+  int loop = emit(c, OP_JUMP);
+  c->prog->code[loop].target = top;
+  patch(c, done);
+}
+
+// Compiles a for loop, after the keyword
+void compileFor(compiler_t *c) {
+  const char *name = peek(c);
+  if (name == NULL || !isVarName(name, strlen(name))) {
+    syntaxError(c, name);
+    return;
+  }
+  c->pos++;
+
+  // The words after in, up to the end of the statement
+  vect_t *words = vect_new();
+  const char *next = peek(c);
+  if (next != NULL && strcmp(next, "in") == 0) {
+    c->pos++;
+    while ((next = peek(c)) != NULL && strcmp(next, ";") != 0 && strcmp(next, "do") != 0) {
+      vect_add(words, next);
+      c->pos++;
+    }
+  }
+
+  int slot = c->prog->slots++;
+  int init = emit(c, OP_FOR_INIT);
+  c->prog->code[init].slot = slot;
+  c->prog->code[init].words = words;
+
+  int top = emit(c, OP_FOR_NEXT);
+  c->prog->code[top].slot = slot;
+  c->prog->code[top].name = strdup(name);
+
+  while ((next = peek(c)) != NULL && strcmp(next, ";") == 0) {
+    c->pos++;
+  }
+  if (!expect(c, "do")) {
+    return;
+  }
+  compileList(c, DONE);
+  if (!expect(c, "done")) {
+    return;
+  }
+
+  int loop = emit(c, OP_JUMP);
+  c->prog->code[loop].target = top;
+  patch(c, top);
+}
+
+// Compiles statements until one of the terminating words, or the end of
+// the tokens when there are none
+void compileList(compiler_t *c, const char **terms) {
+  while (!c->error) {
+    const char *next = peek(c);
+    if (next == NULL) {
+      if (terms != NULL) {
+	syntaxError(c, NULL);
+      }
+      return;
+    }
+
+    if (strcmp(next, ";") == 0) {
+      c->pos++;
+      continue;
+    }
+    if (terms != NULL && isOneOf(next, terms)) {
+      return;
+    }
+
+    compileStatement(c);
+  }
+}
+
+// Compiles one statement
+void compileStatement(compiler_t *c) {
+  const char *next = peek(c);
+  int start = c->prog->size;
+
+  if (strcmp(next, "if") == 0) {
+    c->pos++;
+    compileIf(c);
+    compileRedirects(c, start);
+    return;
+  }
+  if (strcmp(next, "while") == 0) {
+    c->pos++;
+    compileWhile(c);
+    compileRedirects(c, start);
+    return;
+  }
+  if (strcmp(next, "for") == 0) {
+    c->pos++;
+    compileFor(c);
+    compileRedirects(c, start);
+    return;
+  }
+  if (isOneOf(next, RESERVED)) {
+    syntaxError(c, next);
+    return;
+  }
+
+  // A plain statement goes up to the next ;
+  vect_t *stmt = vect_new();
+  while ((next = peek(c)) != NULL && strcmp(next, ";") != 0) {
+    vect_add(stmt, next);
+    c->pos++;
+  }
+  if (compileSimple(c, stmt) == -1 && c->report) {
+    char prevError[] = "There is no previous command\n";
+    assert(write(1, prevError, strlen(prevError)) == strlen(prevError));
+  }
+  vect_delete(stmt);
+}
+
+// Compiles the tokens, printing errors only when report is set
+program_t *compile(vect_t *tokens, int *incomplete, int report) {
+  program_t *prog = malloc(sizeof(program_t));
+  prog->size = 0;
+  prog->capacity = PROGRAM_INITIAL_CAPACITY;
+  prog->code = malloc(prog->capacity * sizeof(instr_t));
+  prog->slots = 0;
+  prog->redirectSlots = 0;
+
+  compiler_t c = { tokens, 0, prog, 0, 0, report, NULL };
+  compileList(&c, NULL);
+
+  if (c.prev != NULL) {
+    vect_delete(c.prev);
+  }
+
+  *incomplete = c.incomplete;
+  if (c.error) {
+    program_delete(prog);
+    return NULL;
+  }
+  return prog;
+}
+
+program_t *compileScript(vect_t *tokens, int *incomplete) {
+  return compile(tokens, incomplete, 1);
+}
+
+int runProgram(program_t *prog, int tail) {
+  // Each for loop keeps its expanded words and how far it has got
+  vect_t **lists = calloc(prog->slots + 1, sizeof(vect_t *));
+  unsigned int *positions = calloc(prog->slots + 1, sizeof(unsigned int));
+  fd_backup_t *backups = calloc(prog->redirectSlots + 1, sizeof(fd_backup_t));
+
+  unsigned int pc = 0;
+  while (pc < prog->size && status == 0) {
+    instr_t *instr = &prog->code[pc];
+
+    switch (instr->op) {
+      case OP_SPAWN:
+	// Nothing follows the last instruction, it can only fall off the end
+	execTree(instr->cmd, tail && pc == prog->size - 1);
+	pc++;
+	break;
+
+      case OP_BUILTIN:
+      case OP_TEST:
+      case OP_ASSIGN: {
+	// An assignment or a word that expands to nothing has the status
+	// of its last command substitution, like x=$(false)
+	int substStatus = 0;
+	vect_t *words = expandTokens(instr->words, &substStatus);
+	if (words == NULL) {
+	  last_status = 1;
+	  pc++;
+	  break;
+	}
+	if (vect_size(words) == 0) {
+	  last_status = substStatus;
+	}
+	else if (instr->op == OP_TEST) {
+	  countStat(STAT_BUILTINS, 1);
+	  last_status = testCmd(words);
+	}
+	else if (instr->op == OP_ASSIGN) {
+	  assignVar(vect_get(words, 0));
+	  last_status = substStatus;
+	}
+	else {
+	  last_status = processBuiltIn(words);
+	}
+	vect_delete(words);
+	pc++;
+	break;
+      }
+
+      case OP_JUMP:
+	pc = instr->target;
+	break;
+
+      case OP_JUMP_FALSE:
+	pc = last_status != 0 ? instr->target : pc + 1;
+	break;
+
+      case OP_FOR_INIT:
+	if (lists[instr->slot] != NULL) {
+	  vect_delete(lists[instr->slot]);
+	}
+	// A list that failed to expand runs the loop no times
+	lists[instr->slot] = expandTokens(instr->words, NULL);
+	if (lists[instr->slot] == NULL) {
+	  lists[instr->slot] = vect_new();
+	  last_status = 1;
+	}
+	positions[instr->slot] = 0;
+	pc++;
+	break;
+
+      case OP_FOR_NEXT: {
+	vect_t *list = lists[instr->slot];
+	if (positions[instr->slot] < vect_size(list)) {
+	  setVar(instr->name, vect_get(list, positions[instr->slot]));
+	  positions[instr->slot]++;
+	  pc++;
+	}
+	else {
+	  pc = instr->target;
+	}
+	break;
+      }
+
+      case OP_REDIRECT:
+	// A redirection that fails skips the command like it would a simple one
+	if (applyRedirects(instr->cmd, &backups[instr->slot]) == -1) {
+	  restoreRedirects(&backups[instr->slot]);
+	  last_status = 1;
+	  pc = instr->target;
+	}
+	else {
+	  pc++;
+	}
+	break;
+
+      case OP_RESTORE:
+	restoreRedirects(&backups[instr->slot]);
+	pc++;
+	break;
+    }
+  }
+
+  for (int i = 0; i < prog->slots; i++) {
+    if (lists[i] != NULL) {
+      vect_delete(lists[i]);
+    }
+  }
+  free(lists);
+  free(positions);
+  free(backups);
+  return last_status;
+}
+
+void program_delete(program_t *prog) {
+  for (unsigned int i = 0; i < prog->size; i++) {
+    instr_t *instr = &prog->code[i];
+    if (instr->words != NULL) {
+      vect_delete(instr->words);
+    }
+    if (instr->cmd != NULL) {
+      cmd_delete(instr->cmd);
+    }
+    free(instr->name);
+  }
+  free(prog->code);
+  free(prog);
+}
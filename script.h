@@ -0,0 +1,68 @@
+#ifndef _SCRIPT_H
+#define _SCRIPT_H
+
+#include "vect.h"
+#include "parse.h"
+
+/** Instructions of the script virtual machine. */
+typedef enum {
+  OP_SPAWN,        /* Run the command tree. */
+  OP_BUILTIN,      /* Call the built in named by the first word. */
+  OP_TEST,         /* Evaluate test or [ without leaving the shell. */
+  OP_ASSIGN,       /* Set a variable from a NAME=value word. */
+  OP_JUMP,         /* Jump to target. */
+  OP_JUMP_FALSE,   /* Jump to target when $? is not 0. */
+  OP_FOR_INIT,     /* Expand the word list of a for loop into its slot. */
+  OP_FOR_NEXT,     /* Set the loop variable to the next word, or jump to target when done. */
+  OP_REDIRECT,     /* Apply the redirections of cmd into its slot, or jump to target when they fail. */
+  OP_RESTORE       /* Put back the fds the redirections in the slot replaced. */
+} opcode_t;
+
+/** A single instruction. Only the fields its opcode uses are set. */
+typedef struct instr {
+  opcode_t op;
+  int target;        /* Jump target. */
+  int slot;          /* Loop slot of a for loop, or redirection slot. */
+  char *name;        /* Loop variable of OP_FOR_NEXT. */
+  vect_t *words;     /* Words of a built in, test, assignment or for list. */
+  cmd_t *cmd;        /* Command tree of OP_SPAWN, redirections of OP_REDIRECT. */
+} instr_t;
+
+/** A compiled script. */
+typedef struct program {
+  instr_t *code;
+  unsigned int size;
+  unsigned int capacity;
+  int slots;         /* Number of for loops, each gets its own slot. */
+  int redirectSlots; /* Number of redirected if, while and for commands. */
+} program_t;
+
+/* Program configuration. */
+#define PROGRAM_INITIAL_CAPACITY 16
+#define PROGRAM_GROWTH_FACTOR 2
+
+/** Checks if the word starts an if, while or for. */
+int isScriptKeyword(const char *word);
+
+/** Checks if any statement in the tokens starts with an if, while or for. */
+int startsScript(vect_t *tokens);
+
+/** Checks if the tokens are a script that ends before every if, while and
+ *  for is finished, so more lines are needed. */
+int isIncompleteScript(vect_t *tokens);
+
+/** Compiles the tokens of a script into a program. Lines of the script are
+ *  separated by ; tokens. Redirections after fi or done apply to the whole
+ *  if, while or for. Returns NULL on a syntax error, and also sets
+ *  incomplete when the script just ended too early (like an if without fi). */
+program_t *compileScript(vect_t *tokens, int *incomplete);
+
+/** Runs the program and returns the exit status of the last command.
+ *  When tail is set nothing runs after the program, so a command that is
+ *  the last instruction replaces the process instead of being forked. */
+int runProgram(program_t *prog, int tail);
+
+/** Delete the program, freeing all memory it occupies. */
+void program_delete(program_t *prog);
+
+#endif /* ifndef _SCRIPT_H */
@@ -0,0 +1,534 @@
+/**
+ * Server mode: ./shell --server /path.sock
+ *
+ * The shell stays running and takes requests from any number of local
+ * clients. Each request runs in a forked copy of the shell with the normal
+ * executor, and its stdout and stderr come back through pipes that are
+ * watched with epoll along with every client socket. A pidfd of the copy
+ * is watched too, so it is reaped without blocking the other clients.
+ */
+#define _GNU_SOURCE
+#include <assert.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+#include <sys/syscall.h>
+
+#include "vect.h"
+#include "token.h"
+#include "shell.h"
+#include "server.h"
+#include "heredoc.h"
+#include "cache.h"
+#include "stats.h"
+#include "readbuf.h"
+
+/** Output waiting for a slow client past which the server stops reading
+ *  the command's output until the client catches up. */
+#define SERVER_MAX_PENDING (4 * 1024 * 1024)
+
+// What a file descriptor in the epoll set is
+enum endpoint_kind {
+  EP_LISTEN,
+  EP_CLIENT,
+  EP_STDOUT,
+  EP_STDERR,
+  EP_EXIT
+};
+
+typedef struct conn conn_t;
+
+/** A file descriptor in the epoll set and the connection it belongs to. */
+typedef struct endpoint {
+  enum endpoint_kind kind;
+  int fd;
+  conn_t *conn;
+} endpoint_t;
+
+/** A client connection and the request it is running. */
+struct conn {
+  endpoint_t client;
+  endpoint_t out;          /* stdout of the running command, fd is -1 when closed. */
+  endpoint_t err;          /* stderr of the running command, fd is -1 when closed. */
+  endpoint_t exit;         /* pidfd of the running command, fd is -1 once it is reaped. */
+  char *in;                /* Bytes from the client that aren't handled yet. */
+  size_t inLen;
+  size_t inCap;
+  char *pending;           /* Bytes waiting to be sent to the client. */
+  size_t pendingLen;
+  size_t pendingPos;
+  size_t pendingCap;
+  char *cwd;               /* Directory for the next command, NULL to stay put. */
+  vect_t *env;             /* NAME=value overrides for the next command. */
+  pid_t pid;               /* The running command, 0 when there is none. */
+  int reaped;              /* Set once the running command has been waited for. */
+  int wstatus;             /* Its wait status once reaped. */
+  int watchingOut;         /* Waiting for the client socket to take more data. */
+  int paused;              /* Stopped reading command output until the client catches up. */
+  int closed;              /* The client hung up. */
+  int dead;                /* Freed at the end of this round of events. */
+  conn_t *nextDead;
+};
+
+static int epfd = -1;
+static conn_t *deadList = NULL;
+
+// Registers the endpoint with epoll for the given events
+void watch(endpoint_t *ep, int op, uint32_t events) {
+  struct epoll_event ev;
+  memset(&ev, 0, sizeof(ev));
+  ev.events = events;
+  ev.data.ptr = ep;
+  if (epoll_ctl(epfd, op, ep->fd, &ev) == -1 && op != EPOLL_CTL_DEL) {
+    perror("epoll_ctl");
+  }
+}
+
+// Makes sure the buffer can hold need more bytes after len
+char *reserve(char *buffer, size_t len, size_t *cap, size_t need) {
+  while (len + need > *cap) {
+    *cap = *cap == 0 ? SERVER_READ_SIZE : *cap * 2;
+    buffer = realloc(buffer, *cap);
+  }
+  return buffer;
+}
+
+// Closes one of the output pipes or the pidfd of the running command
+void closePipe(endpoint_t *ep) {
+  if (ep->fd == -1) {
+    return;
+  }
+  watch(ep, EPOLL_CTL_DEL, 0);
+  close(ep->fd);
+  ep->fd = -1;
+}
+
+// Frees the connection once nothing can refer to it anymore
+void markDead(conn_t *conn) {
+  if (conn->dead) {
+    return;
+  }
+  conn->dead = 1;
+
+  if (conn->client.fd != -1) {
+    watch(&conn->client, EPOLL_CTL_DEL, 0);
+    close(conn->client.fd);
+    conn->client.fd = -1;
+  }
+  conn->nextDead = deadList;
+  deadList = conn;
+}
+
+// Frees every connection that died during this round of events
+void freeDead() {
+  while (deadList != NULL) {
+    conn_t *conn = deadList;
+    deadList = conn->nextDead;
+
+    free(conn->in);
+    free(conn->pending);
+    free(conn->cwd);
+    vect_delete(conn->env);
+    free(conn);
+  }
+}
+
+// Stops or restarts reading the command's output
+void pauseOutput(conn_t *conn, int pause) {
+  if (conn->paused == pause) {
+    return;
+  }
+  conn->paused = pause;
+
+  // The pipes are taken out of the set rather than given no events,
+  // since epoll would keep reporting a hang up on them anyway
+  int op = pause ? EPOLL_CTL_DEL : EPOLL_CTL_ADD;
+  if (conn->out.fd != -1) {
+    watch(&conn->out, op, EPOLLIN);
+  }
+  if (conn->err.fd != -1) {
+    watch(&conn->err, op, EPOLLIN);
+  }
+}
+
+// Sends as much of the pending output to the client as it will take
+void flushClient(conn_t *conn) {
+  while (conn->pendingPos < conn->pendingLen && !conn->closed) {
+    ssize_t n = send(conn->client.fd, conn->pending + conn->pendingPos,
+		     conn->pendingLen - conn->pendingPos, MSG_NOSIGNAL | MSG_DONTWAIT);
+    if (n == -1) {
+      if (errno == EINTR) {
+	continue;
+      }
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+	break;
+      }
+
+      // The client is gone, so its command doesn't need to keep running
+      conn->closed = 1;
+      if (conn->pid != 0) {
+	kill(conn->pid, SIGTERM);
+      }
+      else {
+	markDead(conn);
+      }
+      return;
+    }
+    conn->pendingPos += n;
+  }
+
+  if (conn->pendingPos == conn->pendingLen || conn->closed) {
+    conn->pendingLen = 0;
+    conn->pendingPos = 0;
+  }
+
+  // Only ask epoll about the socket being writable while there is a backlog
+  int backlog = conn->pendingLen > 0;
+  if (backlog != conn->watchingOut && !conn->closed) {
+    conn->watchingOut = backlog;
+    watch(&conn->client, EPOLL_CTL_MOD, EPOLLIN | (backlog ? EPOLLOUT : 0));
+  }
+  pauseOutput(conn, conn->pendingLen - conn->pendingPos > SERVER_MAX_PENDING);
+}
+
+// Queues a frame for the client and tries to send it right away
+void sendFrame(conn_t *conn, char type, const char *payload, uint32_t len) {
+  if (conn->closed) {
+    return;
+  }
+
+  conn->pending = reserve(conn->pending, conn->pendingLen, &conn->pendingCap,
+			  FRAME_HEADER_SIZE + len);
+  conn->pending[conn->pendingLen] = type;
+  memcpy(conn->pending + conn->pendingLen + 1, &len, sizeof(len));
+  memcpy(conn->pending + conn->pendingLen + FRAME_HEADER_SIZE, payload, len);
+  conn->pendingLen += FRAME_HEADER_SIZE + len;
+
+  flushClient(conn);
+}
+
+// Runs the command line in a forked copy of the shell
+// The parent keeps the read ends of the output pipes
+void startRequest(conn_t *conn, const char *line, uint32_t len) {
+  int out[2];
+  int err[2];
+  if (pipe2(out, O_CLOEXEC) == -1 || pipe2(err, O_CLOEXEC) == -1) {
+    perror("Error creating pipe");
+    int result = 1;
+    sendFrame(conn, FRAME_EXIT, (const char *) &result, sizeof(result));
+    return;
+  }
+
+  // The line ends in a newline like it would when typed
+  char *input = (char *) malloc(len + 2);
+  memcpy(input, line, len);
+  input[len] = '\n';
+  input[len + 1] = '\0';
+
+  // Parsing in the server keeps the line in its cache for the next request
+  // A line with a syntax error is parsed again in the child so the client
+  // gets the error
+  int incomplete = 0;
+  parsed_line_t *parsed = parseText(input, PARSE_LINE, &incomplete);
+
+  int pid = countedFork();
+  if (pid == 0) {
+    int devnull = open("/dev/null", O_RDONLY);
+    readAheadMoved(STDIN_FILENO);
+    dup2(devnull, STDIN_FILENO);
+    dup2(out[1], STDOUT_FILENO);
+    dup2(err[1], STDERR_FILENO);
+    close(devnull);
+
+    if (conn->cwd != NULL && chdir(conn->cwd) != 0) {
+      perror("cd");
+      _exit(1);
+    }
+    for (int i = 0; i < vect_size(conn->env); i++) {
+      putenv(vect_get_copy(conn->env, i));
+    }
+
+    if (parsed != NULL) {
+      _exit(runParsed(parsed, 1));
+    }
+    line_source_t lines = { -1, input, NULL };
+    vect_t *tokens = readScript(&lines);
+    int result = runCommand(tokens, 1);
+    _exit(result);
+  }
+  releaseLine(parsed);
+  free(input);
+  close(out[1]);
+  close(err[1]);
+
+  if (pid < 0) {
+    perror("Error - fork failed");
+    close(out[0]);
+    close(err[0]);
+    int result = 1;
+    sendFrame(conn, FRAME_EXIT, (const char *) &result, sizeof(result));
+    return;
+  }
+
+  conn->pid = pid;
+  conn->reaped = 0;
+  conn->paused = 0;
+  conn->out.fd = out[0];
+  conn->err.fd = err[0];
+  fcntl(out[0], F_SETFL, O_NONBLOCK);
+  fcntl(err[0], F_SETFL, O_NONBLOCK);
+  watch(&conn->out, EPOLL_CTL_ADD, EPOLLIN);
+  watch(&conn->err, EPOLL_CTL_ADD, EPOLLIN);
+
+  // The pidfd becomes readable once the command exits. Without pidfds the
+  // command is waited for when its outputs close, which can block
+  conn->exit.fd = syscall(SYS_pidfd_open, pid, 0);
+  if (conn->exit.fd != -1) {
+    watch(&conn->exit, EPOLL_CTL_ADD, EPOLLIN);
+  }
+
+  // The overrides only apply to this request
+  free(conn->cwd);
+  conn->cwd = NULL;
+  vect_delete(conn->env);
+  conn->env = vect_new();
+}
+
+// Handles every complete frame from the client, stopping when a command starts
+void handleFrames(conn_t *conn) {
+  size_t pos = 0;
+
+  while (conn->pid == 0 && !conn->dead && conn->inLen - pos >= FRAME_HEADER_SIZE) {
+    char type = conn->in[pos];
+    uint32_t len;
+    memcpy(&len, conn->in + pos + 1, sizeof(len));
+
+    if (len > FRAME_MAX_PAYLOAD) {
+      fprintf(stderr, "server: frame too large, dropping client\n");
+      markDead(conn);
+      return;
+    }
+    if (conn->inLen - pos < FRAME_HEADER_SIZE + len) {
+      break;
+    }
+
+    const char *payload = conn->in + pos + FRAME_HEADER_SIZE;
+    if (type == FRAME_CWD) {
+      free(conn->cwd);
+      conn->cwd = strndup(payload, len);
+    }
+    else if (type == FRAME_ENV) {
+      char *pair = strndup(payload, len);
+      if (strchr(pair, '=') != NULL) {
+	vect_add(conn->env, pair);
+      }
+      free(pair);
+    }
+    else if (type == FRAME_LINE) {
+      startRequest(conn, payload, len);
+    }
+    pos += FRAME_HEADER_SIZE + len;
+  }
+
+  // Keep whatever is left for later
+  memmove(conn->in, conn->in + pos, conn->inLen - pos);
+  conn->inLen -= pos;
+}
+
+// Reads everything the client has sent
+void readClient(conn_t *conn) {
+  while (1) {
+    conn->in = reserve(conn->in, conn->inLen, &conn->inCap, SERVER_READ_SIZE);
+    ssize_t n = read(conn->client.fd, conn->in + conn->inLen, SERVER_READ_SIZE);
+    if (n > 0) {
+      conn->inLen += n;
+      continue;
+    }
+    if (n == -1 && errno == EINTR) {
+      continue;
+    }
+    if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      break;
+    }
+
+    // The client hung up, stop its command if there is one
+    conn->closed = 1;
+    if (conn->pid != 0) {
+      kill(conn->pid, SIGTERM);
+      watch(&conn->client, EPOLL_CTL_DEL, 0);
+    }
+    else {
+      markDead(conn);
+    }
+    return;
+  }
+
+  handleFrames(conn);
+}
+
+// Sends the exit status once the command has closed both outputs and
+// has been reaped
+void finishRequest(conn_t *conn) {
+  if (!conn->reaped) {
+    countedWaitpid(conn->pid, &conn->wstatus, 0);
+  }
+  conn->pid = 0;
+
+  int result = exitStatus(conn->wstatus);
+  sendFrame(conn, FRAME_EXIT, (const char *) &result, sizeof(result));
+
+  if (conn->closed) {
+    markDead(conn);
+    return;
+  }
+
+  // The client may have sent its next request already
+  handleFrames(conn);
+}
+
+// Forwards what the command wrote on stdout or stderr
+void readOutput(endpoint_t *ep) {
+  conn_t *conn = ep->conn;
+  char buffer[SERVER_READ_SIZE];
+  char type = ep->kind == EP_STDOUT ? FRAME_STDOUT : FRAME_STDERR;
+
+  while (!conn->paused) {
+    ssize_t n = read(ep->fd, buffer, sizeof(buffer));
+    if (n > 0) {
+      sendFrame(conn, type, buffer, n);
+      continue;
+    }
+    if (n == -1 && errno == EINTR) {
+      continue;
+    }
+    if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      return;
+    }
+
+    closePipe(ep);
+    if (conn->out.fd == -1 && conn->err.fd == -1 && (conn->reaped || conn->exit.fd == -1)) {
+      finishRequest(conn);
+    }
+    return;
+  }
+}
+
+// Reaps the command once its pidfd says it exited, which can be before or
+// after its outputs close, since it may have passed them on or closed them
+void reapCommand(conn_t *conn) {
+  if (countedWaitpid(conn->pid, &conn->wstatus, WNOHANG) != conn->pid) {
+    return;
+  }
+  conn->reaped = 1;
+  closePipe(&conn->exit);
+  if (conn->out.fd == -1 && conn->err.fd == -1) {
+    finishRequest(conn);
+  }
+}
+
+// Accepts every waiting client
+void acceptClients(int listenFd) {
+  while (1) {
+    int fd = accept4(listenFd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd == -1) {
+      if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+	perror("accept");
+      }
+      return;
+    }
+
+    conn_t *conn = calloc(1, sizeof(conn_t));
+    conn->client = (endpoint_t) { EP_CLIENT, fd, conn };
+    conn->out = (endpoint_t) { EP_STDOUT, -1, conn };
+    conn->err = (endpoint_t) { EP_STDERR, -1, conn };
+    conn->exit = (endpoint_t) { EP_EXIT, -1, conn };
+    conn->env = vect_new();
+    watch(&conn->client, EPOLL_CTL_ADD, EPOLLIN);
+  }
+}
+
+int runServer(const char *path) {
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    fprintf(stderr, "server: socket path too long\n");
+    return 1;
+  }
+  strcpy(addr.sun_path, path);
+
+  int listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (listenFd == -1) {
+    perror("socket");
+    return 1;
+  }
+
+  // A socket left over from an earlier server would make bind fail
+  unlink(path);
+  if (bind(listenFd, (struct sockaddr *) &addr, sizeof(addr)) == -1
+      || listen(listenFd, SERVER_BACKLOG) == -1) {
+    perror("server");
+    close(listenFd);
+    return 1;
+  }
+
+  epfd = epoll_create1(EPOLL_CLOEXEC);
+  endpoint_t listener = { EP_LISTEN, listenFd, NULL };
+  watch(&listener, EPOLL_CTL_ADD, EPOLLIN);
+
+  struct epoll_event events[SERVER_MAX_EVENTS];
+  while (1) {
+    int n = epoll_wait(epfd, events, SERVER_MAX_EVENTS, -1);
+    if (n == -1) {
+      if (errno == EINTR) {
+	continue;
+      }
+      perror("epoll_wait");
+      break;
+    }
+
+    for (int i = 0; i < n; i++) {
+      endpoint_t *ep = events[i].data.ptr;
+      if (ep->kind == EP_LISTEN) {
+	acceptClients(ep->fd);
+	continue;
+      }
+
+      // Skip events for connections that went away earlier in this round
+      if (ep->conn->dead || ep->fd == -1) {
+	continue;
+      }
+
+      if (ep->kind == EP_CLIENT) {
+	if (events[i].events & EPOLLOUT) {
+	  flushClient(ep->conn);
+	}
+	if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+	  readClient(ep->conn);
+	}
+      }
+      else if (ep->kind == EP_EXIT) {
+	reapCommand(ep->conn);
+      }
+      else {
+	readOutput(ep);
+      }
+    }
+
+    freeDead();
+  }
+
+  close(epfd);
+  close(listenFd);
+  unlink(path);
+  return 1;
+}
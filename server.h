@@ -0,0 +1,44 @@
+#ifndef _SERVER_H
+#define _SERVER_H
+
+#include <stdint.h>
+
+/**
+ * Protocol between ./shell --server and its clients.
+ *
+ * Everything sent either way is a frame: a one byte type, the payload
+ * length as a 32 bit integer in host byte order, then the payload.
+ *
+ * A request is any number of FRAME_CWD and FRAME_ENV frames followed by a
+ * FRAME_LINE frame, which starts the command. The server answers with
+ * FRAME_STDOUT and FRAME_STDERR frames as the command writes, then a
+ * FRAME_EXIT frame holding the exit status as a 32 bit integer. A client
+ * can send its next request on the same connection once it has the exit.
+ */
+#define FRAME_CWD    'C'   /* Directory to run the command in. */
+#define FRAME_ENV    'E'   /* NAME=value to set for the command. */
+#define FRAME_LINE   'L'   /* The command line, starts the request. */
+#define FRAME_STDOUT 'O'   /* Output the command wrote to stdout. */
+#define FRAME_STDERR 'R'   /* Output the command wrote to stderr. */
+#define FRAME_EXIT   'X'   /* Exit status of the command. */
+
+/** Size of the type and length in front of every frame. */
+#define FRAME_HEADER_SIZE (1 + sizeof(uint32_t))
+
+/** Largest payload the server accepts in a frame. */
+#define FRAME_MAX_PAYLOAD (1024 * 1024)
+
+/** Connections the listening socket queues up before accepting. */
+#define SERVER_BACKLOG 128
+
+/** Most epoll events handled per wakeup. */
+#define SERVER_MAX_EVENTS 64
+
+/** Size of the reads from sockets and command output. */
+#define SERVER_READ_SIZE (64 * 1024)
+
+/** Runs the shell as a server on the Unix domain socket at path until it
+ *  is killed. Returns the exit status for the shell if it can't start. */
+int runServer(const char *path);
+
+#endif /* ifndef _SERVER_H */
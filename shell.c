@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <assert.h>
 #include <string.h>
 #include <stdio.h>
@@ -5,21 +6,53 @@
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <sys/stat.h>
 #include <fcntl.h>
 #include "vect.h"
 #include "token.h"
+#include "shell.h"
+#include "expand.h"
+#include "fastcopy.h"
+#include "parse.h"
+#include "script.h"
+#include "vars.h"
+#include "arith.h"
+#include "server.h"
+#include "xargs.h"
+#include "redirect.h"
+#include "heredoc.h"
+#include "cache.h"
+#include "stats.h"
+#include "bench.h"
+#include "jobs.h"
+#include "readbuf.h"
+#include "readcmd.h"
+#include "snapshot.h"
+#include "rlimit.h"
+#include "spawner.h"
+
+extern char **environ;
 
-const size_t buffer_limit = 512;
 int status;
-void runCommand(vect_t *tokens);
-void cd(vect_t *tokens);
-void helpCmd(vect_t *tokens);
-void source(vect_t *tokens);
+int last_status;
 
-void pipeFunc(vect_t **tokenList);
-void outputRedirect(vect_t **tokenList);
-void inputRedirect(vect_t **tokenList);
-void sequence(vect_t **tokenList);
+// Set once the shell reads its commands at the prompt
+static int interactive = 0;
+
+int tryExecProgram(vect_t *tokens);
+int runSimpleCommand(vect_t *tokens, cmd_t *cmd, int tail);
+int runInShell(vect_t *tokens);
+int cd(vect_t *tokens);
+int helpCmd(vect_t *tokens);
+int source(vect_t *tokens);
+int execCmd(vect_t *tokens);
+int runString(const char *line);
+parsed_line_t *readCommand(char **buffer, parsed_line_t **prev);
+int runScriptFile(const char *path, int tail);
+
+int pipeFunc(cmd_t *cmd, int tail);
+int sequence(cmd_t *cmd, int tail);
+int conditional(cmd_t *cmd, int tail);
 
 
 
@@ -28,93 +61,248 @@ int main(int argc, char **argv) {
   char welcome[] = "Welcome to mini-shell.\n";
   char startMsg[] = "shell $ ";
 
+  // Children share the counters so shellstat sees what they do too
+  initStats();
+
+  // Server mode runs until it is killed and never shows a prompt
+  if (argc == 3 && strcmp(argv[1], "--server") == 0) {
+    return runServer(argv[2]);
+  }
+
+  // The spawn helper is forked while the shell is small, before a script,
+  // the rc file or the history make it grow
+  startSpawnHelper();
+
+  // -c runs one line and a file name runs the file as a script
+  // Neither has a prompt, and the last command replaces the shell
+  if (argc == 3 && strcmp(argv[1], "-c") == 0) {
+    return runString(argv[2]);
+  }
+  if (argc == 2) {
+    return runScriptFile(argv[1], 1);
+  }
+
   status = 0;
-  vect_t *prev_cmd = NULL;
+  interactive = 1;
+  parsed_line_t *prev_line = NULL;
   assert(write(1, welcome, strlen(welcome)) == strlen(welcome));
 
-  buffer = (char *) malloc(buffer_limit * sizeof(char));
+  // ~/.minishellrc runs before the first prompt, mapped from its snapshot
+  // when it hasn't changed
+  runRcFile();
+
+  // Commands are read through the read-ahead buffer of fd 0, so the read
+  // built in and the commands the shell starts see the input right after
+  // the line that ran them
+  line_source_t input = { STDIN_FILENO, NULL, NULL };
+  buffer = NULL;
 
   // While there is no exit or ctrl-d, run the shell
   while(status == 0) {
 
     assert(write(1, startMsg, strlen(startMsg)) == strlen(startMsg));
 
-    size_t length = getline(&buffer, &buffer_limit, stdin);
-
-    if (length == -1) {
+    char *next = readLine(&input);
+    if (next == NULL) {
       break;
     }
+    free(buffer);
+    buffer = next;
 
-    // Make sure the stdin is more than 1 character and less than 512 bytes
-    if(strlen(buffer) >= buffer_limit) {
-      char *tooManyChar = "Please enter less than 512 characters\n";
-      assert(write(1, tooManyChar, strlen(tooManyChar)) == strlen(tooManyChar));
-      continue;
-    }
-
-    // For reading in files this might be different 
-    vect_t *tokens = parseInput(buffer);
-
-    // If there are no arguments, continue to the next iteration
-    if (vect_size(tokens) <= 0) {
-      vect_delete(tokens);
-      continue;
-    }
-
-    // Check if the command is prev
-    if(strcmp(vect_get(tokens, 0), "prev") == 0){
-      // Check if its the first iteration so there is no prev
-      if(prev_cmd == NULL) {
-	char prevError[] = "There is no previous command\n";
-	assert(write(1, prevError, strlen(prevError)) == strlen(prevError));
+    // A line that ran before skips the tokenizer and the parser
+    parsed_line_t *line = cacheLookup(buffer, PARSE_LINE);
+    if (line == NULL) {
+      line = readCommand(&buffer, &prev_line);
+      if (line == NULL) {
 	continue;
       }
-      else {
-	runCommand(prev_cmd);
-	vect_delete(tokens);
-	continue; // Doesn't store the "prev" command in prev_cmd
-      }
     }
 
-    // Run the command with the tokens
-    runCommand(tokens);
+    // Run the command
+    runParsed(line, 0);
 
     // Storing the previous command
-    prev_cmd = copy_vect(prev_cmd, tokens);
-
-    vect_delete(tokens);
+    releaseLine(prev_line);
+    prev_line = line;
   }
 
-  vect_delete(prev_cmd);
+  releaseLine(prev_line);
+  clearCache();
+  clearVars();
   free(buffer);
   return 0;
 }
 
 
+// Tokenizes and parses a line typed at the prompt, reading more lines for
+// here-documents and unfinished scripts, and runs prev right away
+// Returns the parsed line, or NULL when there is nothing more to run
+parsed_line_t *readCommand(char **buffer, parsed_line_t **prev){
+  vect_t *tokens = parseInput(*buffer);
+
+  // Here-documents take the lines that follow
+  line_source_t stdinLines = { STDIN_FILENO, NULL, "> " };
+  int multiline = readHeredocs(tokens, &stdinLines) != 0;
+
+  // If there are no arguments, continue to the next iteration
+  if (vect_size(tokens) <= 0) {
+    vect_delete(tokens);
+    return NULL;
+  }
+
+  // Keep reading lines until every if, while and for is finished
+  while (startsScript(tokens) && isIncompleteScript(tokens)) {
+    multiline = 1;
+    assert(write(1, "> ", 2) == 2);
+    char *next = readLine(&stdinLines);
+    if (next == NULL) {
+      break;
+    }
+    free(*buffer);
+    *buffer = next;
+
+    // Each line ends a statement just like ; does
+    vect_add(tokens, ";");
+    vect_t *more = parseInput(*buffer);
+    readHeredocs(more, &stdinLines);
+    for (int i = 0; i < vect_size(more); i++) {
+      vect_add(tokens, vect_get(more, i));
+    }
+    vect_delete(more);
+  }
+
+  // Check if the command is prev
+  if(strcmp(vect_get(tokens, 0), "prev") == 0){
+    vect_delete(tokens);
+    // Check if its the first iteration so there is no prev
+    if(*prev == NULL) {
+      char prevError[] = "There is no previous command\n";
+      assert(write(1, prevError, strlen(prevError)) == strlen(prevError));
+    }
+    else {
+      runParsed(*prev, 0);
+    }
+    return NULL; // Doesn't store the "prev" command in prev
+  }
+
+  int incomplete = 0;
+  parsed_line_t *line = parseTokens(tokens, PARSE_LINE, &incomplete);
+  vect_delete(tokens);
+  if(line == NULL){
+    if(incomplete){
+      char early[] = "syntax error: unexpected end of input\n";
+      assert(write(2, early, strlen(early)) == strlen(early));
+    }
+    last_status = 2;
+    return NULL;
+  }
+
+  // Only a line that stands on its own can be found by its text again
+  if (!multiline) {
+    cacheStore(*buffer, line);
+  }
+  return line;
+}
+
 // Function to process the built in commands
-void processBuiltIn(vect_t *tokens){
+// Returns the exit status of the built in
+int processBuiltIn(vect_t *tokens){
+  countStat(STAT_BUILTINS, 1);
+
   // exit case
   if(strcmp(vect_get(tokens, 0), "exit") == 0){
     char bye[] = "Bye bye.\n";
     assert(write(1, bye, strlen(bye)) == strlen(bye));
     status = 1;
+    return 0;
   }
 
   // cd case
   else if(strcmp(vect_get(tokens, 0), "cd") == 0){
-    cd(tokens);
-    return;
+    return cd(tokens);
   }
 
   // source case
   else if(strcmp(vect_get(tokens, 0), "source") == 0){
-    source(tokens);
+    return source(tokens);
   }
 
   //help case
   else if(strcmp(vect_get(tokens, 0), "help") == 0 && vect_size(tokens) == 1){
-    helpCmd(tokens);
+    return helpCmd(tokens);
+  }
+
+  // test and [ case
+  else if(strcmp(vect_get(tokens, 0), "test") == 0 || strcmp(vect_get(tokens, 0), "[") == 0){
+    return testCmd(tokens);
+  }
+
+  // let case
+  else if(strcmp(vect_get(tokens, 0), "let") == 0){
+    return letCmd(tokens);
+  }
+
+  // exec case
+  else if(strcmp(vect_get(tokens, 0), "exec") == 0){
+    return execCmd(tokens);
+  }
+
+  // xargs case
+  else if(strcmp(vect_get(tokens, 0), "xargs") == 0){
+    return xargsCmd(tokens);
+  }
+
+  // parsecache case
+  else if(strcmp(vect_get(tokens, 0), "parsecache") == 0){
+    return parseCacheCmd(tokens);
+  }
+
+  // shellstat case
+  else if(strcmp(vect_get(tokens, 0), "shellstat") == 0){
+    return shellStatCmd(tokens);
+  }
+
+  // bench case
+  else if(strcmp(vect_get(tokens, 0), "bench") == 0){
+    return benchCmd(tokens);
+  }
+
+  // coproc, jobs and wait case
+  else if(strcmp(vect_get(tokens, 0), "coproc") == 0){
+    return coprocCmd(tokens);
+  }
+  else if(strcmp(vect_get(tokens, 0), "jobs") == 0){
+    return jobsCmd(tokens);
+  }
+  else if(strcmp(vect_get(tokens, 0), "wait") == 0){
+    return waitCmd(tokens);
+  }
+
+  // read, mapfile and readarray case
+  else if(strcmp(vect_get(tokens, 0), "read") == 0){
+    return readCmd(tokens);
   }
+  else if(strcmp(vect_get(tokens, 0), "mapfile") == 0 || strcmp(vect_get(tokens, 0), "readarray") == 0){
+    return mapfileCmd(tokens);
+  }
+
+  // ulimit and limit case
+  else if(strcmp(vect_get(tokens, 0), "ulimit") == 0){
+    return ulimitCmd(tokens);
+  }
+  else if(strcmp(vect_get(tokens, 0), "limit") == 0){
+    return limitCmd(tokens);
+  }
+
+  // true and false case
+  else if(strcmp(vect_get(tokens, 0), "true") == 0){
+    return 0;
+  }
+  else if(strcmp(vect_get(tokens, 0), "false") == 0){
+    return 1;
+  }
+
+  return 0;
 }
 
 // checks to see if the command is a built in
@@ -139,96 +327,141 @@ int isBuiltIn(vect_t *tokens){
     return 1;
   }
 
+  // test and [ case
+  if(strcmp(vect_get(tokens, 0), "test") == 0 || strcmp(vect_get(tokens, 0), "[") == 0){
+    return 1;
+  }
+
+  // let case
+  if(strcmp(vect_get(tokens, 0), "let") == 0){
+    return 1;
+  }
+
+  // exec case
+  if(strcmp(vect_get(tokens, 0), "exec") == 0){
+    return 1;
+  }
+
+  // xargs case
+  if(strcmp(vect_get(tokens, 0), "xargs") == 0){
+    return 1;
+  }
+
+  // parsecache case
+  if(strcmp(vect_get(tokens, 0), "parsecache") == 0){
+    return 1;
+  }
+
+  // shellstat case
+  if(strcmp(vect_get(tokens, 0), "shellstat") == 0){
+    return 1;
+  }
+
+  // bench case
+  if(strcmp(vect_get(tokens, 0), "bench") == 0){
+    return 1;
+  }
+
+  // coproc, jobs and wait case
+  if(strcmp(vect_get(tokens, 0), "coproc") == 0 || strcmp(vect_get(tokens, 0), "jobs") == 0
+     || strcmp(vect_get(tokens, 0), "wait") == 0){
+    return 1;
+  }
+
+  // read, mapfile and readarray case
+  if(strcmp(vect_get(tokens, 0), "read") == 0 || strcmp(vect_get(tokens, 0), "mapfile") == 0
+     || strcmp(vect_get(tokens, 0), "readarray") == 0){
+    return 1;
+  }
+
+  // ulimit and limit case
+  if(strcmp(vect_get(tokens, 0), "ulimit") == 0 || strcmp(vect_get(tokens, 0), "limit") == 0){
+    return 1;
+  }
+
+  // true and false case
+  if(strcmp(vect_get(tokens, 0), "true") == 0 || strcmp(vect_get(tokens, 0), "false") == 0){
+    return 1;
+  }
+
   return 0;
 }
 
-// Checks if it contains a special token
-int containsSpecial(vect_t *tokens){
-  for(int i = 0; i < vect_size(tokens); i++){
+// checks to see if the command is a built in that only prints output
+// These can have their output captured without forking
+int isPureBuiltIn(vect_t *tokens){
+  //help case
+  if(strcmp(vect_get(tokens, 0), "help") == 0 && vect_size(tokens) == 1){
+    return 1;
+  }
 
-    if(strcmp(vect_get(tokens, i), "|") == 0 
-	|| strcmp(vect_get(tokens, i), "<") == 0 
-	|| strcmp(vect_get(tokens, i), ">") == 0 
-	|| strcmp(vect_get(tokens, i), ";") == 0){
-      return 1;
-    }
+  // parsecache case, only when it just prints the counters
+  if(strcmp(vect_get(tokens, 0), "parsecache") == 0 && vect_size(tokens) == 1){
+    return 1;
   }
 
   return 0;
 }
 
-// Method to process special characters in the tokens
-void processSpecial(vect_t *tokens){
-  // Case where there is a pipe
-  // Split tokens into before the pipe and after and pass it to pipeFunc
-  int pipeIdx = indexOf(tokens, "|");
-
-  if(pipeIdx != -1){
-    vect_t *tokenList[2];
-    tokenList[0] = copy_vect_until(NULL, tokens, pipeIdx);
-    if(vect_size(tokens) - 1 <= pipeIdx){
-      runCommand(tokenList[0]);
-      vect_delete(tokenList[0]);
-      return;
-    } 
-    tokenList[1] = copy_vect_after(NULL, tokens, pipeIdx + 1);
-    pipeFunc(tokenList);
-    //free(tokenList);
-    return;
-  }
-
-  // unsure if pipe or sequence should come first
-  // Case where there is sequencing
-  // Split at ; and pass to sequence
-  int sequenceIdx = indexOf(tokens, ";");
-  if(sequenceIdx != -1){
-    vect_t *tokenList[2];
-    tokenList[0] = copy_vect_until(NULL, tokens, sequenceIdx);
-    if(vect_size(tokens) - 1 <= sequenceIdx){
-       runCommand(tokenList[0]);
-       vect_delete(tokenList[0]);
-       return;
-     }
-    tokenList[1] = copy_vect_after(NULL, tokens, sequenceIdx+1);
-    sequence(tokenList);
-    return;
-  }
-
-  // Case where this is a output redirection
-  // Split the tokens to before the > and after and pass to outputRedirection
-  int outputIdx = indexOf(tokens, ">");
-  if(outputIdx != -1){
-    vect_t *tokenList[2];
-    tokenList[0] = copy_vect_until(NULL, tokens, outputIdx);
-    if(vect_size(tokens) - 1 <= outputIdx){
-       runCommand(tokenList[0]);
-       vect_delete(tokenList[0]);
-       return;
+// Turns a status from waitpid into an exit status for $?
+int exitStatus(int wstatus){
+  if(WIFEXITED(wstatus)){
+    return WEXITSTATUS(wstatus);
+  }
+  if(WIFSIGNALED(wstatus)){
+    return 128 + WTERMSIG(wstatus);
+  }
+  return 1;
+}
+
+// Runs a parsed command tree and returns its exit status
+int execCommand(cmd_t *cmd){
+  return execTree(cmd, 0);
+}
+
+int execTree(cmd_t *cmd, int tail){
+  int result = 0;
+
+  switch(cmd->type){
+    // Replace the substitutions and variables right before the command runs
+    case CMD_SIMPLE: {
+      // An expansion that failed already said why, and the command doesn't run
+      int substStatus = 0;
+      vect_t *expanded = expandTokens(cmd->words, &substStatus);
+      if (expanded == NULL) {
+	result = 1;
+	break;
+      }
+      result = runSimpleCommand(expanded, cmd, tail);
+
+      // An assignment or a line that expands to nothing has the status of
+      // its last command substitution, so if out=$(cmd) tests cmd
+      if (result == 0 && (vect_size(expanded) == 0
+	  || (vect_size(expanded) == 1 && isAssignment(vect_get(expanded, 0))))) {
+	result = substStatus;
+      }
+      vect_delete(expanded);
+      break;
     }
-    tokenList[1] = copy_vect_after(NULL, tokens, outputIdx+1);
-    outputRedirect(tokenList);
-    return;
-  }
-
-  // Case where there is input redirection
-  // Split at < and pass to inputRedirection
-  int inputIdx = indexOf(tokens, "<");
-  if(inputIdx != -1){
-    vect_t *tokenList[2];
-    tokenList[0] = copy_vect_until(NULL, tokens, inputIdx);
-    if(vect_size(tokens) - 1 <= inputIdx){
-       runCommand(tokenList[0]);
-       vect_delete(tokenList[0]);
-       return;
-     }
-    tokenList[1] = copy_vect_after(NULL, tokens, inputIdx+1);
-    inputRedirect(tokenList);
-    return;
+    case CMD_PIPE:
+      result = pipeFunc(cmd, tail);
+      break;
+    case CMD_SEQ:
+      result = sequence(cmd, tail);
+      break;
+    case CMD_AND:
+    case CMD_OR:
+      result = conditional(cmd, tail);
+      break;
   }
+
+  last_status = result;
+  return result;
 }
 
 // Function that does the pipe functionality
-void pipeFunc(vect_t **tokenList){
+// The exit status is the one of the right side like in other shells
+int pipeFunc(cmd_t *cmd, int tail){
   int pipe_fd[2];
 
   //create the pipe
@@ -238,239 +471,276 @@ void pipeFunc(vect_t **tokenList){
   int readEnd = pipe_fd[0];
   int writeEnd = pipe_fd[1];
 
-  // save stdin and stdout
-  int saved_stdout = dup(1);
-  int saved_stdin = dup(0);
-
-  // Fork child A
-  int childa_pid = fork();
-  int status;
+  // Fork child A, which reads stdin from where the read built in stopped
+  returnReadAhead();
+  int childa_pid = countedFork();
 
   // In child
   if(childa_pid == 0){
     close(readEnd);
 
-    //close stdout
-    if (close(1) == -1) {
-      perror("Error closing stdout");
-      exit(1);
-    }
-
     // replace stdout with write end of the pipe
     dup2(writeEnd, STDOUT_FILENO);
+    close(writeEnd);
 
-    // run the first command
-    runCommand(tokenList[0]);
+    // run the first command, which is the last thing the child does
+    int result = execTree(cmd->left, 1);
 
-    vect_delete(tokenList[0]);
-    vect_delete(tokenList[1]);
-    //free(tokenList);
     //exit the child
-    exit(0);  
+    _exit(result);  
+  }
+  else if(childa_pid < 0){
+    perror("Error - fork failed");
+    exit(1);
   }
-  // In parent
-  else if(childa_pid > 0){
-    // wait for child to finish
-    waitpid(childa_pid, &status, 0);
-    close(writeEnd);
-
-    // close stdin
-    if(close(0) == -1){
-      perror("Error closing stdin");
-      exit(1);
-    }
 
-    // replace stdin with the read end
+  // When the pipe is the last thing to run the right side runs right
+  // here instead of in child B
+  if(tail){
+    close(writeEnd);
+    readAheadMoved(STDIN_FILENO);
     dup2(readEnd, STDIN_FILENO);
+    close(readEnd);
 
-  }
-  else {
-    perror("Error - fork failed");
-    exit(1);
+    int result = execTree(cmd->right, 1);
+    countedWaitpid(childa_pid, NULL, 0);
+    return result;
   }
 
-  int status2;
-  // Fork child B
-  int childb_pid = fork();
+  // Fork child B while child A is still running, otherwise
+  // child A blocks forever once it fills the pipe
+  int childb_pid = countedFork();
 
   // IN child B
   if(childb_pid == 0){
     close(writeEnd);
 
-    // Put stdout back where it needs to be
-    dup2(saved_stdout, STDOUT_FILENO);
+    // replace stdin with the read end of the pipe
+    readAheadMoved(STDIN_FILENO);
+    dup2(readEnd, STDIN_FILENO);
+    close(readEnd);
 
     // run the second command with stdin being read end of pipe
     // and stdout being stdout
-    runCommand(tokenList[1]);
+    int result = execTree(cmd->right, 1);
 
-    vect_delete(tokenList[0]);
-    vect_delete(tokenList[1]);
     // exit child
-    //free(tokenList);
-    exit(0);
+    _exit(result);
   }
-  // In parent B
-  else if(childb_pid > 0){
-    // Wait for child
-    waitpid(childb_pid, &status2, 0);
-
-    // Put stdin back
-    dup2(saved_stdin, STDIN_FILENO);
-
-  }
-  else {
+  else if(childb_pid < 0){
     perror("Error - fork failed");
     exit(1);
   }
 
-  vect_delete(tokenList[0]);
-  vect_delete(tokenList[1]);
+  // The shell itself doesn't use either end of the pipe
+  close(readEnd);
+  close(writeEnd);
+
+  // Wait for both children to finish
+  int statusb;
+  countedWaitpid(childa_pid, NULL, 0);
+  countedWaitpid(childb_pid, &statusb, 0);
+
+  return exitStatus(statusb);
 }
 
 
-// Method to redirect the output
-void outputRedirect(vect_t **tokenList){
- // save stdout so it can be put back where it belongs
-  int saved_stdout = dup(1);
+// Method to sequence two commands
+int sequence(cmd_t *cmd, int tail){
+  execTree(cmd->left, 0);
+  return execTree(cmd->right, tail);
+}
 
-  // close stdout
-  if (close(1) == -1) {
-    perror("Error closing stdout");
+// Method for && and ||
+// The right side only runs when the left side succeeded for && or failed
+// for ||, otherwise the status of the left side is kept
+int conditional(cmd_t *cmd, int tail){
+  int result = execTree(cmd->left, 0);
+  if(status != 0){
+    return result;
   }
-
-  // open the given file for writing and creating if the file doesn't exist
-  // If error put stdout back and print error
-  int fd = open(vect_get(tokenList[1],0) , O_WRONLY | O_CREAT | O_TRUNC, 0644);
-  if (fd == -1) {
-    dup2(saved_stdout, STDOUT_FILENO);
-    perror("Error trying to open file");
-    return;
+  if((cmd->type == CMD_AND) == (result == 0)){
+    result = execTree(cmd->right, tail);
   }
+  return result;
+}
 
-  // replace stdout with the file
-  dup2(fd, STDOUT_FILENO);
-
-  // Run the command with stdout being the file
-  runCommand(tokenList[0]);
-
-  // Close the file
-  close(fd);
+// Method to run a command
+int runCommand(vect_t *tokens, int tail){
+  if(vect_size(tokens) == 0){
+    return last_status;
+  }
+
+  // A line with an if, while or for in it is compiled for the script
+  // machine, anything else is parsed into a tree
+  int incomplete = 0;
+  parsed_line_t *line = parseTokens(tokens, PARSE_LINE, &incomplete);
+  if(line == NULL){
+    if(incomplete){
+      char early[] = "syntax error: unexpected end of input\n";
+      assert(write(2, early, strlen(early)) == strlen(early));
+    }
+    last_status = 2;
+    return last_status;
+  }
 
-  // Put stdout beack
-  dup2(saved_stdout, STDOUT_FILENO);
-  vect_delete(tokenList[0]);
-  vect_delete(tokenList[1]);
+  int result = runParsed(line, tail);
+  releaseLine(line);
+  return result;
 }
 
-// Method to redirect the input of a command
-void inputRedirect(vect_t **tokenList){
-  // Save stdin for later use
-  int saved_stdin = dup(0);
-
-  // close stdin
-  if (close(0) == -1) {
-    perror("Error closing stdin");
+int runParsed(parsed_line_t *line, int tail){
+  if(line->prog != NULL){
+    return runProgram(line->prog, tail);
   }
-
-  // Open the file for reading
-  // Put stdin back then do the error
-  int fd = open(vect_get(tokenList[1],0) ,O_RDONLY);
-  if (fd == -1) {
-    dup2(saved_stdin, STDIN_FILENO);
-    perror("Error trying to open file");
-    return;
+  if(line->cmd != NULL){
+    return execTree(line->cmd, tail);
   }
-
-  // Make the file stdin
-  dup2(fd, STDIN_FILENO);
-
-  // Run the command with stdin as the file
-  runCommand(tokenList[0]);
-
-  // Close the file
-  close(fd);
-
-  // Put stdin back
-  dup2(saved_stdin, STDIN_FILENO);
-  vect_delete(tokenList[0]);
-  vect_delete(tokenList[1]);
+  return last_status;
 }
 
-// Method to sequence two commands
-void sequence(vect_t **tokenList){
-  runCommand(tokenList[0]);
-  runCommand(tokenList[1]);
-  vect_delete(tokenList[0]);
-  vect_delete(tokenList[1]);
-}
+// Method to run a command without any special characters
+// The redirections of an external command are only applied in the child,
+// and when tail is set the command replaces the shell instead of being forked
+// Returns the exit status of the command
+int runSimpleCommand(vect_t *tokens, cmd_t *cmd, int tail){
+  // Case where exec only has redirections so they stay in the shell for good
+  if(cmd->redirs != NULL && vect_size(tokens) == 1 && strcmp(vect_get(tokens, 0), "exec") == 0){
+    fd_backup_t backup;
+    int result = applyRedirects(cmd, &backup);
+    forgetRedirects(&backup);
+    return result == 0 ? 0 : 1;
+  }
+
+  // Case where the shell runs the command itself
+  // The fds the redirections replace are put back afterwards
+  if(vect_size(tokens) == 0
+     || (vect_size(tokens) == 1 && isAssignment(vect_get(tokens, 0)))
+     || isBuiltIn(tokens) == 1 || isPureCat(tokens) == 1){
+    fd_backup_t backup;
+    int result = 1;
+    if(applyRedirects(cmd, &backup) == 0){
+      result = runInShell(tokens);
+    }
+    restoreRedirects(&backup);
+    return result;
+  }
 
-// Method to run a command
-void runCommand(vect_t *tokens){
-  // Case where the command is a built in
-  if(isBuiltIn(tokens) == 1){
-    processBuiltIn(tokens); 
+  // Case where nothing runs after the command so there is no need to fork
+  if(tail){
+    if(applyRedirects(cmd, NULL) == -1){
+      return 1;
+    }
+    execProgram(tokens);
   }
 
-  // Case where the command has special characters that in it 
-  else if(containsSpecial(tokens) == 1){
-    processSpecial(tokens);
+  // Case where the spawn helper starts the command, so a shell that has
+  // grown big isn't copied. The redirection targets are opened in the
+  // shell and passed along as fds 0 to 2, the shell's own stay as they are
+  if(canSpawn(cmd)){
+    std_fds_t std;
+    if(openStdFds(cmd, &std) == -1){
+      return 1;
+    }
+    int result = spawnProgram(tokens, &std);
+    closeStdFds(&std);
+    return result;
   }
 
   // Case where the command is in bin
-  else {
-    // Make the first arg have /bin/ in front for exec
-    char *args[vect_size(tokens)+1];
-    char *executable = (char *)malloc(strlen("/bin/") + strlen(vect_get(tokens, 0)) + 1);
-    strcpy(executable, "/bin/");  // Copy "/bin/"
-    strcat(executable, vect_get(tokens, 0));  // Concatenate the command
-    args[0] = executable;
-
-    // Create the not found string incase the command doesn't exist
-    char *notFound = (char *)malloc(strlen(" : command not found\n") + strlen(vect_get(tokens, 0)) + 1);
-    strcpy(notFound, vect_get(tokens,0));
-    strcat(notFound, " : command not found\n");  // Concatenate the command
-
-    // Copy the tokens to a char[] for exec
-    for(int i = 1; i < vect_size(tokens); i++) {
-      args[i] = (char *) malloc(strlen(vect_get(tokens,i))+1);
-      strcpy(args[i],vect_get(tokens,i));
+  // Fork to run comand, which reads stdin from where the read built in stopped
+  returnReadAhead();
+  int pid = countedFork();
+  if (pid == 0) {
+    if(applyRedirects(cmd, NULL) == -1){
+      _exit(1);
     }
+    execProgram(tokens);
+  }
+  else if(pid < 0){
+    perror("Error - fork failed");
+    return 1;
+  }
 
-    // set last arg to null for exec
-    args[vect_size(tokens)] = NULL;
-
-    // Fork to run comand
-    if (fork()  == 0) {
-      // Executes command from child then terminates our process
-      // Note: There are other 'exec' functions that may be helpful. Look at 'man exec' and 'man execve'.
-      execve(args[0], args, NULL);
+  // Wait till child is finished
+  int wstatus = 0;
+  countedWaitpid(pid, &wstatus, 0);
+  return exitStatus(wstatus);
+}
 
-      // If reached there was an error
-      assert(write(1, notFound, strlen(notFound)) == strlen(notFound));
-      //perror("execvp");
-      exit(1);              
-    }
+// Runs a command that doesn't need a new process
+int runInShell(vect_t *tokens){
+  // Case where there is nothing to run, like a line with only > file
+  if(vect_size(tokens) == 0){
+    return 0;
+  }
 
-    // Wait till child is finished
-    wait(NULL);
+  // Case where the command sets a variable
+  if(vect_size(tokens) == 1 && isAssignment(vect_get(tokens, 0))){
+    assignVar(vect_get(tokens, 0));
+    return 0;
+  }
 
-    // Free the allocated memory
-    free(executable);
-    for(int i = 1; i < vect_size(tokens); i++){
-      free(args[i]);
-    }
-    free(notFound);
+  // Case where the command is a built in
+  if(isBuiltIn(tokens) == 1){
+    return processBuiltIn(tokens); 
   }
+
+  // Case where the command is cat just moving data around
+  // The shell copies it itself without forking, from where read stopped
+  returnReadAhead();
+  return runPureCat(tokens);
+}
+
+void execProgram(vect_t *tokens){
+  tryExecProgram(tokens);
+  _exit(127);
+}
+
+// Replaces the process with the command in /bin
+// Returns 127 after printing an error when it can't be run
+int tryExecProgram(vect_t *tokens){
+  // Make the first arg have /bin/ in front for exec
+  char *args[vect_size(tokens)+1];
+  char *executable = (char *)malloc(strlen("/bin/") + strlen(vect_get(tokens, 0)) + 1);
+  strcpy(executable, "/bin/");  // Copy "/bin/"
+  strcat(executable, vect_get(tokens, 0));  // Concatenate the command
+  args[0] = executable;
+
+  // Copy the tokens to a char[] for exec
+  for(int i = 1; i < vect_size(tokens); i++) {
+    args[i] = vect_get_copy(tokens, i);
+  }
+
+  // set last arg to null for exec
+  args[vect_size(tokens)] = NULL;
+
+  // Executes command then terminates our process, which starts reading
+  // files where the read built in stopped
+  returnReadAhead();
+  countStat(STAT_EXECS, 1);
+  execve(args[0], args, environ);
+  countStat(STAT_EXEC_FAILURES, 1);
+
+  // If reached there was an error
+  for(int i = 0; i < vect_size(tokens); i++) {
+    free(args[i]);
+  }
+  char *notFound = (char *)malloc(strlen(" : command not found\n") + strlen(vect_get(tokens, 0)) + 1);
+  strcpy(notFound, vect_get(tokens,0));
+  strcat(notFound, " : command not found\n");  // Concatenate the command
+  assert(write(1, notFound, strlen(notFound)) == strlen(notFound));
+  free(notFound);
+  return 127;
 }
 
 // Function for the cd command
-void cd(vect_t *tokens){
+int cd(vect_t *tokens){
   // case where there are too many args to cd
   if (vect_size(tokens) != 2) {
     char tooArg[] = "cd: too many args\n";
     assert(write(1, tooArg, strlen(tooArg)) == strlen(tooArg));
-    return;
+    return 1;
   }
 
   // Get the directory we are changing to
@@ -479,77 +749,220 @@ void cd(vect_t *tokens){
   // Change directory faiiled
   if (chdir(newDir) != 0) {
     perror("cd");
+    return 1;
   }
+  return 0;
 }
 
-void source(vect_t *tokens){
+// Function for the source command
+// The whole file is compiled once and then run, so loops don't parse their body again
+int source(vect_t *tokens){
 
   // Checks if the no. of arguments is correct
   if (vect_size(tokens) != 2) {
     char oneArg[] = "source: only 1 args expected\n";
     assert(write(1, oneArg, strlen(oneArg)) == strlen(oneArg));
-    return;
+    return 1;
   }
 
+  return runScriptFile(vect_get(tokens, 1), 0);
+}
+
+// Runs every line of the file as one script
+// When tail is set the script is the last thing the shell runs
+int runScriptFile(const char *path, int tail){
   // Opens the file to read from it
-  const char *file_path = vect_get(tokens, 1);
-  FILE *fd = fopen(file_path, "r");
+  FILE *fd = fopen(path, "r");
   if (fd == NULL) {
     perror("Error reading file");
-    return;
+    return 1;
   }
 
+  // The whole file is the key, so sourcing it again skips the parser
   size_t buff_size = 0;
-  char *buffer = NULL;
-  size_t length = 0;
-  fpos_t *pos = (fpos_t *)malloc(sizeof(fpos_t));
-
-  length = getline(&buffer, &buff_size, fd);
-  vect_t *prev_cmd = NULL;
-  fgetpos(fd,pos);
-  while(length != -1) {
-    vect_t *tokens = parseInput(buffer);
-
-    // Check if the command is prev
-    if(strcmp(vect_get(tokens, 0), "prev") == 0){
-      // Check if its the first iteration so there is no prev
-      if(prev_cmd == NULL) {
-	char prevError[] = "There is no previous command\n";
-	assert(write(1, prevError, strlen(prevError)) == strlen(prevError));
-	vect_delete(tokens);
-	continue;
-      }
-      else {
-	fsetpos(fd,pos);
-	runCommand(prev_cmd);
-	length = getline(&buffer, &buff_size, fd);
-	fgetpos(fd,pos);
-	vect_delete(tokens);
-	continue; // Doesn't store the "prev" command in prev_cmd
-      }
+  char *text = NULL;
+  if (getdelim(&text, &buff_size, '\0', fd) == -1) {
+    free(text);
+    text = strdup("");
+  }
+  fclose(fd);
+
+  int incomplete = 0;
+  parsed_line_t *script = parseText(text, PARSE_SCRIPT, &incomplete);
+  free(text);
+  if (script == NULL) {
+    if (incomplete) {
+      fprintf(stderr, "%s: syntax error: unexpected end of file\n", path);
     }
+    return 2;
+  }
 
-    fsetpos(fd,pos);
-    runCommand(tokens);
+  int result = runParsed(script, tail);
+  releaseLine(script);
+  return result;
+}
 
-    // Storing the previous command
-    prev_cmd = copy_vect(prev_cmd, tokens);
+// Runs the line given with -c as the only thing the shell does
+int runString(const char *line){
+  line_source_t lines = { -1, line, NULL };
+  vect_t *tokens = readScript(&lines);
 
-    free(buffer);
-    length = getline(&buffer, &buff_size, fd);
-    fgetpos(fd,pos);
-    vect_delete(tokens);
+  int result = runCommand(tokens, 1);
+  vect_delete(tokens);
+  return result;
+}
+
+// The exec built in replaces the shell with the command
+// On its own it does nothing, exec > file is handled by the redirection
+int execCmd(vect_t *tokens){
+  if(vect_size(tokens) == 1){
+    return 0;
   }
 
-  vect_delete(prev_cmd);
-  free(pos);
+  // Only a shell without a prompt exits when the command can't be run
+  vect_t *args = copy_vect_after(NULL, tokens, 1);
+  int result = tryExecProgram(args);
+  vect_delete(args);
+  if(!interactive){
+    _exit(result);
+  }
+  return result;
 }
 
-void helpCmd(vect_t *tokens){
-  char *helpMsg = "cd: Change the shell working directory.\npwd: Print the name of the current working directory.\nhelp:  Display information about builtin commands.\nprev: Runs the previous command, not including itself";
+// Function for the test and [ commands
+// Returns 0 when the expression is true, 1 when false and 2 on an error
+int testCmd(vect_t *tokens){
+  int argc = vect_size(tokens) - 1;
+
+  // [ has to be closed by ]
+  if (strcmp(vect_get(tokens, 0), "[") == 0) {
+    if (argc == 0 || strcmp(vect_get(tokens, argc), "]") != 0) {
+      char noClose[] = "[: missing ]\n";
+      assert(write(2, noClose, strlen(noClose)) == strlen(noClose));
+      return 2;
+    }
+    argc--;
+  }
+
+  const char *args[argc > 0 ? argc : 1];
+  for (int i = 0; i < argc; i++) {
+    args[i] = vect_get(tokens, i + 1);
+  }
+
+  // ! flips the result of the rest
+  int negate = 0;
+  int first = 0;
+  if (argc - first > 1 && strcmp(args[first], "!") == 0) {
+    negate = 1;
+    first++;
+  }
+
+  int count = argc - first;
+  const char **arg = args + first;
+  int result;
+
+  if (count == 0) {
+    result = 0;
+  }
+  else if (count == 1) {
+    result = arg[0][0] != '\0';
+  }
+  else if (count == 2) {
+    struct stat info;
+    const char *op = arg[0];
+    if (strcmp(op, "-n") == 0) {
+      result = arg[1][0] != '\0';
+    }
+    else if (strcmp(op, "-z") == 0) {
+      result = arg[1][0] == '\0';
+    }
+    else if (strcmp(op, "-e") == 0) {
+      result = stat(arg[1], &info) == 0;
+    }
+    else if (strcmp(op, "-f") == 0) {
+      result = stat(arg[1], &info) == 0 && S_ISREG(info.st_mode);
+    }
+    else if (strcmp(op, "-d") == 0) {
+      result = stat(arg[1], &info) == 0 && S_ISDIR(info.st_mode);
+    }
+    else if (strcmp(op, "-s") == 0) {
+      result = stat(arg[1], &info) == 0 && info.st_size > 0;
+    }
+    else {
+      fprintf(stderr, "test: %s: unary operator expected\n", op);
+      return 2;
+    }
+  }
+  else if (count == 3) {
+    const char *op = arg[1];
+    long long left = strtoll(arg[0], NULL, 10);
+    long long right = strtoll(arg[2], NULL, 10);
+    if (strcmp(op, "=") == 0 || strcmp(op, "==") == 0) {
+      result = strcmp(arg[0], arg[2]) == 0;
+    }
+    else if (strcmp(op, "!=") == 0) {
+      result = strcmp(arg[0], arg[2]) != 0;
+    }
+    else if (strcmp(op, "-eq") == 0) {
+      result = left == right;
+    }
+    else if (strcmp(op, "-ne") == 0) {
+      result = left != right;
+    }
+    else if (strcmp(op, "-lt") == 0) {
+      result = left < right;
+    }
+    else if (strcmp(op, "-le") == 0) {
+      result = left <= right;
+    }
+    else if (strcmp(op, "-gt") == 0) {
+      result = left > right;
+    }
+    else if (strcmp(op, "-ge") == 0) {
+      result = left >= right;
+    }
+    else {
+      fprintf(stderr, "test: %s: binary operator expected\n", op);
+      return 2;
+    }
+  }
+  else {
+    char tooMany[] = "test: too many arguments\n";
+    assert(write(2, tooMany, strlen(tooMany)) == strlen(tooMany));
+    return 2;
+  }
+
+  if (negate) {
+    result = !result;
+  }
+  return result ? 0 : 1;
+}
+
+int helpCmd(vect_t *tokens){
+  // One line per built in
+  char *helpMsg =
+    "cd: Change the shell working directory.\n"
+    "pwd: Print the name of the current working directory.\n"
+    "help:  Display information about builtin commands.\n"
+    "prev: Runs the previous command, not including itself\n"
+    "test, [: Evaluate a file, string or number test, [ needs a closing ].\n"
+    "true, false: Return a successful or an unsuccessful status.\n"
+    "let: Evaluate each argument as an arithmetic expression, like $(( )).\n"
+    "exec: Replace the shell with the command, or keep its redirections for the shell.\n"
+    "xargs: Run the command with the items read from stdin as arguments, packed up to ARG_MAX.\n"
+    "parsecache: Print the hits and misses of the parsed line cache, -c clears it.\n"
+    "shellstat: Print the shell counters, as JSON with -j, -r resets them.\n"
+    "bench: Time a command over several runs and print the mean, spread and usage.\n"
+    "coproc: Start a command in the background with pipes to and from it.\n"
+    "jobs: List the background jobs and their state.\n"
+    "wait: Wait for the given jobs, or all of them, and return the last status.\n"
+    "read: Read a line from stdin or -u FD into the variables.\n"
+    "mapfile, readarray: Read the lines from stdin or -u FD into an array.\n"
+    "ulimit: Show or set a resource limit of the shell.\n"
+    "limit: Run a command with memory, CPU time or open file limits for it alone.\n";
 
   assert(write(1, helpMsg, strlen(helpMsg)) == strlen(helpMsg));
-  return;
+  return 0;
 
 }
 
@@ -0,0 +1,50 @@
+#ifndef _SHELL_H
+#define _SHELL_H
+
+#include "vect.h"
+#include "parse.h"
+#include "cache.h"
+
+// Set to 1 once the shell should exit
+extern int status;
+
+// Exit status of the last command, used for $?
+extern int last_status;
+
+// Runs a tokenized command line, including any special characters in it
+// Set tail when nothing else will run in this process afterwards, so the
+// last command can replace the process instead of being forked
+// Returns the exit status of the command
+int runCommand(vect_t *tokens, int tail);
+
+// Runs a line that was already tokenized and parsed, where tail is the
+// same as for runCommand
+int runParsed(parsed_line_t *line, int tail);
+
+// Runs a parsed command tree and returns its exit status
+int execCommand(cmd_t *cmd);
+
+// Runs a parsed command tree, where tail is the same as for runCommand
+int execTree(cmd_t *cmd, int tail);
+
+// Replaces the process with the command in /bin
+// Never returns, it exits with 127 if the command can't be run
+void execProgram(vect_t *tokens);
+
+// Turns a status from waitpid into an exit status for $?
+int exitStatus(int wstatus);
+
+// Checks to see if the command is a built in
+int isBuiltIn(vect_t *tokens);
+
+// Checks to see if the command is a built in that only prints output
+// and does not change the state of the shell
+int isPureBuiltIn(vect_t *tokens);
+
+// Runs the built in command and returns its exit status
+int processBuiltIn(vect_t *tokens);
+
+// Runs the test or [ built in and returns its exit status
+int testCmd(vect_t *tokens);
+
+#endif /* ifndef _SHELL_H */
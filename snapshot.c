@@ -0,0 +1,421 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "vect.h"
+#include "parse.h"
+#include "script.h"
+#include "heredoc.h"
+#include "cache.h"
+#include "stats.h"
+#include "snapshot.h"
+
+// Length written in place of a string or list that is NULL
+#define SNAPSHOT_NONE UINT32_MAX
+
+/** The bytes of a snapshot being built. */
+typedef struct snapshot_writer {
+  char *data;
+  size_t len;
+  size_t cap;
+} snapshot_writer_t;
+
+/** Where decoding a mapped snapshot has got to. */
+typedef struct snapshot_reader {
+  const char *pos;
+  const char *end;
+  int bad;             /* Set once anything runs past the end or makes no sense. */
+} snapshot_reader_t;
+
+// Adds bytes to the end of the snapshot
+void putBytes(snapshot_writer_t *w, const void *bytes, size_t len);
+
+// Adds a number to the snapshot
+void putU32(snapshot_writer_t *w, uint32_t value);
+
+// Adds a string, which may be NULL, as its length and its bytes
+void putString(snapshot_writer_t *w, const char *s);
+
+// Adds a list of words, which may be NULL, as a count and the words
+void putWords(snapshot_writer_t *w, vect_t *words);
+
+// Adds a command tree, which may be NULL, with the left side before the right
+void putCmd(snapshot_writer_t *w, cmd_t *cmd);
+
+// Takes a number from the snapshot
+uint32_t getU32(snapshot_reader_t *r);
+
+// Takes a string from the snapshot, NULL when it was NULL or on an error
+char *getString(snapshot_reader_t *r);
+
+// Takes a list of words from the snapshot
+vect_t *getWords(snapshot_reader_t *r);
+
+// Takes a command tree from the snapshot
+cmd_t *getCmd(snapshot_reader_t *r);
+
+// Reads the whole file on fd, returning it with its length in len
+char *readFile(int fd, size_t *len);
+
+// Adds bytes to the end of the snapshot
+void putBytes(snapshot_writer_t *w, const void *bytes, size_t len) {
+  if (w->len + len > w->cap) {
+    while (w->len + len > w->cap) {
+      w->cap = w->cap == 0 ? 4096 : w->cap * 2;
+    }
+    w->data = realloc(w->data, w->cap);
+  }
+  memcpy(w->data + w->len, bytes, len);
+  w->len += len;
+}
+
+// Adds a number to the snapshot
+void putU32(snapshot_writer_t *w, uint32_t value) {
+  putBytes(w, &value, sizeof(value));
+}
+
+// Adds a string, which may be NULL, as its length and its bytes
+void putString(snapshot_writer_t *w, const char *s) {
+  if (s == NULL) {
+    putU32(w, SNAPSHOT_NONE);
+    return;
+  }
+  uint32_t len = strlen(s);
+  putU32(w, len);
+  putBytes(w, s, len);
+}
+
+// Adds a list of words, which may be NULL, as a count and the words
+void putWords(snapshot_writer_t *w, vect_t *words) {
+  if (words == NULL) {
+    putU32(w, SNAPSHOT_NONE);
+    return;
+  }
+  putU32(w, vect_size(words));
+  for (int i = 0; i < vect_size(words); i++) {
+    putString(w, vect_get(words, i));
+  }
+}
+
+// Adds a command tree, which may be NULL, with the left side before the right
+void putCmd(snapshot_writer_t *w, cmd_t *cmd) {
+  putU32(w, cmd != NULL);
+  if (cmd == NULL) {
+    return;
+  }
+
+  putU32(w, cmd->type);
+  putU32(w, cmd->pipedOut);
+  putWords(w, cmd->words);
+
+  uint32_t redirs = 0;
+  for (redir_t *redir = cmd->redirs; redir != NULL; redir = redir->next) {
+    redirs++;
+  }
+  putU32(w, redirs);
+  for (redir_t *redir = cmd->redirs; redir != NULL; redir = redir->next) {
+    putU32(w, redir->type);
+    putU32(w, redir->fd);
+    putU32(w, redir->flags);
+    putString(w, redir->word);
+  }
+
+  putCmd(w, cmd->left);
+  putCmd(w, cmd->right);
+}
+
+// Takes a number from the snapshot
+uint32_t getU32(snapshot_reader_t *r) {
+  uint32_t value = 0;
+  if (r->bad || r->end - r->pos < sizeof(value)) {
+    r->bad = 1;
+    return 0;
+  }
+  memcpy(&value, r->pos, sizeof(value));
+  r->pos += sizeof(value);
+  return value;
+}
+
+// Takes a string from the snapshot, NULL when it was NULL or on an error
+char *getString(snapshot_reader_t *r) {
+  uint32_t len = getU32(r);
+  if (r->bad || len == SNAPSHOT_NONE) {
+    return NULL;
+  }
+  if (r->end - r->pos < len) {
+    r->bad = 1;
+    return NULL;
+  }
+  char *s = strndup(r->pos, len);
+  r->pos += len;
+  return s;
+}
+
+// Takes a list of words from the snapshot
+vect_t *getWords(snapshot_reader_t *r) {
+  uint32_t count = getU32(r);
+  if (r->bad || count == SNAPSHOT_NONE) {
+    return NULL;
+  }
+
+  // The words are copied straight out of the mapping
+  vect_t *words = vect_new();
+  for (uint32_t i = 0; i < count && !r->bad; i++) {
+    uint32_t len = getU32(r);
+    if (len == SNAPSHOT_NONE || r->end - r->pos < len) {
+      r->bad = 1;
+      break;
+    }
+    vect_add_len(words, r->pos, len);
+    r->pos += len;
+  }
+  return words;
+}
+
+// Takes a command tree from the snapshot
+cmd_t *getCmd(snapshot_reader_t *r) {
+  if (getU32(r) == 0) {
+    return NULL;
+  }
+
+  cmd_t *cmd = calloc(1, sizeof(cmd_t));
+  cmd->type = getU32(r);
+  cmd->pipedOut = getU32(r);
+  cmd->words = getWords(r);
+  if (cmd->type > CMD_OR) {
+    r->bad = 1;
+  }
+
+  // Redirections are added at the end to keep their order
+  redir_t **tail = &cmd->redirs;
+  uint32_t redirs = getU32(r);
+  for (uint32_t i = 0; i < redirs && !r->bad; i++) {
+    redir_t *redir = calloc(1, sizeof(redir_t));
+    redir->type = getU32(r);
+    redir->fd = getU32(r);
+    redir->flags = getU32(r);
+    redir->word = getString(r);
+    *tail = redir;
+    tail = &redir->next;
+    if (redir->type > REDIR_HERESTRING) {
+      r->bad = 1;
+    }
+  }
+
+  if (!r->bad) {
+    cmd->left = getCmd(r);
+  }
+  if (!r->bad) {
+    cmd->right = getCmd(r);
+  }
+
+  // A simple command needs its words and an operator both of its sides
+  if (cmd->type == CMD_SIMPLE ? cmd->words == NULL : cmd->left == NULL || cmd->right == NULL) {
+    r->bad = 1;
+  }
+  return cmd;
+}
+
+int saveSnapshot(const char *path, program_t *prog, const struct stat *rc, uint64_t hash) {
+  snapshot_writer_t w = { NULL, 0, 0 };
+  for (unsigned int i = 0; i < prog->size; i++) {
+    instr_t *instr = &prog->code[i];
+    putU32(&w, instr->op);
+    putU32(&w, instr->target);
+    putU32(&w, instr->slot);
+    putString(&w, instr->name);
+    putWords(&w, instr->words);
+    putCmd(&w, instr->cmd);
+  }
+
+  snapshot_header_t header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+  header.version = SNAPSHOT_VERSION;
+  header.slots = prog->slots;
+  header.redirectSlots = prog->redirectSlots;
+  header.size = prog->size;
+  header.rcSize = rc->st_size;
+  header.rcMtimeSec = rc->st_mtim.tv_sec;
+  header.rcMtimeNsec = rc->st_mtim.tv_nsec;
+  header.rcHash = hash;
+  header.bodyLen = w.len;
+
+  // Written next to the snapshot and renamed over it once it is complete
+  char *tmp = malloc(strlen(path) + 32);
+  sprintf(tmp, "%s.%d", path, getpid());
+  int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  int result = fd == -1 ? -1 : 0;
+  if (result == 0 && (write(fd, &header, sizeof(header)) != sizeof(header)
+		      || (w.len > 0 && write(fd, w.data, w.len) != w.len))) {
+    result = -1;
+  }
+  if (fd != -1 && close(fd) == -1) {
+    result = -1;
+  }
+  if (result == 0 && rename(tmp, path) == -1) {
+    result = -1;
+  }
+  if (result == -1 && fd != -1) {
+    unlink(tmp);
+  }
+  free(tmp);
+  free(w.data);
+  return result;
+}
+
+program_t *loadSnapshot(const char *path, const struct stat *rc, uint64_t hash) {
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd == -1) {
+    return NULL;
+  }
+  struct stat st;
+  if (fstat(fd, &st) == -1 || st.st_size < sizeof(snapshot_header_t)) {
+    close(fd);
+    return NULL;
+  }
+  char *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    return NULL;
+  }
+
+  // A snapshot is only used for the exact rc file it was made from
+  snapshot_header_t header;
+  memcpy(&header, map, sizeof(header));
+  if (memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) != 0
+      || header.version != SNAPSHOT_VERSION
+      || header.rcSize != rc->st_size
+      || header.rcMtimeSec != rc->st_mtim.tv_sec
+      || header.rcMtimeNsec != rc->st_mtim.tv_nsec
+      || header.rcHash != hash
+      || header.bodyLen != st.st_size - sizeof(header)) {
+    munmap(map, st.st_size);
+    return NULL;
+  }
+
+  program_t *prog = malloc(sizeof(program_t));
+  prog->capacity = header.size > 0 ? header.size : 1;
+  prog->code = calloc(prog->capacity, sizeof(instr_t));
+  prog->size = 0;
+  prog->slots = header.slots;
+  prog->redirectSlots = header.redirectSlots;
+
+  snapshot_reader_t r = { map + sizeof(header), map + st.st_size, 0 };
+  while (prog->size < header.size && !r.bad) {
+    instr_t *instr = &prog->code[prog->size++];
+    instr->op = getU32(&r);
+    instr->target = getU32(&r);
+    instr->slot = getU32(&r);
+    instr->name = getString(&r);
+    instr->words = getWords(&r);
+    instr->cmd = getCmd(&r);
+
+    // Anything that would make the program index out of its arrays, jump
+    // out of the code or miss what its opcode runs
+    int redirect = instr->op == OP_REDIRECT || instr->op == OP_RESTORE;
+    int slots = redirect ? prog->redirectSlots : prog->slots;
+    int needsCmd = instr->op == OP_SPAWN || instr->op == OP_REDIRECT;
+    int needsWords = instr->op == OP_BUILTIN || instr->op == OP_TEST
+      || instr->op == OP_ASSIGN || instr->op == OP_FOR_INIT;
+    if (instr->op > OP_RESTORE || instr->slot < 0 || instr->slot > slots
+	|| instr->target < 0 || instr->target > header.size
+	|| (needsCmd && instr->cmd == NULL) || (needsWords && instr->words == NULL)
+	|| (instr->op == OP_FOR_NEXT && instr->name == NULL)) {
+      r.bad = 1;
+    }
+  }
+  munmap(map, st.st_size);
+
+  if (r.bad || r.pos != r.end) {
+    program_delete(prog);
+    return NULL;
+  }
+  return prog;
+}
+
+// Reads the whole file on fd, returning it with its length in len
+char *readFile(int fd, size_t *len) {
+  struct stat st;
+  size_t cap = fstat(fd, &st) == 0 && st.st_size > 0 ? st.st_size + 1 : 4096;
+  char *text = malloc(cap);
+  *len = 0;
+  while (1) {
+    if (*len + 1 == cap) {
+      cap *= 2;
+      text = realloc(text, cap);
+    }
+    ssize_t n = read(fd, text + *len, cap - *len - 1);
+    if (n == -1 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      break;
+    }
+    *len += n;
+  }
+  text[*len] = '\0';
+  return text;
+}
+
+int runRcFile() {
+  const char *home = getenv("HOME");
+  if (home == NULL) {
+    return 0;
+  }
+  char *path = malloc(strlen(home) + strlen(RC_FILE) + strlen(SNAPSHOT_SUFFIX) + 2);
+  sprintf(path, "%s/%s", home, RC_FILE);
+
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  struct stat rc;
+  if (fd == -1 || fstat(fd, &rc) == -1) {
+    if (fd != -1) {
+      close(fd);
+    }
+    free(path);
+    return 0;
+  }
+  size_t len;
+  char *text = readFile(fd, &len);
+  close(fd);
+  uint64_t hash = hashText(text, len);
+
+  char *snapshot = malloc(strlen(path) + strlen(SNAPSHOT_SUFFIX) + 1);
+  sprintf(snapshot, "%s%s", path, SNAPSHOT_SUFFIX);
+
+  // Only an rc file that changed since the snapshot goes through the parser
+  program_t *prog = loadSnapshot(snapshot, &rc, hash);
+  if (prog == NULL) {
+    line_source_t lines = { -1, text, NULL };
+    vect_t *tokens = readScript(&lines);
+    uint64_t start = statClock();
+    int incomplete = 0;
+    prog = compileScript(tokens, &incomplete);
+    countSince(STAT_NS_PARSE, start);
+    vect_delete(tokens);
+
+    if (prog == NULL && incomplete) {
+      fprintf(stderr, "%s: syntax error: unexpected end of file\n", path);
+    }
+    if (prog != NULL) {
+      saveSnapshot(snapshot, prog, &rc, hash);
+    }
+  }
+  free(text);
+  free(snapshot);
+  free(path);
+  if (prog == NULL) {
+    return 2;
+  }
+
+  int result = runProgram(prog, 0);
+  program_delete(prog);
+  return result;
+}
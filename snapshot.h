@@ -0,0 +1,53 @@
+#ifndef _SNAPSHOT_H
+#define _SNAPSHOT_H
+
+#include <stdint.h>
+#include <sys/stat.h>
+
+#include "script.h"
+
+/** File in $HOME an interactive shell runs before its first prompt. */
+#define RC_FILE ".minishellrc"
+
+/** Added to the rc file's path to name its snapshot. */
+#define SNAPSHOT_SUFFIX ".snap"
+
+/** First bytes of every snapshot. */
+#define SNAPSHOT_MAGIC "MSHSNAP"
+
+/** Format of the snapshot. Bump it whenever the layout, the instructions
+ *  or what the compiler emits changes, so old snapshots are rebuilt. */
+#define SNAPSHOT_VERSION 2
+
+/** Start of a snapshot. The rc file it was made from has to have the same
+ *  size, mtime and hash for it to be used. */
+typedef struct snapshot_header {
+  char magic[8];
+  uint32_t version;
+  uint32_t slots;        /* Loop slots of the program. */
+  uint32_t size;         /* Instructions in the program. */
+  uint32_t redirectSlots; /* Redirection slots of the program. */
+  uint64_t rcSize;
+  int64_t rcMtimeSec;
+  int64_t rcMtimeNsec;
+  uint64_t rcHash;       /* hashText of the rc file. */
+  uint64_t bodyLen;      /* Bytes of instructions after the header. */
+} snapshot_header_t;
+
+/** Writes the program compiled from the rc file to the snapshot at path.
+ *  It is written to a temporary file that is renamed over path, so a shell
+ *  starting at the same time never maps half a snapshot.
+ *  Returns 0, or -1 when it can't be written. */
+int saveSnapshot(const char *path, program_t *prog, const struct stat *rc, uint64_t hash);
+
+/** Maps the snapshot at path and rebuilds the program in it, without the
+ *  tokenizer or the parser. Returns NULL when there is no snapshot, or it
+ *  is from another version or another rc file, or it is damaged. */
+program_t *loadSnapshot(const char *path, const struct stat *rc, uint64_t hash);
+
+/** Runs ~/.minishellrc, from its snapshot when the snapshot is up to date,
+ *  and otherwise by compiling it and saving a new snapshot.
+ *  Returns the exit status of the rc file, 0 when there is none. */
+int runRcFile();
+
+#endif /* ifndef _SNAPSHOT_H */
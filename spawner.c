@@ -0,0 +1,542 @@
+#define _GNU_SOURCE
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+
+#include "vect.h"
+#include "parse.h"
+#include "shell.h"
+#include "stats.h"
+#include "readbuf.h"
+#include "spawner.h"
+
+extern char **environ;
+
+// The shell's end of the socketpair, -1 when there is no helper
+static int helperFd = -1;
+static pid_t helperPid = -1;
+
+// Only the process that started the helper may use it, forked children
+// share the socket and would mix up the replies
+static pid_t helperOwner = -1;
+
+// Set when the next request has to carry the shell's limits
+static int limitsChanged = 0;
+
+// The limits ulimit can change, which the helper mirrors
+static const int mirroredLimits[] = {
+  RLIMIT_CORE, RLIMIT_FSIZE, RLIMIT_NOFILE, RLIMIT_STACK,
+  RLIMIT_CPU, RLIMIT_NPROC, RLIMIT_AS
+};
+#define MIRRORED_LIMITS (sizeof(mirroredLimits) / sizeof(mirroredLimits[0]))
+
+// Fds above 2 that the shell kept for its commands, which the helper
+// can't give them
+static int *keptFds = NULL;
+static int keptCount = 0;
+static int keptCap = 0;
+
+// The payload of the last request, kept so most requests don't allocate
+static char *payload = NULL;
+static size_t payloadCap = 0;
+
+// Reads exactly len bytes, returns -1 at the end or on an error
+int readFully(int fd, void *buf, size_t len);
+
+// Sends exactly len bytes, without a SIGPIPE when the other end is gone
+int sendFully(int fd, const void *buf, size_t len);
+
+// Makes room for len bytes of payload
+char *reservePayload(char **buf, size_t *cap, size_t len);
+
+// Runs the helper until the shell closes its end, never returns
+void runHelper(int sock);
+
+// Reads the next request in the helper, with the fds it passed in fds
+// and -1 for the ones it didn't. Returns -1 when the shell is gone
+int receiveRequest(int sock, spawn_request_t *req, int *fds, char **buf, size_t *cap);
+
+// Puts the fds a command gets on 0 to 2, closing the ones it gets closed
+void useFds(const int *fds);
+
+// Turns the child of the helper into the command, never returns
+void startCommand(spawn_request_t *req, int *fds, char *buf);
+
+// Sends the command to the helper with the fds it gets as 0 to 2
+// Returns -1 when nothing reached the helper, -2 when only part did
+int sendRequest(vect_t *tokens, const int *fds);
+
+// Forks the command from the shell, for when the helper is gone
+int forkProgram(vect_t *tokens, const int *fds);
+
+// Reads exactly len bytes, returns -1 at the end or on an error
+int readFully(int fd, void *buf, size_t len) {
+  size_t done = 0;
+  while (done < len) {
+    ssize_t n = read(fd, (char *) buf + done, len - done);
+    if (n == -1 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return -1;
+    }
+    done += n;
+  }
+  return 0;
+}
+
+// Sends exactly len bytes, without a SIGPIPE when the other end is gone
+int sendFully(int fd, const void *buf, size_t len) {
+  size_t done = 0;
+  while (done < len) {
+    ssize_t n = send(fd, (const char *) buf + done, len - done, MSG_NOSIGNAL);
+    if (n == -1 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return -1;
+    }
+    done += n;
+  }
+  return 0;
+}
+
+// Makes room for len bytes of payload
+char *reservePayload(char **buf, size_t *cap, size_t len) {
+  if (len > *cap) {
+    size_t grown = *cap == 0 ? 4096 : *cap;
+    while (grown < len) {
+      grown *= 2;
+    }
+    char *bigger = realloc(*buf, grown);
+    if (bigger == NULL) {
+      return NULL;
+    }
+    *buf = bigger;
+    *cap = grown;
+  }
+  return *buf;
+}
+
+int startSpawnHelper() {
+  const char *enabled = getenv(SPAWN_HELPER_ENV);
+  if (enabled == NULL || strcmp(enabled, "1") != 0 || helperFd != -1) {
+    return -1;
+  }
+
+  int pair[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, pair) == -1) {
+    perror("spawn helper: socketpair");
+    return -1;
+  }
+
+  pid_t pid = countedFork();
+  if (pid == 0) {
+    // The helper only writes to the fds it is given, so a reader of the
+    // shell's output sees the end as soon as the shell exits
+    close(pair[0]);
+    int null = open("/dev/null", O_RDWR);
+    for (int fd = 0; fd < 3; fd++) {
+      dup2(null, fd);
+    }
+    if (null > 2) {
+      close(null);
+    }
+    runHelper(pair[1]);
+  }
+  close(pair[1]);
+  if (pid < 0) {
+    perror("spawn helper: fork");
+    close(pair[0]);
+    return -1;
+  }
+
+  helperFd = fcntl(pair[0], F_DUPFD_CLOEXEC, SPAWN_HELPER_MIN_FD);
+  close(pair[0]);
+  helperPid = pid;
+  helperOwner = getpid();
+  if (helperFd == -1) {
+    countedWaitpid(helperPid, NULL, 0);
+    return -1;
+  }
+  return 0;
+}
+
+void stopSpawnHelper() {
+  if (helperFd == -1) {
+    return;
+  }
+
+  // The helper exits once it sees the end of the socket
+  close(helperFd);
+  helperFd = -1;
+  if (getpid() == helperOwner) {
+    countedWaitpid(helperPid, NULL, 0);
+  }
+}
+
+int canSpawn(cmd_t *cmd) {
+  if (helperFd == -1 || getpid() != helperOwner) {
+    return 0;
+  }
+  for (redir_t *redir = cmd->redirs; redir != NULL; redir = redir->next) {
+    if (redir->fd > 2) {
+      return 0;
+    }
+  }
+  if (fansOut(cmd)) {
+    return 0;
+  }
+
+  // Kept fds that were closed since, or whose number was reused by a
+  // close-on-exec fd, no longer reach commands
+  int kept = 0;
+  for (int i = 0; i < keptCount; i++) {
+    int flags = fcntl(keptFds[i], F_GETFD);
+    if (flags != -1 && !(flags & FD_CLOEXEC)) {
+      keptFds[kept++] = keptFds[i];
+    }
+  }
+  keptCount = kept;
+  return keptCount == 0;
+}
+
+void spawnFdKept(int fd) {
+  for (int i = 0; i < keptCount; i++) {
+    if (keptFds[i] == fd) {
+      return;
+    }
+  }
+  if (keptCount == keptCap) {
+    keptCap = keptCap == 0 ? 4 : keptCap * 2;
+    keptFds = realloc(keptFds, keptCap * sizeof(int));
+  }
+  keptFds[keptCount++] = fd;
+}
+
+void spawnLimitsChanged() {
+  limitsChanged = 1;
+}
+
+// Runs the helper until the shell closes its end, never returns
+void runHelper(int sock) {
+  spawn_request_t req;
+  int fds[3];
+  char *buf = NULL;
+  size_t cap = 0;
+
+  while (receiveRequest(sock, &req, fds, &buf, &cap) == 0) {
+    // Limits are set in the helper itself so every later command has them
+    spawn_limit_t *limits = (spawn_limit_t *) buf;
+    for (uint32_t i = 0; i < req.limits; i++) {
+      struct rlimit rl = { limits[i].cur, limits[i].max };
+      setrlimit(limits[i].resource, &rl);
+    }
+
+    pid_t pid = countedFork();
+    if (pid == 0) {
+      startCommand(&req, fds, buf);
+    }
+
+    spawn_reply_t reply;
+    int wstatus = 0;
+    if (pid < 0) {
+      char failed[] = "Error - fork failed\n";
+      if (fds[2] != -1) {
+	assert(write(fds[2], failed, strlen(failed)) == strlen(failed));
+      }
+      wstatus = W_EXITCODE(1, 0);
+    }
+    for (int fd = 0; fd < 3; fd++) {
+      if (fds[fd] != -1) {
+	close(fds[fd]);
+      }
+    }
+
+    if (pid > 0) {
+      countStat(STAT_HELPER_SPAWNS, 1);
+      reply.type = SPAWN_STARTED;
+      reply.value = pid;
+      if (sendFully(sock, &reply, sizeof(reply)) == -1) {
+	break;
+      }
+      countedWaitpid(pid, &wstatus, 0);
+    }
+    reply.type = SPAWN_EXITED;
+    reply.value = wstatus;
+    if (sendFully(sock, &reply, sizeof(reply)) == -1) {
+      break;
+    }
+  }
+  _exit(0);
+}
+
+// Reads the next request in the helper, with the fds it passed in fds
+// and -1 for the ones it didn't. Returns -1 when the shell is gone
+int receiveRequest(int sock, spawn_request_t *req, int *fds, char **buf, size_t *cap) {
+  char control[CMSG_SPACE(3 * sizeof(int))];
+  struct iovec iov = { req, sizeof(*req) };
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+
+  ssize_t n;
+  while ((n = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC)) == -1 && errno == EINTR) {
+  }
+  if (n <= 0) {
+    return -1;
+  }
+
+  // The fds come in the order of the bits that are set
+  int passed[3];
+  int count = 0;
+  for (struct cmsghdr *c = CMSG_FIRSTHDR(&msg); c != NULL; c = CMSG_NXTHDR(&msg, c)) {
+    if (c->cmsg_level == SOL_SOCKET && c->cmsg_type == SCM_RIGHTS) {
+      count = (c->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+      memcpy(passed, CMSG_DATA(c), count * sizeof(int));
+    }
+  }
+
+  // Only the first bytes of the request carry the fds
+  int bad = n < sizeof(*req) && readFully(sock, (char *) req + n, sizeof(*req) - n) == -1;
+  int next = 0;
+  for (int fd = 0; fd < 3; fd++) {
+    fds[fd] = (req->fds & (1u << fd)) && next < count ? passed[next++] : -1;
+  }
+  bad = bad || next != count || req->argc == 0 || req->len > SPAWN_MAX_PAYLOAD
+    || (uint64_t) req->limits * sizeof(spawn_limit_t) > req->len
+    || reservePayload(buf, cap, req->len + 1) == NULL
+    || readFully(sock, *buf, req->len) == -1;
+  if (bad) {
+    for (int i = 0; i < count; i++) {
+      close(passed[i]);
+    }
+    return -1;
+  }
+  (*buf)[req->len] = '\0';
+  return 0;
+}
+
+// Puts the fds a command gets on 0 to 2, closing the ones it gets closed
+// They are copied above 2 first so putting one in place can't replace
+// another, and the copies are close-on-exec while 0 to 2 aren't
+void useFds(const int *fds) {
+  int copies[3];
+  for (int fd = 0; fd < 3; fd++) {
+    copies[fd] = fds[fd] == -1 ? -1 : fcntl(fds[fd], F_DUPFD_CLOEXEC, 3);
+  }
+  for (int fd = 0; fd < 3; fd++) {
+    if (copies[fd] == -1) {
+      close(fd);
+    }
+    else {
+      dup2(copies[fd], fd);
+    }
+  }
+}
+
+// Turns the child of the helper into the command, never returns
+void startCommand(spawn_request_t *req, int *fds, char *buf) {
+  useFds(fds);
+
+  // Every string ends in a NUL and the payload has one past its end, so
+  // a short payload only leaves the last words empty
+  char *end = buf + req->len;
+  char *p = buf + req->limits * sizeof(spawn_limit_t);
+  char *cwd = p;
+  p += strlen(p) + 1;
+  char **args = malloc((req->argc + 1) * sizeof(char *));
+  char **envp = malloc((req->envc + 1) * sizeof(char *));
+  for (uint32_t i = 0; i < req->argc; i++) {
+    args[i] = p < end ? p : "";
+    p += p < end ? strlen(p) + 1 : 0;
+  }
+  for (uint32_t i = 0; i < req->envc; i++) {
+    envp[i] = p < end ? p : "";
+    p += p < end ? strlen(p) + 1 : 0;
+  }
+  args[req->argc] = NULL;
+  envp[req->envc] = NULL;
+
+  if (chdir(cwd) == -1) {
+    perror("spawn helper: cd");
+    _exit(126);
+  }
+
+  // Same as execProgram, the command has to be in /bin
+  char *name = args[0];
+  char *executable = malloc(strlen("/bin/") + strlen(name) + 1);
+  strcpy(executable, "/bin/");
+  strcat(executable, name);
+  args[0] = executable;
+  countStat(STAT_EXECS, 1);
+  execve(executable, args, envp);
+  countStat(STAT_EXEC_FAILURES, 1);
+
+  char *notFound = malloc(strlen(" : command not found\n") + strlen(name) + 1);
+  strcpy(notFound, name);
+  strcat(notFound, " : command not found\n");
+  assert(write(1, notFound, strlen(notFound)) == strlen(notFound));
+  _exit(127);
+}
+
+// Sends the command to the helper with the fds it gets as 0 to 2
+// Returns -1 when nothing reached the helper, -2 when only part did
+int sendRequest(vect_t *tokens, const int *fds) {
+  char *cwd = getcwd(NULL, 0);
+  if (cwd == NULL) {
+    return -1;
+  }
+
+  spawn_request_t req;
+  memset(&req, 0, sizeof(req));
+  req.argc = vect_size(tokens);
+  req.limits = limitsChanged ? MIRRORED_LIMITS : 0;
+  size_t len = req.limits * sizeof(spawn_limit_t) + strlen(cwd) + 1;
+  for (int i = 0; i < vect_size(tokens); i++) {
+    len += strlen(vect_get(tokens, i)) + 1;
+  }
+  for (char **env = environ; *env != NULL; env++) {
+    len += strlen(*env) + 1;
+    req.envc++;
+  }
+  req.len = len;
+  if (reservePayload(&payload, &payloadCap, len) == NULL) {
+    free(cwd);
+    return -1;
+  }
+
+  // The payload is the limits, then the strings one after another
+  char *p = payload;
+  for (uint32_t i = 0; i < req.limits; i++) {
+    spawn_limit_t limit;
+    struct rlimit rl;
+    memset(&limit, 0, sizeof(limit));
+    getrlimit(mirroredLimits[i], &rl);
+    limit.resource = mirroredLimits[i];
+    limit.cur = rl.rlim_cur;
+    limit.max = rl.rlim_max;
+    memcpy(p, &limit, sizeof(limit));
+    p += sizeof(limit);
+  }
+  size_t n = strlen(cwd) + 1;
+  memcpy(p, cwd, n);
+  p += n;
+  free(cwd);
+  for (int i = 0; i < vect_size(tokens); i++) {
+    n = strlen(vect_get(tokens, i)) + 1;
+    memcpy(p, vect_get(tokens, i), n);
+    p += n;
+  }
+  for (char **env = environ; *env != NULL; env++) {
+    n = strlen(*env) + 1;
+    memcpy(p, *env, n);
+    p += n;
+  }
+
+  // A closed fd can't be passed, so it is left out of the bits
+  int passed[3];
+  int count = 0;
+  for (int fd = 0; fd < 3; fd++) {
+    if (fds[fd] != -1) {
+      req.fds |= 1u << fd;
+      passed[count++] = fds[fd];
+    }
+  }
+
+  char control[CMSG_SPACE(3 * sizeof(int))];
+  memset(control, 0, sizeof(control));
+  struct iovec iov = { &req, sizeof(req) };
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  if (count > 0) {
+    msg.msg_control = control;
+    msg.msg_controllen = CMSG_SPACE(count * sizeof(int));
+    struct cmsghdr *c = CMSG_FIRSTHDR(&msg);
+    c->cmsg_level = SOL_SOCKET;
+    c->cmsg_type = SCM_RIGHTS;
+    c->cmsg_len = CMSG_LEN(count * sizeof(int));
+    memcpy(CMSG_DATA(c), passed, count * sizeof(int));
+  }
+
+  ssize_t sent;
+  while ((sent = sendmsg(helperFd, &msg, MSG_NOSIGNAL)) == -1 && errno == EINTR) {
+  }
+  if (sent <= 0) {
+    return -1;
+  }
+  if (sendFully(helperFd, (char *) &req + sent, sizeof(req) - sent) == -1
+      || sendFully(helperFd, payload, len) == -1) {
+    return -2;
+  }
+  limitsChanged = 0;
+  return 0;
+}
+
+// Forks the command from the shell, for when the helper is gone
+int forkProgram(vect_t *tokens, const int *fds) {
+  int pid = countedFork();
+  if (pid == 0) {
+    useFds(fds);
+    execProgram(tokens);
+  }
+  else if (pid < 0) {
+    perror("Error - fork failed");
+    return 1;
+  }
+
+  int wstatus = 0;
+  countedWaitpid(pid, &wstatus, 0);
+  return exitStatus(wstatus);
+}
+
+int spawnProgram(vect_t *tokens, std_fds_t *std) {
+  // The command starts reading files where the read built in stopped
+  returnReadAhead();
+  int sent = helperFd == -1 ? -1 : sendRequest(tokens, std->fds);
+  if (sent == -1) {
+    stopSpawnHelper();
+    return forkProgram(tokens, std->fds);
+  }
+
+  // The helper may have the start of the request, so forking the command
+  // here as well could run it twice
+  if (sent == -2) {
+    fprintf(stderr, "spawn helper: could not send %s\n", vect_get(tokens, 0));
+    stopSpawnHelper();
+    return 1;
+  }
+
+  spawn_reply_t reply;
+  pid_t pid = -1;
+  while (readFully(helperFd, &reply, sizeof(reply)) == 0) {
+    if (reply.type == SPAWN_STARTED) {
+      pid = reply.value;
+    }
+    else if (reply.type == SPAWN_EXITED) {
+      return exitStatus(reply.value);
+    }
+  }
+
+  // A helper that went away before forking never ran the command
+  stopSpawnHelper();
+  if (pid == -1) {
+    return forkProgram(tokens, std->fds);
+  }
+  fprintf(stderr, "spawn helper: lost %s, pid %d\n", vect_get(tokens, 0), pid);
+  return 1;
+}
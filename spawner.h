@@ -0,0 +1,88 @@
+#ifndef _SPAWNER_H
+#define _SPAWNER_H
+
+#include <stdint.h>
+
+#include "vect.h"
+#include "parse.h"
+#include "redirect.h"
+
+/**
+ * Protocol between the shell and its spawn helper, over a Unix socketpair.
+ *
+ * A request is a spawn_request_t with the fds it passes attached as
+ * SCM_RIGHTS, followed by its payload: limits spawn_limit_t entries, then
+ * the working directory, the argc words of the command and the envc
+ * entries of the environment, each ending in a NUL. The helper answers
+ * with a SPAWN_STARTED reply holding the pid once the command is forked,
+ * and a SPAWN_EXITED reply holding its wait status once it is done.
+ */
+#define SPAWN_STARTED 'S'
+#define SPAWN_EXITED  'X'
+
+/** Environment variable that starts the helper when it is 1. */
+#define SPAWN_HELPER_ENV "MINISHELL_SPAWN_HELPER"
+
+/** Lowest fd the shell keeps its end of the socketpair on, out of the way
+ *  of the fds that scripts redirect and of the redirection backups. */
+#define SPAWN_HELPER_MIN_FD 50
+
+/** Largest payload the helper accepts in a request. */
+#define SPAWN_MAX_PAYLOAD (16 * 1024 * 1024)
+
+/** Start of a request. */
+typedef struct spawn_request {
+  uint32_t argc;
+  uint32_t envc;
+  uint32_t fds;          /* Bit n is set when fd n is attached, 0 to 2. */
+  uint32_t limits;       /* spawn_limit_t entries at the start of the payload. */
+  uint64_t len;          /* Bytes of payload after the request. */
+} spawn_request_t;
+
+/** A resource limit the helper takes on so its commands inherit it. */
+typedef struct spawn_limit {
+  uint32_t resource;
+  uint32_t unused;
+  uint64_t cur;
+  uint64_t max;
+} spawn_limit_t;
+
+/** What the helper sends back about a request. */
+typedef struct spawn_reply {
+  uint32_t type;         /* SPAWN_STARTED or SPAWN_EXITED. */
+  int32_t value;         /* The pid, or the wait status. */
+} spawn_reply_t;
+
+/** Forks the spawn helper when SPAWN_HELPER_ENV is 1. Call it at startup
+ *  while the shell is still small, since the helper forks every command it
+ *  is sent and never grows. Returns 0, or -1 when it isn't running. */
+int startSpawnHelper();
+
+/** Stops the helper, so every command is forked by the shell again. */
+void stopSpawnHelper();
+
+/** Checks if the helper can start the simple command: it is running, this
+ *  is the process that started it, the command only redirects fds 0 to 2,
+ *  the fds it is given, none of them fans out, and the shell has no fd
+ *  kept by spawnFdKept open for it to inherit. */
+int canSpawn(cmd_t *cmd);
+
+/** Notes that the shell keeps fd for its commands, like exec 3> file does.
+ *  The helper can't pass it on, so canSpawn refuses commands while it is
+ *  open and inherited. */
+void spawnFdKept(int fd);
+
+/** Tells the helper to take on the shell's resource limits before it
+ *  starts the next command, after ulimit changed one. */
+void spawnLimitsChanged();
+
+/** Starts the program in /bin like execProgram, from the helper, with std
+ *  as its fds 0 to 2 and the shell's working directory and environment,
+ *  and waits for it. If the helper can't be sent the request at all, or is
+ *  gone before it reads any of it, the shell forks the command itself.
+ *  A request that was only partly sent is reported and not run again.
+ *  The helper's children aren't the shell's, so their CPU time isn't in
+ *  the shell's RUSAGE_CHILDREN. Returns the exit status of the command. */
+int spawnProgram(vect_t *tokens, std_fds_t *std);
+
+#endif /* ifndef _SPAWNER_H */
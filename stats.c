@@ -0,0 +1,143 @@
+#define _GNU_SOURCE
+#include <assert.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "vect.h"
+#include "stats.h"
+
+// Names of the counters, in the order of stat_t
+static const char *statNames[STAT_COUNT] = {
+  "lines_read",
+  "bytes_tokenized",
+  "tokens",
+  "vect_allocs",
+  "vect_reallocs",
+  "forks",
+  "execs",
+  "exec_failures",
+  "waits",
+  "redirections",
+  "builtin_calls",
+  "helper_spawns",
+  "ns_tokenize",
+  "ns_parse",
+  "ns_expand",
+  "ns_wait"
+};
+
+static uint64_t localCounters[STAT_COUNT];
+static uint64_t *counters = localCounters;
+
+void initStats() {
+  if (counters != localCounters) {
+    return;
+  }
+
+  uint64_t *shared = mmap(NULL, sizeof(localCounters), PROT_READ | PROT_WRITE,
+			  MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (shared == MAP_FAILED) {
+    return;
+  }
+  memcpy(shared, localCounters, sizeof(localCounters));
+  counters = shared;
+}
+
+// Children update the counters at the same time as the shell, so the
+// adds are atomic
+void countStat(stat_t stat, uint64_t n) {
+  __atomic_fetch_add(&counters[stat], n, __ATOMIC_RELAXED);
+}
+
+uint64_t statClock() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t) now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+void countSince(stat_t stat, uint64_t start) {
+  countStat(stat, statClock() - start);
+}
+
+void resetStats() {
+  for (int i = 0; i < STAT_COUNT; i++) {
+    __atomic_store_n(&counters[i], 0, __ATOMIC_RELAXED);
+  }
+}
+
+pid_t countedFork() {
+  pid_t pid = fork();
+  if (pid > 0) {
+    countStat(STAT_FORKS, 1);
+  }
+  return pid;
+}
+
+pid_t countedWaitpid(pid_t pid, int *wstatus, int options) {
+  return countedWait4(pid, wstatus, options, NULL);
+}
+
+pid_t countedWait4(pid_t pid, int *wstatus, int options, struct rusage *usage) {
+  uint64_t start = statClock();
+  pid_t result;
+  while ((result = wait4(pid, wstatus, options, usage)) == -1 && errno == EINTR) {
+  }
+  if (result > 0) {
+    countStat(STAT_WAITS, 1);
+  }
+  countSince(STAT_NS_WAIT, start);
+  return result;
+}
+
+int shellStatCmd(vect_t *tokens) {
+  int json = 0;
+  int reset = 0;
+  for (int i = 1; i < vect_size(tokens); i++) {
+    if (strcmp(vect_get(tokens, i), "-j") == 0) {
+      json = 1;
+    }
+    else if (strcmp(vect_get(tokens, i), "-r") == 0) {
+      reset = 1;
+    }
+    else {
+      char usage[] = "usage: shellstat [-j] [-r]\n";
+      assert(write(2, usage, strlen(usage)) == strlen(usage));
+      return 1;
+    }
+  }
+
+  // Every counter is read first so the output is one consistent write
+  char out[STAT_COUNT * 48 + 8];
+  int len = 0;
+  if (json) {
+    len += snprintf(out + len, sizeof(out) - len, "{");
+  }
+  for (int i = 0; i < STAT_COUNT; i++) {
+    uint64_t value = __atomic_load_n(&counters[i], __ATOMIC_RELAXED);
+    if (json) {
+      len += snprintf(out + len, sizeof(out) - len, "%s\"%s\": %llu",
+		      i > 0 ? ", " : "", statNames[i], (unsigned long long) value);
+    }
+    else {
+      len += snprintf(out + len, sizeof(out) - len, "%s %llu\n",
+		      statNames[i], (unsigned long long) value);
+    }
+  }
+  if (json) {
+    len += snprintf(out + len, sizeof(out) - len, "}\n");
+  }
+  assert(write(1, out, len) == len);
+
+  if (reset) {
+    resetStats();
+  }
+  return 0;
+}
@@ -0,0 +1,68 @@
+#ifndef _STATS_H
+#define _STATS_H
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/resource.h>
+
+#include "vect.h"
+
+/** The counters the shell keeps about itself. The STAT_NS_ ones are the
+ *  nanoseconds spent in a phase. Phases nest, so the time of a command
+ *  substitution counts in the expand phase and in the phases it runs. */
+typedef enum {
+  STAT_LINES,            /* Lines read from the terminal, scripts and here-documents. */
+  STAT_BYTES_TOKENIZED,
+  STAT_TOKENS,
+  STAT_VECT_ALLOCS,
+  STAT_VECT_REALLOCS,    /* Times a vect_t had to grow. */
+  STAT_FORKS,
+  STAT_EXECS,
+  STAT_EXEC_FAILURES,
+  STAT_WAITS,
+  STAT_REDIRECTIONS,
+  STAT_BUILTINS,
+  STAT_HELPER_SPAWNS,    /* Commands the spawn helper forked. */
+  STAT_NS_TOKENIZE,
+  STAT_NS_PARSE,
+  STAT_NS_EXPAND,
+  STAT_NS_WAIT,          /* Time spent waiting for children. */
+  STAT_COUNT
+} stat_t;
+
+/** Moves the counters to memory shared with every child the shell forks
+ *  from now on, so the execs they do are counted too. Call it once before
+ *  the first fork. Until then the counters are private to the process. */
+void initStats();
+
+/** Adds n to the counter. */
+void countStat(stat_t stat, uint64_t n);
+
+/** Returns the monotonic clock in nanoseconds, to time a phase with. */
+uint64_t statClock();
+
+/** Adds the nanoseconds since start, from statClock, to the counter. */
+void countSince(stat_t stat, uint64_t start);
+
+/** Sets every counter back to 0. */
+void resetStats();
+
+/** fork, counted. */
+pid_t countedFork();
+
+/** waitpid, counted along with the time spent waiting. EINTR is retried. */
+pid_t countedWaitpid(pid_t pid, int *wstatus, int options);
+
+/** wait4, counted like countedWaitpid, for when the rusage of the child is
+ *  needed. usage may be NULL. */
+pid_t countedWait4(pid_t pid, int *wstatus, int options, struct rusage *usage);
+
+/** Runs the shellstat built in:
+ *
+ *    shellstat [-j] [-r]
+ *
+ *  Prints every counter, one "name value" per line or as a JSON object
+ *  with -j. -r sets the counters back to 0 after printing them. */
+int shellStatCmd(vect_t *tokens);
+
+#endif /* ifndef _STATS_H */
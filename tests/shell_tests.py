@@ -9,6 +9,8 @@ import sys
 import subprocess
 import random
 import re
+import json
+import time
 
 from shell_test_helpers import *
 
@@ -105,6 +107,469 @@ class ShellTests(ShellTestCase):
         actual = self.run_shell(script)
         self.assertEqual(actual, "one\ntwo\nthree")
 
+    def test10(self):
+        """ Command substitution works """
+        actual = self.run_shell("echo $(echo one two)\necho a`echo b`c")
+        self.assertEqual(actual, "one two\nabc")
+
+    def test11(self):
+        """ Nested command substitution works """
+        actual = self.run_shell("echo $(echo $(echo inner))")
+        self.assertEqual(actual, "inner")
+
+    def test12(self):
+        """ cat copies through redirections and pipes """
+        sh('rm -f tmp/copy_in tmp/copy_out')
+        script = \
+            "seq 1 20000 > tmp/copy_in\n"\
+            "cat < tmp/copy_in > tmp/copy_out\n"\
+            "cat tmp/copy_out | wc -l\n"
+        actual = self.run_shell(script)
+        self.assertEqual(actual, "20000")
+        self.assertEqual(sh('cmp tmp/copy_in tmp/copy_out && echo same'), "same")
+        sh('rm -f tmp/copy_in tmp/copy_out')
+
+    def test13(self):
+        """ for loops and if statements work """
+        script = \
+            "for x in a b; do if [ $x = a ]; then echo first $x; else echo other $x; fi; done"
+        actual = self.run_shell(script)
+        self.assertEqual(actual, "first a\nother b")
+
+    def test14(self):
+        """ while loops work in a sourced script and $? is set """
+        with open("tmp/loop_script", "w") as f:
+            f.write("i=0\n"
+                    "while [ $i != 3 ]\n"
+                    "do\n"
+                    "  echo $i\n"
+                    "  i=$(expr $i + 1)\n"
+                    "done\n"
+                    "false\n"
+                    "echo $?\n")
+        actual = self.run_shell("source tmp/loop_script")
+        self.assertEqual(actual, "0\n1\n2\n1")
+        sh('rm -f tmp/loop_script')
+
+    def test15(self):
+        """ $(( )) and let evaluate arithmetic """
+        script = \
+            "x=6\n"\
+            "echo $(( x * 7 )) $((1 + 2 * 3)) $((x > 3 ? 10 : 20))\n"\
+            "let i=0\n"\
+            "while [ $i -lt 4 ]; do let i++; done\n"\
+            "echo $i\n"
+        actual = self.run_shell(script)
+        self.assertEqual(actual, "42 7 10\n4")
+
+    def test16(self):
+        """ Server mode runs requests from the client """
+        sock = "tmp/test_server.sock"
+        server = subprocess.Popen([SHELL, "--server", sock])
+        try:
+            for _ in range(50):
+                if os.path.exists(sock):
+                    break
+                subprocess.run(["sleep", "0.05"])
+            rc, output = execute("./client", sock, "-e", "WHO=server", "--",
+                                 "echo hello $WHO; false")
+            self.assertEqual(output, "hello server")
+            self.assertEqual(rc, 1)
+
+            # A command that runs on after closing its outputs doesn't hold
+            # up the other clients
+            slow = subprocess.Popen(["./client", sock, "--",
+                                     "exec > /dev/null 2> /dev/null; sleep 1"])
+            subprocess.run(["sleep", "0.2"])
+            start = time.monotonic()
+            rc, output = execute("./client", sock, "--", "echo fast")
+            elapsed = time.monotonic() - start
+            self.assertEqual(slow.wait(), 0)
+            self.assertEqual(output, "fast")
+            self.assertLess(elapsed, 0.5)
+        finally:
+            server.kill()
+            server.wait()
+            sh('rm -f ' + sock)
+
+    def test17(self):
+        """ && and || skip the right side based on the exit status """
+        script = \
+            "false && echo skipped || echo recovered\n"\
+            "true && echo a && echo b\n"\
+            "false || false && echo skipped\n"\
+            "echo $?\n"\
+            "echo x | grep -q y && echo skipped; echo $?\n"
+        actual = self.run_shell(script)
+        self.assertEqual(actual, "recovered\na\nb\n1\n1")
+
+    def test18(self):
+        """ -c execs the last command in place of the shell """
+        exe = subprocess.Popen([SHELL, "-c", "echo a | head -n 1 /proc/self/stat"],
+                               stdout = subprocess.PIPE)
+        out = try_decode(exe.communicate(timeout = 2)[0])
+        self.assertEqual(out.split()[0], str(exe.pid))
+
+        rc, output = execute(SHELL, "-c", "true && ls tmp/no_such_file")
+        self.assertNotEqual(rc, 0)
+
+    def test19(self):
+        """ A script file runs without a prompt and exec > file redirects the shell """
+        sh('mkdir -p tmp; rm -f tmp/exec_out')
+        with open("tmp/exec_script", "w") as f:
+            f.write("echo before\n"
+                    "exec > tmp/exec_out\n"
+                    "echo after\n"
+                    "exec echo last\n")
+        rc, output = execute(SHELL, "tmp/exec_script")
+        self.assertEqual(output, "before")
+        self.assertEqual(sh("cat tmp/exec_out"), "after\nlast")
+        sh('rm -f tmp/exec_out tmp/exec_script')
+
+    def test20(self):
+        """ xargs packs as many items into each command as fit """
+        script = \
+            "seq 1 5000 | xargs echo | wc -l\n"\
+            "seq 1 5 | xargs -n 2 echo n\n"\
+            "seq 1 100 | xargs -P 4 -n 10 echo | wc -w\n"
+        actual = self.run_shell(script)
+        self.assertEqual(actual, "1\nn 1 2\nn 3 4\nn 5\n100")
+
+    def test21(self):
+        """ >>, 2>, 2>&1 and &> redirect in the child """
+        sh('mkdir -p tmp; rm -f tmp/redir_*')
+        script = \
+            "echo one > tmp/redir_a\n"\
+            "echo two >> tmp/redir_a\n"\
+            "cat tmp/redir_a\n"\
+            "ls tmp/no_such_file 2> tmp/redir_err\n"\
+            "cat tmp/redir_err | wc -l\n"\
+            "ls tmp/no_such_file tmp/redir_a > tmp/redir_both 2>&1\n"\
+            "cat tmp/redir_both | wc -l\n"\
+            "ls tmp/no_such_file &> tmp/redir_all\n"\
+            "cat tmp/redir_all | wc -l\n"\
+            "echo lost > tmp/no_dir/file\n"\
+            "echo $?\n"
+        actual = self.run_shell(script)
+        sh('rm -f tmp/redir_*')
+        self.assertEqual(actual, "one\ntwo\n1\n2\n1\n"
+                         "tmp/no_dir/file: No such file or directory\n1")
+
+    def test22(self):
+        """ Several output files on one command all get the output """
+        sh('mkdir -p tmp; rm -f tmp/multi_*')
+        script = \
+            "echo hello > tmp/multi_a > tmp/multi_b | tr a-z A-Z\n"\
+            "cat tmp/multi_a tmp/multi_b\n"\
+            "seq 1 50000 > tmp/multi_c >> tmp/multi_d\n"\
+            "cat tmp/multi_c | wc -l\n"\
+            "cat tmp/multi_d | wc -l\n"
+        actual = self.run_shell(script)
+        sh('rm -f tmp/multi_*')
+        self.assertEqual(actual, "HELLO\nhello\nhello\n50000\n50000")
+
+    def test23(self):
+        """ Here-documents and here-strings feed stdin without temporary files """
+        sh('mkdir -p tmp')
+        with open("tmp/heredoc_script", "w") as f:
+            f.write("name=world\n"
+                    "cat <<EOF\n"
+                    "hello $name\n"
+                    "EOF\n"
+                    "cat <<'EOF'\n"
+                    "hello $name\n"
+                    "EOF\n"
+                    "cat <<-EOF\n"
+                    "\t\ttabs\n"
+                    "\tEOF\n"
+                    "tr a-z A-Z <<< $name\n"
+                    "wc -c <<< \"$(seq 1 20000)\"\n")
+        rc, output = execute(SHELL, "tmp/heredoc_script")
+        sh('rm -f tmp/heredoc_script')
+        self.assertEqual(output, "hello world\nhello $name\ntabs\nWORLD\n108894")
+
+    def test24(self):
+        """ Repeated lines and substitutions come from the parse cache """
+        script = \
+            "parsecache -c\n"\
+            "echo same\n"\
+            "echo same\n"\
+            "for i in 1 2 3; do x=$(echo $i); done\n"\
+            "echo $x\n"\
+            "parsecache\n"
+        actual = self.run_shell(script)
+        self.assertEqual(actual, "same\nsame\n3\nhits: 3\nmisses: 5\nlines: 5/64")
+
+    def test25(self):
+        """ shellstat counts forks, execs and builtins, and can reset them """
+        sh('mkdir -p tmp')
+        script = \
+            "shellstat -r > /dev/null\n"\
+            "echo one | cat\n"\
+            "nosuchcmd\n"\
+            "shellstat > tmp/stat_text\n"\
+            "shellstat -j > tmp/stat_json\n"\
+            "grep -e ^forks -e ^execs -e ^exec_failures -e ^builtin tmp/stat_text\n"
+        actual = self.run_shell(script)
+        with open("tmp/stat_json") as f:
+            stats = json.load(f)
+        sh('rm -f tmp/stat_text tmp/stat_json')
+        self.assertEqual(actual, "one\nnosuchcmd : command not found\n"
+                         "forks 3\nexecs 2\nexec_failures 1\nbuiltin_calls 1")
+        self.assertEqual(stats["exec_failures"], 1)
+        self.assertGreater(stats["ns_wait"], 0)
+
+    def test26(self):
+        """ bench times a parsed command and compares two side by side """
+        script = \
+            "x=0\n"\
+            "bench -n 4 -w 2 -- let x=$x+1 -- echo run\n"\
+            "bench -n 3\n"
+        actual = self.run_shell(script)
+        lines = actual.splitlines()
+        self.assertEqual(lines.count("run"), 6)
+        report = [line for line in lines if line != "run"]
+        self.assertEqual(report[0], "command: let x=0+1")
+        self.assertEqual(report[1], "against: echo run")
+        self.assertEqual(report[2].split(), ["runs", "4", "4"])
+        labels = [line.split(" (")[0].split()[0] for line in report[3:11]]
+        self.assertEqual(labels, ["min", "mean", "median", "p95", "stddev",
+                                  "user", "sys", "switches"])
+        for line in report[3:8]:
+            self.assertRegex(line, r"\(us\) +[0-9.]+ +[0-9.]+$")
+        self.assertTrue(report[11].startswith("median ratio"))
+        self.assertEqual(report[12], "usage: bench [-n N] [-w WARMUP] -- command [-- command]")
+
+    def test27(self):
+        """ A coprocess answers many requests through its pipes """
+        script = \
+            "coproc UP tr a-z A-Z\n"\
+            "echo hello >&${UP[1]}\n"\
+            "echo world >&${UP[1]}\n"\
+            "jobs\n"\
+            "wait UP\n"\
+            "cat <&${UP[0]}\n"\
+            "coproc ECHO cat\n"\
+            "echo ping >&${ECHO[1]}\n"\
+            "head -n 1 <&${ECHO[0]}\n"\
+            "echo pong >&${ECHO[1]}\n"\
+            "head -n 1 <&${ECHO[0]}\n"\
+            "wait\n"\
+            "jobs\n"\
+            "jobs\n"
+        actual = self.run_shell(script)
+        actual = re.sub(r"\] [0-9]+ ", "] PID ", actual)
+        self.assertEqual(actual, "[1] PID Running tr a-z A-Z\nHELLO\nWORLD\nping\npong\n"
+                         "[1] PID Done tr a-z A-Z\n[2] PID Done cat")
+
+    def test28(self):
+        """ read and mapfile share what was read ahead with the commands after them """
+        with open("read_test.txt", "w") as f:
+            f.write("a b c\n  one  two  \nrest\nlast\n")
+        script = \
+            "read x y < read_test.txt\n"\
+            "echo [$x] [$y]\n"\
+            "exec < read_test.txt\n"\
+            "read x\n"\
+            "read x y\n"\
+            "echo [$x] [$y]\n"\
+            "cat\n"\
+            "mapfile -t L < read_test.txt\n"\
+            "echo ${#L[@]} ${L[3]}\n"\
+            "read l\n"\
+            "echo $? [$l]\n"\
+            "coproc C cat\n"\
+            "echo 1 >&${C[1]}\n"\
+            "echo 2 >&${C[1]}\n"\
+            "read a <&${C[0]}\n"\
+            "read -u ${C[0]} b\n"\
+            "echo $a $b\n"\
+            "wait C\n"
+
+        # exec < points the commands of a shell reading its stdin at the file
+        # too, so the script comes from a file of its own
+        with open("read_test.sh", "w") as f:
+            f.write(script)
+        rc, actual = execute(SHELL, "read_test.sh")
+        os.remove("read_test.sh")
+        os.remove("read_test.txt")
+        self.assertEqual(rc, 0)
+        self.assertEqual(actual, "[a] [b c]\n[one] [two]\nrest\nlast\n4 last\n1 []\n1 2")
+
+    def test29(self):
+        """ ~/.minishellrc runs from its snapshot until the rc file changes """
+        home = os.path.abspath("tmp/rc_home")
+        rc = os.path.join(home, ".minishellrc")
+        sh('rm -rf ' + home + '; mkdir -p ' + home)
+        with open(rc, "w") as f:
+            f.write("GREETING=hello\nfor x in a b; do echo rc $x; done\n")
+        old_home = os.environ.get("HOME")
+        os.environ["HOME"] = home
+        try:
+            first = self.run_shell("echo $GREETING")
+
+            # An edited snapshot shows the warm start never parsed the rc
+            with open(rc + ".snap", "rb") as f:
+                snapshot = f.read()
+            with open(rc + ".snap", "wb") as f:
+                f.write(snapshot.replace(b"hello", b"HELLO"))
+            warm = self.run_shell("echo $GREETING")
+
+            # A damaged snapshot is compiled again instead of being run, here
+            # the first instruction turned into a spawn without a command
+            with open(rc + ".snap", "r+b") as f:
+                f.seek(64)
+                f.write(b"\0\0\0\0")
+            damaged = self.run_shell("echo $GREETING")
+
+            with open(rc, "w") as f:
+                f.write("GREETING=howdy\n")
+            changed = self.run_shell("echo $GREETING")
+        finally:
+            os.environ["HOME"] = old_home
+            sh('rm -rf ' + home)
+        self.assertEqual(first, "rc a\nrc b\nhello")
+        self.assertEqual(warm, "rc a\nrc b\nHELLO")
+        self.assertEqual(damaged, "rc a\nrc b\nhello")
+        self.assertEqual(changed, "howdy")
+
+    def test30(self):
+        """ limit caps only its child and says which limit tripped """
+        script = \
+            "ulimit -S -n 100\n"\
+            "limit -n 50 -- ulimit -n\n"\
+            "ulimit -n\n"\
+            "limit -t 1 -- yes > /dev/null\n"\
+            "echo $? $LIMIT_TRIPPED\n"\
+            "limit -t 10 -- true\n"\
+            "echo $? [$LIMIT_TRIPPED]\n"\
+            "limit -m 1G -n 50 -- grep nomatch /etc/hostname\n"\
+            "echo $? [$LIMIT_TRIPPED]\n"\
+            "ulimit -t\n"
+        actual = self.run_shell(script).splitlines()
+        self.assertEqual(actual[0:2], ["50", "100"])
+        self.assertRegex(actual[2], r"^limit: yes: killed by signal [0-9]+ \(.*\), "
+                         r"cpu time limit hit \(cpu [0-9.]+s of 1s, max rss [0-9.]+[KMG]\)$")
+        # An ordinary failure isn't blamed on a limit
+        self.assertEqual(actual[3:], ["152 cpu", "0 []", "1 []", "unlimited"])
+
+    def test31(self):
+        """ The spawn helper starts commands with the shell's fds, cwd and limits """
+        script = \
+            "shellstat -r > /dev/null\n"\
+            "mkdir -p tmp/spawn\n"\
+            "cd tmp/spawn\n"\
+            "sh -c \"pwd; exit 3\" > out\n"\
+            "echo $?\n"\
+            "cat < out\n"\
+            "sh -c \"echo both; echo err >&2\" > out 2>&1\n"\
+            "cat 0<&- < out\n"\
+            "ulimit -S -n 77\n"\
+            "sh -c \"ulimit -n\"\n"\
+            "nosuchcmd\n"\
+            "exec 3> /dev/null\n"\
+            "sh -c \"exit 0\"\n"\
+            "exec 3>&-\n"\
+            "cd ../..\n"\
+            "rm -r tmp/spawn\n"\
+            "shellstat | grep helper\n"
+        os.environ["MINISHELL_SPAWN_HELPER"] = "1"
+        try:
+            actual = self.run_shell(script).splitlines()
+        finally:
+            del os.environ["MINISHELL_SPAWN_HELPER"]
+        self.assertEqual(actual, ["3", os.path.abspath("tmp/spawn"), "both", "err", "77",
+                                  "nosuchcmd : command not found", "helper_spawns 7"])
+
+    def test32(self):
+        """ read takes lines from the shell's own stdin and leaves the rest """
+        sh('mkdir -p tmp; printf "a\\nb\\nc\\nd\\n" > tmp/abcd')
+        typed = self.run_shell("read x\nhello\necho x=$x\ncat\nrest1\nrest2\n")
+        seekable = sh("./shell -c 'read x; echo x=$x; head -2' < tmp/abcd")
+        piped = sh("./shell -c 'read x; xargs echo' < tmp/abcd")
+        copied = sh("cat tmp/abcd | ./shell -c 'read x; read y; cat'")
+        sh('rm -f tmp/abcd')
+        self.assertEqual(typed, "x=hello\nrest1\nrest2")
+        self.assertEqual(seekable, "x=a\nb\nc")
+        self.assertEqual(piped, "b c d")
+        self.assertEqual(copied, "c\nd")
+
+    def test33(self):
+        """ $(( )) expands its expression, reads octal, and stops the command on an error """
+        script = \
+            "echo $((1/0)); echo st=$?\n"\
+            "for i in a $((1/0)); do echo never; done\n"\
+            "echo st=$?\n"\
+            "x=3; echo $(( ${x} + 1 )) $(( $(echo 2) * x )) $((010)) $((0x10))\n"\
+            "echo $((09))\n"
+        actual = self.run_shell(script).splitlines()
+        self.assertEqual(actual, ["arithmetic: division by 0 in '1/0'", "st=1",
+                                  "arithmetic: division by 0 in '1/0'", "st=1",
+                                  "4 6 8 16", "arithmetic: invalid octal number in '09'"])
+    def test34(self):
+        """ Redirections after done and fi apply to the whole loop or if """
+        script = \
+            "mkdir -p tmp\n"\
+            "for i in 1 2; do echo $i; done > tmp/loop\n"\
+            "while read l; do echo got $l; done < tmp/loop\n"\
+            "if true; then echo err >&2\n"\
+            "fi 2> tmp/loop\n"\
+            "cat tmp/loop\n"\
+            "if prev\n"\
+            "then echo ran; fi\n"\
+            "for i in a; do echo $i; done | cat\n"\
+            "rm tmp/loop\n"
+        actual = self.run_shell(script).splitlines()
+        # Output after a continuation line follows its "> " prompt
+        self.assertEqual(actual, ["got 1", "got 2", "> err", "> There is no previous command",
+                                  "ran", "syntax error near unexpected token '|'"])
+    def test35(self):
+        """ A substitution in double quotes isn't split into words """
+        sh('mkdir -p tmp; printf "a   b\\n" > tmp/spaced')
+        script = \
+            "echo \"$(cat tmp/spaced)\" $(cat tmp/spaced)\n"\
+            "echo \"<`cat tmp/spaced`>\"\n"\
+            "cat <<< \"$(cat tmp/spaced)\"\n"\
+            "for w in \"$(cat tmp/spaced)\" $(cat tmp/spaced); do echo \"[$w]\"; done\n"\
+            "rm tmp/spaced\n"
+        actual = self.run_shell(script).splitlines()
+        self.assertEqual(actual, ["a   b a b", "<a   b>", "a   b", "[a   b]", "[a]", "[b]"])
+    def test36(self):
+        """ A failed exec only exits a shell that has no prompt """
+        actual = self.run_shell("exec nosuch\necho still here $?\n").splitlines()
+        rc, output = execute(SHELL, "-c", "exec nosuch; echo never")
+        self.assertEqual(actual, ["nosuch : command not found", "still here 127"])
+        self.assertEqual((rc, output), (127, "nosuch : command not found"))
+    def test37(self):
+        """ An assignment from a command substitution has the command's status """
+        script = \
+            "x=$(false); echo $?\n"\
+            "x=$(echo ok); echo $? $x\n"\
+            "if out=$(sh -c \"exit 3\"); then echo yes; else echo no $?; fi\n"\
+            "for i in 1; do y=$(false); echo $?; done\n"
+        actual = self.run_shell(script).splitlines()
+        self.assertEqual(actual, ["1", "0 ok", "no 3", "1"])
+    def test38(self):
+        """ An assignment takes a quoted value with spaces or variables in it """
+        script = \
+            "x=\"hello\"; echo $x\n"\
+            "x=\"a  b\"\n"\
+            "echo \"[$x]\"\n"\
+            "if true; then y=\"$x and $x\"; fi\n"\
+            "echo \"[$y]\"\n"\
+            "z=\"\"; echo [$z]\n"
+        actual = self.run_shell(script).splitlines()
+        self.assertEqual(actual, ["hello", "[a  b]", "[a  b and a  b]", "[]"])
+    def test39(self):
+        """ Nothing in single quotes is expanded and the quotes are left out """
+        script = \
+            "x=val\n"\
+            "echo '$x' a'$x'b\n"\
+            "echo 'a  b' \"it's $x\"\n"\
+            "y='$x  z'; echo \"[$y]\"\n"
+        actual = self.run_shell(script).splitlines()
+        self.assertEqual(actual, ["$x a$xb", "a  b it's val", "[$x  z]"])
+
 if __name__ == '__main__':
     print(f"-= {YELLOW}Running tests for {SHELL}{RESET} =-")
     unittest.main(testRunner = unittest.TextTestRunner(resultclass = PrettierTextTestResult))
@@ -49,6 +49,30 @@ class ShellTests(ShellTestCase):
                 sh("echo 'foo \"Lorem ipsum dolor sit amet\" < bar \"consectetur (adipiscing; >elit\"' | ./tokenize"), 
                 "foo\nLorem ipsum dolor sit amet\n<\nbar\nconsectetur (adipiscing; >elit")
 
+    def test07(self):
+        """Keeps a command substitution in one token"""
+        self.assertEqual(
+                sh("echo 'echo $(ls | wc -l) `date`' | ./tokenize"),
+                "echo\n$(ls | wc -l)\n`date`")
+
+    def test08(self):
+        """Splits && and || into their own tokens"""
+        self.assertEqual(
+                sh("echo 'make&&echo ok || echo bad' | ./tokenize"),
+                "make\n&&\necho\nok\n||\necho\nbad")
+
+    def test09(self):
+        """Keeps the fd number with a redirection operator"""
+        self.assertEqual(
+                sh("echo 'cmd 2>&1 >>log &>all 3<> rw 2 > f' | ./tokenize"),
+                "cmd\n2>&\n1\n>>\nlog\n&>\nall\n3<>\nrw\n2\n>\nf")
+
+    def test10(self):
+        """Here-document and here-string operators are single tokens"""
+        self.assertEqual(
+                sh("echo 'cat <<-EOF 2<<x <<< word' | ./tokenize"),
+                "cat\n<<-\nEOF\n2<<\nx\n<<<\nword")
+
 
 
 if __name__ == '__main__':
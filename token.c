@@ -1,9 +1,11 @@
 #include <assert.h>
+#include <ctype.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 
 #include "vect.h"
+#include "stats.h"
 
 // Tokenizes the inputs
 vect_t *parseInput(char *input);
@@ -14,6 +16,12 @@ int handle_string(int i, char *input, vect_t *output);
 // Checks if the given character is a special character
 int isSpecialChar(char c);
 
+// Copies a $(...) or `...` command substitution into the word buffer
+int handle_substitution(int i, char *input, char *buffer, int *bufferIdx);
+
+// Adds a redirection operator like >, 2>>, 2>& or &> as one token
+int handle_redirection(int i, char *input, vect_t *output, char *buffer, int *bufferIdx);
+
 // Checks if the given character is a special character
 int isSpecialChar(char c) {
   if (c == '(' || c == ')' 
@@ -26,9 +34,10 @@ int isSpecialChar(char c) {
 }
 
 vect_t *parseInput(char *input) {
+  uint64_t start = statClock();
 
   // Keeps track of the string not seperated by space
-  char *buffer = (char *) malloc(255);
+  char *buffer = (char *) malloc(strlen(input) + 1);
 
   // Keeps track of the last character within the string
   int bufferIdx = 0;
@@ -37,9 +46,46 @@ vect_t *parseInput(char *input) {
   for(int i = 0; i < strlen(input); i++){
     char curChar = input[i];
 
+    // Checks if it is a command substitution, which stays part of the current word
+    if ((curChar == '$' && input[i+1] == '(') || curChar == '`') {
+      i = handle_substitution(i, input, buffer, &bufferIdx);
+      if (i >= (int) strlen(input) - 1 && bufferIdx > 0) {
+	buffer[bufferIdx] = '\0';
+	vect_add(output, buffer);
+	bufferIdx = 0;
+      }
+      continue;
+    }
+
+    // A quoted string right after a word is part of it, like x="a b", and
+    // so is a single-quoted one anywhere. Both keep their quotes for the
+    // expansion to take out
+    if (curChar == '\'' || (curChar == '\"' && bufferIdx > 0)) {
+      buffer[bufferIdx++] = input[i++];
+      while (input[i] != '\0' && input[i] != curChar) {
+	buffer[bufferIdx++] = input[i++];
+      }
+      if (input[i] == curChar) {
+	buffer[bufferIdx++] = input[i];
+      }
+      if (i >= (int) strlen(input) - 1) {
+	buffer[bufferIdx] = '\0';
+	vect_add(output, buffer);
+	bufferIdx = 0;
+      }
+      continue;
+    }
+
+    // Checks if it is a redirection, which takes any fd number before it
+    if (curChar == '<' || curChar == '>' || (curChar == '&' && input[i+1] == '>')) {
+      i = handle_redirection(i, input, output, buffer, &bufferIdx);
+      continue;
+    }
+
     // Checks if a special case was encountered to add all the temporarily stored string into the vector
     if (bufferIdx > 0
 	&& (isSpecialChar(curChar)
+	  || (curChar == '&' && input[i+1] == '&')
 	  || (curChar == '\\' && (input[i+1] == 'n' ||  input[i+1] == 't'))
 	  || (curChar == '\"' || (curChar == '\\' && input[i+1] == '\"')) 
 	  || curChar == '\n' || curChar == '\t')) {
@@ -58,11 +104,20 @@ vect_t *parseInput(char *input) {
       vect_add(output, buffer);
     }
 
+    // && and || are tokens made of two characters
+    if ((curChar == '&' || curChar == '|') && input[i+1] == curChar) {
+      char special[3] = { curChar, curChar, '\0' };
+      vect_add(output, special);
+      i++;
+      continue;
+    }
+
     // Checks if the character on its own is a token
     if (curChar == '(' || curChar == ')'
 	|| curChar == '<' || curChar == '>'
 	|| curChar == ';'  || curChar == '|') {
-      vect_add(output, &curChar);
+      char special[2] = { curChar, '\0' };
+      vect_add(output, special);
       continue;
     }
 
@@ -88,6 +143,10 @@ vect_t *parseInput(char *input) {
   }
   
   free(buffer);
+
+  countStat(STAT_BYTES_TOKENIZED, strlen(input));
+  countStat(STAT_TOKENS, vect_size(output));
+  countSince(STAT_NS_TOKENIZE, start);
   return output;
 }
 
@@ -98,8 +157,10 @@ int handle_string(int i, char *input, vect_t *output) {
     i++;
   }
 
-  char *buffer = (char *) malloc(255 * sizeof(char*));
-  int bufferIdx = 0;
+  // The first byte is kept for the opening quote
+  char *buffer = (char *) malloc(strlen(input) + 3);
+  buffer[0] = '\"';
+  int bufferIdx = 1;
 
   while(input[i] != '\"') {
     char curChar = input[i];
@@ -108,14 +169,115 @@ int handle_string(int i, char *input, vect_t *output) {
     i++;
   }
 
-  if(buffer[bufferIdx-1] == '\\'){
-    buffer[bufferIdx-1] = '\0';
+  if(bufferIdx > 1 && buffer[bufferIdx-1] == '\\'){
+    bufferIdx--;
+  }
+  buffer[bufferIdx] = '\0';
+
+  // A string with a substitution or variable keeps its quotes, so what it
+  // expands to isn't split into words, and so does one with a ' in it, so
+  // the expansion doesn't take that for a single quote
+  if(strpbrk(buffer + 1, "$`'") != NULL){
+    buffer[bufferIdx] = '\"';
+    buffer[bufferIdx + 1] = '\0';
+    vect_add(output, buffer);
   }
   else{
-    buffer[bufferIdx] = '\0';
+    vect_add(output, buffer + 1);
   }
-
-  vect_add(output, buffer);
   free(buffer);
   return i;
 }
+
+// Copies a $(...) or `...` command substitution into the word buffer
+// Returns the index of the closing ) or `
+int handle_substitution(int i, char *input, char *buffer, int *bufferIdx) {
+  int len = strlen(input);
+
+  // Backticks do not nest so just copy up to the next one
+  if (input[i] == '`') {
+    buffer[(*bufferIdx)++] = input[i++];
+    while (i < len && input[i] != '`') {
+      buffer[(*bufferIdx)++] = input[i++];
+    }
+    if (i < len) {
+      buffer[(*bufferIdx)++] = input[i];
+    }
+    return i;
+  }
+
+  // Copy the $( and keep track of how deep the parentheses go
+  buffer[(*bufferIdx)++] = input[i++];
+  buffer[(*bufferIdx)++] = input[i++];
+  int depth = 1;
+  while (i < len) {
+    if (input[i] == '(') {
+      depth++;
+    }
+    else if (input[i] == ')') {
+      depth--;
+    }
+    buffer[(*bufferIdx)++] = input[i];
+    if (depth == 0) {
+      break;
+    }
+    i++;
+  }
+  return i;
+}
+
+// Adds a redirection operator like >, 2>>, 2>& or &> as one token
+// A word of only digits right before it is the fd being redirected
+// Returns the index of the last character of the operator
+int handle_redirection(int i, char *input, vect_t *output, char *buffer, int *bufferIdx) {
+  int fdLen = 0;
+  if (input[i] != '&' && *bufferIdx > 0) {
+    fdLen = *bufferIdx;
+    for (int k = 0; k < *bufferIdx; k++) {
+      if (!isdigit((unsigned char) buffer[k])) {
+	fdLen = 0;
+      }
+    }
+  }
+
+  // Anything else in the buffer is a word of its own
+  if (fdLen == 0 && *bufferIdx > 0) {
+    buffer[*bufferIdx] = '\0';
+    vect_add(output, buffer);
+  }
+
+  char *op = (char *) malloc(fdLen + 4);
+  memcpy(op, buffer, fdLen);
+  int opLen = fdLen;
+  *bufferIdx = 0;
+
+  // &> and &>>
+  if (input[i] == '&') {
+    op[opLen++] = input[i++];
+    op[opLen++] = input[i];
+    if (input[i+1] == '>') {
+      op[opLen++] = input[++i];
+    }
+  }
+  // << for a here-document, <<- to strip its tabs, and <<< for a here-string
+  else if (input[i] == '<' && input[i+1] == '<') {
+    op[opLen++] = input[i++];
+    op[opLen++] = input[i];
+    if (input[i+1] == '<' || input[i+1] == '-') {
+      op[opLen++] = input[++i];
+    }
+  }
+  // >>, >& and <&, and <> only with an fd so a bare < > stays two tokens
+  else {
+    op[opLen++] = input[i];
+    if ((input[i] == '>' && (input[i+1] == '>' || input[i+1] == '&'))
+	|| (input[i] == '<' && (input[i+1] == '&' || (input[i+1] == '>' && fdLen > 0)))) {
+      op[opLen++] = input[++i];
+    }
+  }
+  op[opLen] = '\0';
+
+  vect_add(output, op);
+  free(op);
+  return i;
+}
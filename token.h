@@ -8,4 +8,10 @@ vect_t *parseInput(char *input);
 int handle_string(int i, char *input, vect_t *output);
 
 int isSpecialChar(char c);
+
+// Copies a $(...) or `...` command substitution into the word buffer
+int handle_substitution(int i, char *input, char *buffer, int *bufferIdx);
+
+// Adds a redirection operator like >, 2>>, 2>& or &> as one token
+int handle_redirection(int i, char *input, vect_t *output, char *buffer, int *bufferIdx);
 #endif /* ifndef _TOKEN_H */
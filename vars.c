@@ -0,0 +1,183 @@
+#define _GNU_SOURCE
+#include <assert.h>
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "vect.h"
+#include "vars.h"
+
+// Names and values of the shell variables, matched up by index
+static vect_t *names = NULL;
+static vect_t *values = NULL;
+
+// Names of the arrays and their values, matched up by index
+static vect_t *arrayNames = NULL;
+static vect_t **arrays = NULL;
+
+// Looks up element n of an array from "name[n]", or element 0 from a name
+// alone, setting found when the name is an array
+const char *getElement(const char *name, int *found);
+
+// Looks up element n of an array from "name[n]", or element 0 from a name
+// alone, setting found when the name is an array
+const char *getElement(const char *name, int *found) {
+  *found = 0;
+  if (arrayNames == NULL) {
+    return NULL;
+  }
+
+  const char *bracket = strchr(name, '[');
+  char *arrayName = bracket == NULL ? strdup(name) : strndup(name, bracket - name);
+  vect_t *array = getArray(arrayName);
+  free(arrayName);
+  if (array == NULL) {
+    return NULL;
+  }
+
+  unsigned int n = 0;
+  if (bracket != NULL) {
+    char *end;
+    n = strtoul(bracket + 1, &end, 10);
+    if (!isdigit((unsigned char) bracket[1]) || strcmp(end, "]") != 0) {
+      return NULL;
+    }
+  }
+  *found = 1;
+  return n < vect_size(array) ? vect_get(array, n) : NULL;
+}
+
+const char *getVar(const char *name) {
+  int idx = names == NULL ? -1 : indexOf(names, name);
+  if (idx != -1) {
+    return vect_get(values, idx);
+  }
+
+  // Variables the shell hasn't set come from the environment
+  int found;
+  const char *element = getElement(name, &found);
+  return found ? element : getenv(name);
+}
+
+void setVar(const char *name, const char *value) {
+  if (names == NULL) {
+    names = vect_new();
+    values = vect_new();
+  }
+
+  int idx = indexOf(names, name);
+  if (idx == -1) {
+    vect_add(names, name);
+    vect_add(values, value);
+  }
+  else {
+    vect_set(values, idx, value);
+  }
+}
+
+void unsetVar(const char *name) {
+  if (names == NULL) {
+    return;
+  }
+
+  int idx = indexOf(names, name);
+  if (idx == -1) {
+    return;
+  }
+
+  // Move the last variable into the hole so the vectors stay packed
+  int last = vect_size(names) - 1;
+  if (idx != last) {
+    vect_set(names, idx, vect_get(names, last));
+    vect_set(values, idx, vect_get(values, last));
+  }
+  vect_remove_last(names);
+  vect_remove_last(values);
+}
+
+void setArray(const char *name, vect_t *array) {
+  if (arrayNames == NULL) {
+    arrayNames = vect_new();
+  }
+
+  int idx = indexOf(arrayNames, name);
+  if (idx == -1) {
+    idx = vect_size(arrayNames);
+    vect_add(arrayNames, name);
+    arrays = realloc(arrays, vect_size(arrayNames) * sizeof(vect_t *));
+  }
+  else {
+    vect_delete(arrays[idx]);
+  }
+  arrays[idx] = array;
+}
+
+vect_t *getArray(const char *name) {
+  int idx = arrayNames == NULL ? -1 : indexOf(arrayNames, name);
+  return idx == -1 ? NULL : arrays[idx];
+}
+
+void unsetArray(const char *name) {
+  int idx = arrayNames == NULL ? -1 : indexOf(arrayNames, name);
+  if (idx == -1) {
+    return;
+  }
+
+  // Same as unsetVar, the last array fills the hole
+  vect_delete(arrays[idx]);
+  int last = vect_size(arrayNames) - 1;
+  if (idx != last) {
+    vect_set(arrayNames, idx, vect_get(arrayNames, last));
+    arrays[idx] = arrays[last];
+  }
+  vect_remove_last(arrayNames);
+}
+
+int isVarName(const char *name, int len) {
+  if (len <= 0 || (name[0] >= '0' && name[0] <= '9')) {
+    return 0;
+  }
+
+  for (int i = 0; i < len; i++) {
+    char c = name[i];
+    if (!((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z')
+	  || (c >= '0' && c <= '9') || c == '_')) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+int isAssignment(const char *word) {
+  const char *equals = strchr(word, '=');
+  return equals != NULL && isVarName(word, equals - word);
+}
+
+void assignVar(const char *word) {
+  assert(isAssignment(word));
+
+  const char *equals = strchr(word, '=');
+  char *name = strndup(word, equals - word);
+  setVar(name, equals + 1);
+  free(name);
+}
+
+void clearVars() {
+  if (arrayNames != NULL) {
+    for (int i = 0; i < vect_size(arrayNames); i++) {
+      vect_delete(arrays[i]);
+    }
+    vect_delete(arrayNames);
+    free(arrays);
+    arrayNames = NULL;
+    arrays = NULL;
+  }
+
+  if (names == NULL) {
+    return;
+  }
+  vect_delete(names);
+  vect_delete(values);
+  names = NULL;
+  values = NULL;
+}
@@ -0,0 +1,39 @@
+#ifndef _VARS_H
+#define _VARS_H
+
+#include "vect.h"
+
+/** Get the value of a shell variable, falling back to the environment.
+ *  "name[n]" is element n of an array, and the name of an array alone is
+ *  its first element. Returns NULL if it is set in neither. */
+const char *getVar(const char *name);
+
+/** Set a shell variable, replacing any previous value. */
+void setVar(const char *name, const char *value);
+
+/** Remove a shell variable. */
+void unsetVar(const char *name);
+
+/** Replaces the array with the values, which the array keeps. Arrays are
+ *  kept apart from the other variables so elements are found by index. */
+void setArray(const char *name, vect_t *values);
+
+/** Get the values of an array, or NULL if there is no such array. */
+vect_t *getArray(const char *name);
+
+/** Remove an array. */
+void unsetArray(const char *name);
+
+/** Checks if the string is a valid variable name. */
+int isVarName(const char *name, int len);
+
+/** Checks if the word is a NAME=value assignment. */
+int isAssignment(const char *word);
+
+/** Sets the variable from a NAME=value assignment. */
+void assignVar(const char *word);
+
+/** Delete every variable, freeing all memory they occupy. */
+void clearVars();
+
+#endif /* ifndef _VARS_H */
@@ -14,6 +14,7 @@
 #include <string.h>
 
 #include "vect.h"
+#include "stats.h"
 
 /** Main data structure for the vector. */
 struct vect {
@@ -30,6 +31,7 @@ vect_t *vect_new() {
   v->size = 0;
   v->capacity = VECT_INITIAL_CAPACITY;
   v->data = malloc(v->capacity * sizeof(char*));
+  countStat(STAT_VECT_ALLOCS, 1);
   
   return v;
 }
@@ -73,17 +75,24 @@ void vect_set(vect_t *v, unsigned int idx, const char *elt) {
 
 /** Add an element to the back of the vector. */
 void vect_add(vect_t *v, const char *elt) {
+  vect_add_len(v, elt, strlen(elt));
+}
+
+/** Add the first len bytes of elt to the back of the vector. */
+void vect_add_len(vect_t *v, const char *elt, size_t len) {
   assert(v != NULL);
 
   if (v->size == v->capacity) {
     v->capacity = v->capacity * VECT_GROWTH_FACTOR;
     v->data = realloc(v->data, v->capacity * sizeof(char*));
+    countStat(STAT_VECT_REALLOCS, 1);
   }
   // Allocate memory for the new data
-  v->data[v->size] = malloc(strlen(elt) + 1);
+  v->data[v->size] = malloc(len + 1);
 
   // Copies the element to add to the allocated memory
-  strncpy(v->data[v->size], elt, strlen(elt) + 1);
+  memcpy(v->data[v->size], elt, len);
+  v->data[v->size][len] = '\0';
   v->size++;
 }
 
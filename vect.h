@@ -2,6 +2,7 @@
 #define _VECT_H
 
 #include <limits.h>
+#include <stddef.h>
 
 /** Type of a vector (fields are hidden). */
 typedef struct vect vect_t;
@@ -25,6 +26,10 @@ void vect_set(vect_t *v, unsigned int idx, const char *elt);
 /** Add an element to the back of the vector. */
 void vect_add(vect_t *v, const char *elt);
 
+/** Add the first len bytes of elt to the back of the vector, for text
+ *  that isn't terminated where the element ends. */
+void vect_add_len(vect_t *v, const char *elt, size_t len);
+
 /** Remove the last element from the vector. */
 void vect_remove_last(vect_t *v);
 
@@ -0,0 +1,296 @@
+#define _GNU_SOURCE
+#include <assert.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "vect.h"
+#include "shell.h"
+#include "xargs.h"
+#include "stats.h"
+#include "readbuf.h"
+
+extern char **environ;
+
+// How items are separated on stdin
+enum xargs_split {
+  SPLIT_BLANKS,
+  SPLIT_DELIM
+};
+
+/** State of one run of the xargs built in. */
+typedef struct xargs {
+  vect_t *batch;         /* The command words followed by the items so far. */
+  unsigned int fixed;    /* Number of command words at the start of batch. */
+  size_t budget;         /* Bytes of arguments one exec can take. */
+  size_t base;           /* Bytes the command words take up. */
+  size_t used;           /* Bytes the whole batch takes up. */
+  size_t maxArg;         /* Longest single argument the kernel accepts. */
+  int maxItems;          /* Most items per run, 0 for no limit. */
+  int jobs;              /* Most runs at the same time. */
+  pid_t *running;        /* Runs that haven't been waited for, oldest first. */
+  int runningCount;
+  int result;
+} xargs_t;
+
+// Bytes an argument takes up in an exec, the string and its pointer
+size_t argCost(size_t len);
+
+// Turns the -d argument into the delimiter, understanding \n, \t and \0
+int parseDelimiter(const char *arg, char *delim);
+
+// Records how a run ended in the overall result
+void recordRun(xargs_t *x, int wstatus);
+
+// Waits for the oldest run to finish
+void waitRun(xargs_t *x);
+
+// Runs the command with the items in the batch and starts a new batch
+void runBatch(xargs_t *x);
+
+// Adds an item, running the batch first when the item doesn't fit
+void addItem(xargs_t *x, const char *item, size_t len);
+
+// Bytes an argument takes up in an exec, the string and its pointer
+size_t argCost(size_t len) {
+  return len + 1 + sizeof(char *);
+}
+
+// Turns the -d argument into the delimiter, understanding \n, \t and \0
+int parseDelimiter(const char *arg, char *delim) {
+  if (strlen(arg) == 1) {
+    *delim = arg[0];
+    return 0;
+  }
+  if (strcmp(arg, "\\n") == 0) {
+    *delim = '\n';
+    return 0;
+  }
+  if (strcmp(arg, "\\t") == 0) {
+    *delim = '\t';
+    return 0;
+  }
+  if (strcmp(arg, "\\0") == 0) {
+    *delim = '\0';
+    return 0;
+  }
+  return -1;
+}
+
+// Records how a run ended in the overall result
+// Not being able to run the command at all wins over a run failing
+void recordRun(xargs_t *x, int wstatus) {
+  int result = exitStatus(wstatus);
+  if (result == 127) {
+    x->result = 127;
+  }
+  else if (result != 0 && x->result == 0) {
+    x->result = 123;
+  }
+}
+
+// Waits for the oldest run to finish
+// Only our own children are waited for so a pipeline the built in is part
+// of doesn't lose its status
+void waitRun(xargs_t *x) {
+  int wstatus = 0;
+  countedWaitpid(x->running[0], &wstatus, 0);
+  recordRun(x, wstatus);
+
+  x->runningCount--;
+  memmove(x->running, x->running + 1, x->runningCount * sizeof(pid_t));
+}
+
+// Runs the command with the items in the batch and starts a new batch
+void runBatch(xargs_t *x) {
+  if (vect_size(x->batch) == x->fixed) {
+    return;
+  }
+
+  while (x->runningCount >= x->jobs) {
+    waitRun(x);
+  }
+
+  int pid = countedFork();
+  if (pid == 0) {
+    // The items come from stdin so the command doesn't get to read it
+    int devnull = open("/dev/null", O_RDONLY);
+    dup2(devnull, STDIN_FILENO);
+    close(devnull);
+    execProgram(x->batch);
+  }
+  else if (pid < 0) {
+    perror("xargs: fork failed");
+    x->result = 1;
+  }
+  else {
+    x->running[x->runningCount++] = pid;
+  }
+
+  // Start the next batch with just the command words
+  while (vect_size(x->batch) > x->fixed) {
+    vect_remove_last(x->batch);
+  }
+  x->used = x->base;
+}
+
+// Adds an item, running the batch first when the item doesn't fit
+void addItem(xargs_t *x, const char *item, size_t len) {
+  size_t cost = argCost(len);
+  if (len + 1 > x->maxArg || x->base + cost > x->budget) {
+    fprintf(stderr, "xargs: argument too long, skipping it\n");
+    x->result = 1;
+    return;
+  }
+
+  if (x->used + cost > x->budget) {
+    runBatch(x);
+  }
+  vect_add(x->batch, item);
+  x->used += cost;
+
+  if (x->maxItems > 0 && vect_size(x->batch) - x->fixed == x->maxItems) {
+    runBatch(x);
+  }
+}
+
+int xargsCmd(vect_t *tokens) {
+  int split = SPLIT_BLANKS;
+  char delim = '\n';
+  int maxItems = 0;
+  int jobs = 1;
+
+  int i = 1;
+  while (i < vect_size(tokens) && vect_get(tokens, i)[0] == '-') {
+    const char *opt = vect_get(tokens, i);
+    const char *arg = i + 1 < vect_size(tokens) ? vect_get(tokens, i + 1) : NULL;
+
+    if (strcmp(opt, "--") == 0) {
+      i++;
+      break;
+    }
+    else if (strcmp(opt, "-0") == 0) {
+      split = SPLIT_DELIM;
+      delim = '\0';
+      i++;
+    }
+    else if (strcmp(opt, "-d") == 0 && arg != NULL && parseDelimiter(arg, &delim) == 0) {
+      split = SPLIT_DELIM;
+      i += 2;
+    }
+    else if (strcmp(opt, "-n") == 0 && arg != NULL && atoi(arg) > 0) {
+      maxItems = atoi(arg);
+      i += 2;
+    }
+    else if (strcmp(opt, "-P") == 0 && arg != NULL && atoi(arg) > 0) {
+      jobs = atoi(arg);
+      i += 2;
+    }
+    else {
+      fprintf(stderr, "usage: xargs [-0] [-d DELIM] [-n MAX] [-P JOBS] [command [args...]]\n");
+      return 1;
+    }
+  }
+
+  xargs_t x;
+  x.batch = copy_vect_after(NULL, tokens, i);
+  if (vect_size(x.batch) == 0) {
+    vect_add(x.batch, "echo");
+  }
+  x.fixed = vect_size(x.batch);
+  x.maxItems = maxItems;
+  x.jobs = jobs;
+  x.running = malloc(jobs * sizeof(pid_t));
+  x.runningCount = 0;
+  x.result = 0;
+  x.maxArg = XARGS_MAX_ARG_PAGES * sysconf(_SC_PAGESIZE);
+
+  // The environment shares the ARG_MAX budget with the arguments
+  size_t envBytes = sizeof(char *);
+  for (char **env = environ; *env != NULL; env++) {
+    envBytes += argCost(strlen(*env));
+  }
+  long argMax = sysconf(_SC_ARG_MAX);
+
+  // The command words, the /bin/ added in front of the command and the
+  // NULL at the end of argv go in every run
+  x.base = sizeof(char *) + strlen("/bin/");
+  for (int w = 0; w < x.fixed; w++) {
+    x.base += argCost(strlen(vect_get(x.batch, w)));
+  }
+  x.used = x.base;
+
+  if (argMax <= 0 || envBytes + XARGS_HEADROOM + x.base >= (size_t) argMax) {
+    fprintf(stderr, "xargs: the environment and command leave no room for arguments\n");
+    vect_delete(x.batch);
+    free(x.running);
+    return 1;
+  }
+  x.budget = argMax - envBytes - XARGS_HEADROOM;
+
+  // Items can be split across reads so they are collected here
+  char *buffer = (char *) malloc(XARGS_READ_SIZE);
+  size_t itemCap = 256;
+  size_t itemLen = 0;
+  char *item = (char *) malloc(itemCap);
+
+  while (1) {
+    // What the shell read ahead from stdin comes before the rest of it
+    ssize_t n = takeReadAhead(STDIN_FILENO, buffer, XARGS_READ_SIZE);
+    if (n == 0) {
+      n = read(STDIN_FILENO, buffer, XARGS_READ_SIZE);
+    }
+    if (n == 0) {
+      break;
+    }
+    if (n == -1) {
+      if (errno == EINTR) {
+	continue;
+      }
+      perror("xargs: read");
+      x.result = 1;
+      break;
+    }
+
+    for (ssize_t b = 0; b < n; b++) {
+      char c = buffer[b];
+      int ends = split == SPLIT_DELIM ? c == delim : (c == ' ' || c == '\t' || c == '\n');
+      if (ends) {
+	// Runs of blanks don't make empty items, but two delimiters do
+	if (itemLen > 0 || split == SPLIT_DELIM) {
+	  item[itemLen] = '\0';
+	  addItem(&x, item, itemLen);
+	}
+	itemLen = 0;
+	continue;
+      }
+
+      if (itemLen + 1 >= itemCap) {
+	itemCap = itemCap * 2;
+	item = realloc(item, itemCap);
+      }
+      item[itemLen++] = c;
+    }
+  }
+
+  // The last item doesn't need a delimiter after it
+  if (itemLen > 0) {
+    item[itemLen] = '\0';
+    addItem(&x, item, itemLen);
+  }
+  runBatch(&x);
+  while (x.runningCount > 0) {
+    waitRun(&x);
+  }
+
+  free(buffer);
+  free(item);
+  free(x.running);
+  vect_delete(x.batch);
+  return x.result;
+}
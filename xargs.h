@@ -0,0 +1,29 @@
+#ifndef _XARGS_H
+#define _XARGS_H
+
+#include "vect.h"
+
+/** Size of each read from stdin while looking for items. */
+#define XARGS_READ_SIZE (64 * 1024)
+
+/** Bytes of the ARG_MAX budget left unused, like xargs does, so the
+ *  command still has some room when it starts. */
+#define XARGS_HEADROOM 2048
+
+/** Linux refuses any single argument longer than this many pages. */
+#define XARGS_MAX_ARG_PAGES 32
+
+/** Runs the xargs built in:
+ *
+ *    xargs [-0] [-d DELIM] [-n MAX] [-P JOBS] [command [args...]]
+ *
+ *  Items are read from stdin, split on blanks and newlines by default, on
+ *  NUL bytes with -0 or on DELIM with -d (which understands \n, \t and \0).
+ *  Each run of the command (echo when none is given) gets as many items as
+ *  fit in sysconf(_SC_ARG_MAX) after the environment, or at most MAX with
+ *  -n. With -P up to JOBS runs happen at once.
+ *  Returns 0 when every run succeeded, 127 if the command couldn't be run
+ *  and 123 if any run failed. */
+int xargsCmd(vect_t *tokens);
+
+#endif /* ifndef _XARGS_H */